@@ -0,0 +1,48 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#include "AllocationCounter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+	std::atomic<size_t> allocations(0);
+
+	void* allocate(size_t iSize)
+	{
+		allocations.fetch_add(1, std::memory_order_relaxed);
+		return std::malloc(iSize ? iSize : 1);
+	}
+}
+
+size_t allocation_count() { return allocations.load(std::memory_order_relaxed); }
+
+void* operator new(size_t iSize)
+{
+	if(void* p = allocate(iSize)) return p;
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t iSize)
+{
+	if(void* p = allocate(iSize)) return p;
+	throw std::bad_alloc();
+}
+
+void* operator new(size_t iSize, const std::nothrow_t&) noexcept { return allocate(iSize); }
+void* operator new[](size_t iSize, const std::nothrow_t&) noexcept { return allocate(iSize); }
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
@@ -0,0 +1,21 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#ifndef CEP_ALLOCATIONCOUNTER_H_
+#define CEP_ALLOCATIONCOUNTER_H_
+
+#include <cstddef>
+
+/** Allocations made so far through the global operator new, by every thread.
+ *
+ * Linking AllocationCounter.cpp replaces all the forms of the global operators
+ * new and delete with counting ones. They live in a translation unit of their
+ * own so that the compiler never pairs an inlined delete with a new expression. */
+size_t allocation_count();
+
+#endif /* CEP_ALLOCATIONCOUNTER_H_ */
@@ -0,0 +1,1606 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <chrono>
+#include <cmath>
+#include <vector>
+#include <cstdlib>
+#include <thread>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <CompactExpressionParser/Expression.h>
+#include <CompactExpressionParser/BatchEvaluator.h>
+#include <CompactExpressionParser/ExpressionCache.h>
+#include <CompactExpressionParser/ExpressionProgram.h>
+#include <CompactExpressionParser/Profile.h>
+#include <CompactExpressionParser/ProgramBundle.h>
+#include <CompactExpressionParser/IncrementalEvaluator.h>
+#include <CompactExpressionParser/StaticExpression.hpp>
+#include <CompactExpressionParser/SyntaxTree.h>
+#include "AllocationCounter.h"
+#include "BenchmarkReport.h"
+#include "RowStream.h"
+
+using CompactExpressionParser::Expression;
+using CompactExpressionParser::ResultType;
+using CompactExpressionParser::ArgumentSpan;
+using CompactExpressionParser::EvaluationContext;
+using CompactExpressionParser::RuntimeFunction;
+
+// Every measure of the run, saved with --json and compared with --baseline
+static BenchmarkReport report;
+
+// Name of a measure taken on an expression
+std::string measure_name(const std::string& iSection, const std::string& iExpression)
+{
+	return iSection + "/" + (iExpression.size() > 40 ? iExpression.substr(0, 37) + "..." : iExpression);
+}
+
+struct Pi { ResultType operator()(const std::vector<ResultType>&) { return std::atan2(0.,-1.); } };
+struct Cosinus { ResultType operator()(const std::vector<ResultType>& args) { return std::cos(args[0]); } };
+struct Sinus { ResultType operator()(const std::vector<ResultType>& args) { return std::sin(args[0]); } };
+struct Arctan2 { ResultType operator()(const std::vector<ResultType>& args) { return std::atan2(args[0],args[1]); } };
+struct UserArg
+{
+	double m_value;
+	UserArg() : m_value(0.) {}
+	ResultType operator()(const std::vector<ResultType>&) { return m_value; }
+};
+
+// Counts its calls
+struct Counter
+{
+	int m_calls;
+	Counter() : m_calls(0) {}
+	ResultType operator()(const std::vector<ResultType>&) { return ++m_calls; }
+};
+
+// Counts its calls, and gives a string past 500
+struct Naming
+{
+	int m_calls;
+	Naming() : m_calls(0) {}
+	ResultType operator()(const std::vector<ResultType>& args) { ++m_calls; return double(args[0]) > 500. ? ResultType(std::string("large")) : args[0]; }
+};
+
+struct VectorSinus
+{
+	void operator()(const double* const* args, size_t count, double* results) { for(size_t i = 0; i < count; ++i) results[i] = std::sin(args[0][i]); }
+};
+
+struct Hypot { ResultType operator()(const ArgumentSpan& args) const { return std::sqrt(double(args[0])*args[0] + double(args[1])*args[1]); } };
+
+struct Length { ResultType operator()(const std::vector<ResultType>& args) { return static_cast<double>(args[0].StringView().size()); } };
+
+// Expressions evaluated by every backend, results must agree
+const char* const eval_corpus[] = {
+	"4+3*2",
+	"4 + 3 * 2 / 13.21^(-1.) - (25-2)*1.7",
+	"sin(Pi()/2)",
+	"atan2(0,-1)",
+	"cos(2*Pi()/3)",
+	"2--1",
+	"4 + 3*x - y",
+	"Length(\"Coucou Roger/mon\\\\Pote\")",
+	"((((1+2)*3-4)/5)^2 + sin(1)*cos(2) - atan2(3,4))*10",
+	"hypot(3, 4*x) + hypot(sin(y), Pi())",
+	"x > 0.5 ? hypot(x, y) : sin(y)*2 + (x <= y)",
+	"(x < y && y != 0 || x == 1) + hypot(x, y)*(y >= 0)",
+	nullptr
+};
+
+void register_functions(Expression& ioExp)
+{
+	ioExp.register_function("Pi", Pi());
+	ioExp.register_function("cos", Cosinus());
+	ioExp.register_function("sin", Sinus());
+	ioExp.register_function("atan2", Arctan2());
+	ioExp.register_function("Length", Length());
+	ioExp.register_function("hypot", Hypot());
+}
+
+// Builds "((((1+1)*2)-3)/4)..." with iDepth nested groups
+std::string nested_expression(int iDepth)
+{
+	static const char ops[] = { '+', '*', '-', '/' };
+	std::ostringstream out;
+	out << std::string(iDepth, '(') << 1;
+	for(int i = 0; i < iDepth; ++i) out << ops[i % 4] << (i % 7 + 1) << ')';
+	return out.str();
+}
+
+// Builds "1+2*3-4/5^1+..." with iLength operands
+std::string long_expression(int iLength)
+{
+	static const char ops[] = { '+', '*', '-', '/', '^' };
+	std::ostringstream out;
+	out << 1;
+	for(int i = 1; i < iLength; ++i) out << ops[i % 5] << (i % 5 == 4 ? 1 : i % 9 + 1);
+	return out.str();
+}
+
+// Builds "x0+x1+x2+..." with iCount distinct variables
+std::string names_expression(int iCount)
+{
+	std::ostringstream out;
+	out << "x0";
+	for(int i = 1; i < iCount; ++i) out << "+x" << i;
+	return out.str();
+}
+
+// Sum of iTerms variables nested to the left, deeper than the native stack would allow to walk
+bool bench_deep_output(int iTerms)
+{
+	std::string source = "x";
+	for(int i = 1; i < iTerms; ++i) source += "+x";
+	Expression exp;
+	exp.variables()["x"] = 0.5;
+	if(!exp.compile(source) || exp() != iTerms * 0.5)
+	{
+		std::cerr << "Failed to lower a sum of " << iTerms << " terms" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Average time of one compilation of iExpression, in microseconds
+double time_compile(const std::string& iExpression)
+{
+	typedef std::chrono::steady_clock clock;
+	Expression exp;
+	register_functions(exp);
+	int runs = 0;
+	clock::time_point start = clock::now();
+	clock::duration elapsed;
+	do
+	{
+		if(!exp.compile(iExpression))
+		{
+			std::cerr << "Failed to compile a generated expression" << std::endl;
+			return -1.;
+		}
+		++runs;
+		elapsed = clock::now() - start;
+	} while(elapsed < std::chrono::milliseconds(100));
+	return std::chrono::duration<double, std::micro>(elapsed).count() / runs;
+}
+
+// Average time of one evaluation of ioExp, in nanoseconds
+double time_eval(Expression& ioExp)
+{
+	typedef std::chrono::steady_clock clock;
+	int runs = 0;
+	double sink = 0.;
+	clock::time_point start = clock::now();
+	clock::duration elapsed;
+	do
+	{
+		for(int i = 0; i < 1000; ++i) sink += ioExp();
+		runs += 1000;
+		elapsed = clock::now() - start;
+	} while(elapsed < std::chrono::milliseconds(100));
+	if(sink == 42.) std::cout << std::endl;
+	return std::chrono::duration<double, std::nano>(elapsed).count() / runs;
+}
+
+bool same_result(double iLeft, double iRight)
+{
+	return iLeft == iRight || (std::isnan(iLeft) && std::isnan(iRight));
+}
+
+void bench_compile_output(const std::string& iName, int iSize, const std::string& iExpression)
+{
+	double us = time_compile(iExpression);
+	std::ostringstream name;
+	name << "compile/" << iName << "/" << iSize;
+	report.add(name.str(), us, "us");
+	std::cout << std::setw(8) << iName << std::setw(8) << iSize << std::setw(10) << iExpression.size()
+		<< std::setw(14) << std::fixed << std::setprecision(2) << us
+		<< std::setw(12) << std::setprecision(1) << (us * 1000. / iExpression.size()) << std::endl;
+}
+
+// Memory held by the parsed tree, and allocations made to build it and to copy the expression
+bool bench_tree_output(const std::string& iExpression)
+{
+	Expression exp;
+	register_functions(exp);
+	size_t allocations = allocation_count();
+	if(!exp.compile(iExpression))
+	{
+		std::cerr << "Failed to compile " << iExpression << std::endl;
+		return false;
+	}
+	size_t compile_allocations = allocation_count() - allocations;
+	const CompactExpressionParser::SyntaxTree& tree = *exp.syntax_tree();
+
+	allocations = allocation_count();
+	size_t copy_allocations;
+	{
+		Expression copy(exp);
+		copy_allocations = allocation_count() - allocations;
+		if(copy.syntax_tree() != exp.syntax_tree() || copy.eval() != exp.eval())
+		{
+			std::cerr << "Copy of " << iExpression << " does not share its tree" << std::endl;
+			return false;
+		}
+	}
+
+	std::string shown = iExpression.size() > 60 ? iExpression.substr(0, 57) + "..." : iExpression;
+	std::cout << std::setw(8) << tree.size() << std::setw(12) << tree.memory() << std::setw(12) << compile_allocations
+		<< std::setw(12) << copy_allocations << "  " << shown << std::endl;
+	if(copy_allocations)
+		std::cerr << "Copying " << iExpression << " allocates" << std::endl;
+	return copy_allocations == 0;
+}
+
+// Checks that the backends agree before timing them, returns false on a mismatch
+bool bench_eval_output(const std::string& iExpression)
+{
+	Expression exp;
+	register_functions(exp);
+	if(!exp.compile(iExpression))
+	{
+		std::cerr << "Failed to compile " << iExpression << std::endl;
+		return false;
+	}
+	exp.variables()["x"] = 0.75; exp.variables()["y"] = -2.5;
+	exp.set_backend(Expression::TreeWalker);
+	double reference = exp();
+	exp.set_backend(Expression::VirtualMachine);
+	double result = exp();
+	exp.set_backend(Expression::Native);
+	double native = exp();
+	if(!same_result(reference, result) || !same_result(reference, native))
+	{
+		std::cerr << "Backends disagree on " << iExpression << ": " << reference << " != " << result << " != " << native << std::endl;
+		return false;
+	}
+
+	// Stacks are already grown by the first evaluation, string literals are shared
+	exp.set_backend(Expression::VirtualMachine);
+	size_t allocations = allocation_count();
+	for(int i = 0; i < 100; ++i) exp();
+	double allocations_per_eval = (allocation_count() - allocations) / 100.;
+	if(allocations_per_eval != 0.)
+		std::cerr << "Evaluating " << iExpression << " allocates" << std::endl;
+
+	exp.set_backend(Expression::TreeWalker);
+	double tree = time_eval(exp);
+	exp.set_backend(Expression::VirtualMachine);
+	double vm = time_eval(exp);
+	exp.set_backend(Expression::Native);
+	std::ostringstream jit;
+	if(exp.native_program()) jit << std::fixed << std::setprecision(1) << time_eval(exp);
+	else jit << "vm";
+	report.add(measure_name("eval/tree", iExpression), tree, "ns");
+	report.add(measure_name("eval/vm", iExpression), vm, "ns");
+	std::cout << std::setw(12) << std::fixed << std::setprecision(1) << tree << std::setw(12) << vm << std::setw(12) << jit.str()
+		<< std::setw(12) << allocations_per_eval << "  " << iExpression << std::endl;
+	return allocations_per_eval == 0.;
+}
+
+// String functions reading their arguments in place
+struct Echo { ResultType operator()(const ArgumentSpan& args) const { return args[0]; } };
+struct Size { ResultType operator()(const ArgumentSpan& args) const { return static_cast<double>(args[0].StringView().size()); } };
+struct Join
+{
+	ResultType operator()(const ArgumentSpan& args) const
+	{
+		boost::string_view left = args[0].StringView(), right = args[1].StringView();
+		return left.to_string().append(right.data(), right.size());
+	}
+};
+
+// Allocations and time of an evaluation passing strings around, on the tree walker and the virtual machine
+bool bench_string_output(const std::string& iExpression)
+{
+	Expression exp;
+	register_functions(exp);
+	exp.register_function("Echo", CompactExpressionParser::SpanFunctionType(Echo()));
+	exp.register_function("Size", CompactExpressionParser::SpanFunctionType(Size()));
+	exp.register_function("Join", CompactExpressionParser::SpanFunctionType(Join()));
+	if(!exp.compile(iExpression))
+	{
+		std::cerr << "Failed to compile " << iExpression << std::endl;
+		return false;
+	}
+	exp.variables()["x"] = 2.;
+	const Expression::Backend backends[] = { Expression::TreeWalker, Expression::VirtualMachine };
+	double ns[2], allocations[2], results[2];
+	for(int b = 0; b < 2; ++b)
+	{
+		exp.set_backend(backends[b]);
+		results[b] = exp();
+		size_t before = allocation_count();
+		for(int i = 0; i < 1000; ++i) exp();
+		allocations[b] = (allocation_count() - before) / 1000.;
+		ns[b] = time_eval(exp);
+	}
+	report.add(measure_name("strings/tree", iExpression), ns[0], "ns");
+	report.add(measure_name("strings/vm", iExpression), ns[1], "ns");
+	report.add(measure_name("strings/tree allocations", iExpression), allocations[0], "allocs");
+	report.add(measure_name("strings/vm allocations", iExpression), allocations[1], "allocs");
+	std::cout << std::setw(12) << std::fixed << std::setprecision(1) << ns[0] << std::setw(10) << allocations[0]
+		<< std::setw(12) << ns[1] << std::setw(10) << allocations[1] << "  " << iExpression << std::endl;
+	if(!same_result(results[0], results[1])) std::cerr << "Backends disagree on " << iExpression << std::endl;
+	return same_result(results[0], results[1]);
+}
+
+// Builds a sum of iLength operands, iDensity percent of them calling a function
+std::string function_expression(int iLength, int iDensity)
+{
+	static const char* const calls[] = { "sin(x*", "cos(", "hypot(x, ", "atan2(y, " };
+	std::ostringstream out;
+	for(int i = 0; i < iLength; ++i)
+	{
+		int k = i % 9 + 1;
+		if(i) out << (i % 3 ? " + " : " - ");
+		if(i * iDensity / 100 != (i + 1) * iDensity / 100) out << calls[i % 4] << k << ")";
+		else out << "x*" << k;
+	}
+	return out.str();
+}
+
+// Latency of one evaluation on the virtual machine, and rows per second of a batch over x and y
+bool bench_workload_output(const std::string& iName, const std::string& iExpression)
+{
+	Expression exp;
+	register_functions(exp);
+	if(!exp.compile(iExpression))
+	{
+		std::cerr << "Failed to compile " << iExpression << std::endl;
+		return false;
+	}
+	exp.variables()["x"] = 0.5; exp.variables()["y"] = 2.;
+	double latency_ns = time_eval(exp);
+
+	const size_t rows = 1 << 16;
+	std::vector<double> x(rows), y(rows), results(rows);
+	for(size_t i = 0; i < rows; ++i) { x[i] = (i % 1000) * 0.01; y[i] = (i % 77) * 0.5; }
+	std::vector<CompactExpressionParser::Column> columns;
+	CompactExpressionParser::Column column_x = { "x", x.data() }, column_y = { "y", y.data() };
+	columns.push_back(column_x);
+	columns.push_back(column_y);
+	typedef std::chrono::steady_clock clock;
+	clock::time_point start = clock::now();
+	exp.eval_batch(columns, rows, results.data());
+	double rows_per_second = rows / std::chrono::duration<double>(clock::now() - start).count();
+
+	exp.variables()["x"] = x[rows - 1]; exp.variables()["y"] = y[rows - 1];
+	bool status = same_result(exp(), results[rows - 1]);
+	report.add("workload/" + iName + "/latency", latency_ns, "ns");
+	report.add("workload/" + iName + "/throughput", rows_per_second, "rows/s", true);
+	std::cout << std::setw(12) << iName << std::setw(14) << std::fixed << std::setprecision(1) << latency_ns
+		<< std::setw(14) << std::setprecision(0) << rows_per_second << "  " << (status ? "same results" : "MISMATCH") << std::endl;
+	if(!status) std::cerr << "Batch disagrees with the virtual machine on " << iExpression << std::endl;
+	return status;
+}
+
+// Cost of copying a compiled expression, which shares its tree and program
+bool bench_copy_output(const std::string& iExpression)
+{
+	typedef std::chrono::steady_clock clock;
+	Expression exp;
+	register_functions(exp);
+	if(!exp.compile(iExpression)) return false;
+	const int copies = 100000;
+	double sink = 0.;
+	size_t allocations = allocation_count();
+	clock::time_point start = clock::now();
+	for(int i = 0; i < copies; ++i)
+	{
+		Expression copy(exp);
+		sink += copy.program()->code().size();
+	}
+	double copy_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count() / copies;
+	double allocations_per_copy = static_cast<double>(allocation_count() - allocations) / copies;
+	if(sink == 42.) std::cout << std::endl;
+	report.add(measure_name("copy", iExpression), copy_ns, "ns");
+	std::cout << std::setw(12) << std::fixed << std::setprecision(1) << copy_ns << std::setw(12) << allocations_per_copy
+		<< "  " << measure_name("copy", iExpression) << std::endl;
+	return allocations_per_copy == 0.;
+}
+
+// A runtime function kept as a call, its argument being volatile and read twice, against the same formula written in place
+bool bench_call_output()
+{
+	UserArg arg;
+	arg.m_value = 1.5;
+	Expression exp;
+	exp.register_function("Arg1", std::ref(arg));
+	RuntimeFunction twice(exp, "twice", CompactExpressionParser::Pure);
+	twice.compile("_1 + _1");
+	Expression hand(exp);
+	if(!exp.compile("twice(Arg1())") || !hand.compile("Arg1()*2") || exp.program()->functions().size() != 2) return false;
+	double call_ns = time_eval(exp), hand_ns = time_eval(hand);
+	report.add("call/runtime_function", call_ns, "ns");
+	report.add("call/hand", hand_ns, "ns");
+	std::cout << std::setw(12) << std::fixed << std::setprecision(1) << call_ns << std::setw(12) << hand_ns
+		<< std::setw(14) << call_ns - hand_ns << "  twice(Arg1()) against Arg1()*2" << std::endl;
+	return same_result(exp(), hand());
+}
+
+// Spins about iNanoseconds, standing for a costly user function
+struct Slow
+{
+	double m_ns;
+	explicit Slow(double iNanoseconds) : m_ns(iNanoseconds) {}
+	ResultType operator()(const ArgumentSpan& args) const
+	{
+		typedef std::chrono::steady_clock clock;
+		clock::time_point start = clock::now();
+		while(std::chrono::duration<double, std::nano>(clock::now() - start).count() < m_ns) {}
+		return double(args[0]) + 1.;
+	}
+};
+
+// Cost of evaluating with profiling off, sampled and on every evaluation, and whether the report finds the costly call
+bool bench_profile_output(const std::string& iExpression, size_t iPeriod)
+{
+	Expression exp;
+	register_functions(exp);
+	exp.register_function("slow", CompactExpressionParser::SpanFunctionType(Slow(2000.)));
+	exp.set_profiling(iPeriod);
+	if(!exp.compile(iExpression))
+	{
+		std::cerr << "Failed to compile " << iExpression << std::endl;
+		return false;
+	}
+	exp.variables()["x"] = 0.5;
+	double reference = Expression(exp).eval();
+	double profiled_ns = time_eval(exp);
+	const CompactExpressionParser::Profile& profile = *exp.profile();
+	bool status = same_result(exp(), reference) && profile.timed() == (profile.evaluations() + iPeriod - 1) / iPeriod;
+
+	std::vector<CompactExpressionParser::Profile::SpanCost> spans = profile.spans();
+	std::vector<CompactExpressionParser::Profile::FunctionCost> functions = profile.functions();
+	// The whole expression comes first, and the call spends most of the time by itself
+	size_t heaviest = 0;
+	for(size_t index = 1; index < spans.size(); ++index)
+		if(spans[index].self_ns > spans[heaviest].self_ns) heaviest = index;
+	status = spans.size() > 1 && spans[0].text == iExpression && spans[heaviest].text == "slow(x)" && status;
+	status = !functions.empty() && functions[0].name == "slow" && functions[0].ns > 1000. && status;
+
+	std::ostringstream name;
+	name << "profile/period " << iPeriod;
+	report.add(name.str(), profiled_ns, "ns");
+	std::cout << std::setw(8) << iPeriod << std::setw(14) << std::fixed << std::setprecision(1) << profiled_ns
+		<< std::setw(14) << profile.total_ns() << std::setw(12) << (functions.empty() ? 0. : functions[0].ns)
+		<< "  " << (status ? "slow(x) found" : "MISMATCH") << std::endl;
+	if(!status)
+	{
+		std::cerr << "Profile of " << iExpression << " misses slow(x)" << std::endl;
+		profile.report(std::cerr);
+	}
+	return status;
+}
+
+// Replays the examples of run_samples on every backend
+bool bench_examples_output()
+{
+	const char* const sources[] = { "4+3*2^(6+3)", "4 + 3*Arg1() - Arg2()", "Arg1() + Arg2()", "MyFunc1(2,2) + MyFunc2(10,2,3)",
+		"Print(\"\\nCoucou Roger/mon\\\\Pote\")", "MyFunc1(Arg1(), MyFunc2(Arg2(), sin(Arg1()), 3))", nullptr };
+	bool status = true;
+	for(const char* const* source = sources; *source; ++source)
+	{
+		UserArg arg1, arg2;
+		arg1.m_value = 10.; arg2.m_value = 14.;
+		Expression exp;
+		register_functions(exp);
+		exp.register_function("Arg1", std::ref(arg1));
+		exp.register_function("Arg2", std::ref(arg2));
+		exp.register_function("Print", Length());
+		RuntimeFunction f1(exp, "MyFunc1"), f2(exp, "MyFunc2");
+		f1.compile("_1 * _2");
+		f2.compile("_1 - _2*_3");
+		if(!exp.compile(*source))
+		{
+			std::cerr << "Failed to compile " << *source << std::endl;
+			status = false;
+			continue;
+		}
+		double results[3];
+		const Expression::Backend backends[] = { Expression::TreeWalker, Expression::VirtualMachine, Expression::Native };
+		for(int b = 0; b < 3; ++b)
+		{
+			exp.set_backend(backends[b]);
+			results[b] = exp();
+		}
+		if(!same_result(results[0], results[1]) || !same_result(results[0], results[2]))
+		{
+			std::cerr << "Backends disagree on " << *source << std::endl;
+			status = false;
+		}
+	}
+	// Variables of an expression that fails to compile are not declared
+	Expression broken;
+	broken.variables()["x"] = 1.;
+	if(broken.compile("x + y*z +") || broken.variables().size() != 1)
+	{
+		std::cerr << "Failing to compile declared variables" << std::endl;
+		status = false;
+	}
+	return status;
+}
+
+// Compares eval_batch against setting UserArg functors row by row
+bool bench_batch_output(const std::string& iExpression, bool iVectorized)
+{
+	const size_t rows = 1 << 20;
+	std::vector<double> column1(rows), column2(rows), batch(rows), scalar(rows);
+	for(size_t i = 0; i < rows; ++i) { column1[i] = (i % 1000) * 0.01; column2[i] = (i % 77) * 0.5; }
+
+	UserArg arg1, arg2;
+	Expression exp;
+	register_functions(exp);
+	if(iVectorized) exp.register_function("vsin", Sinus(), VectorSinus());
+	else exp.register_function("vsin", Sinus());
+	exp.register_function("Arg1", std::ref(arg1));
+	exp.register_function("Arg2", std::ref(arg2));
+	exp.compile(iExpression);
+
+	typedef std::chrono::steady_clock clock;
+	clock::time_point start = clock::now();
+	CompactExpressionParser::VariableSet& vars = exp.variables();
+	for(size_t i = 0; i < rows; ++i)
+	{
+		arg1.m_value = vars["x"] = column1[i]; arg2.m_value = vars["y"] = column2[i];
+		scalar[i] = exp();
+	}
+	double row_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count() / rows;
+
+	std::vector<CompactExpressionParser::Column> columns;
+	CompactExpressionParser::Column c1 = { "Arg1", column1.data() }, c2 = { "Arg2", column2.data() };
+	CompactExpressionParser::Column x = { "x", column1.data() }, y = { "y", column2.data() };
+	columns.push_back(x); columns.push_back(y);
+	columns.push_back(c1); columns.push_back(c2);
+	start = clock::now();
+	exp.eval_batch(columns, rows, batch.data());
+	double batch_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count() / rows;
+
+	for(size_t i = 0; i < rows; ++i)
+	{
+		if(!same_result(scalar[i], batch[i]))
+		{
+			std::cerr << "Batch disagrees on " << iExpression << " row " << i << ": " << scalar[i] << " != " << batch[i] << std::endl;
+			return false;
+		}
+	}
+
+	// A function giving a string partway through a block must not make the block call its functions again
+	Counter counter;
+	Naming naming;
+	Expression calls;
+	calls.register_function("Count", std::ref(counter));
+	calls.register_function("Name", std::ref(naming));
+	std::vector<double> numbers(1000), counted(numbers.size());
+	for(size_t i = 0; i < numbers.size(); ++i) numbers[i] = static_cast<double>(i);
+	CompactExpressionParser::Column number_column = { "x", numbers.data() };
+	std::vector<CompactExpressionParser::Column> number_columns(1, number_column);
+	bool counts = calls.compile("Count(x) + 0*Name(x)");
+	if(counts) calls.eval_batch(number_columns, numbers.size(), counted.data());
+	for(size_t i = 0; counts && i < counted.size(); ++i) counts = counted[i] == i + 1.;
+	if(!counts || counter.m_calls != 1000 || naming.m_calls != 1000)
+	{
+		std::cerr << "Batch called Count " << counter.m_calls << " and Name " << naming.m_calls << " times over 1000 rows" << std::endl;
+		return false;
+	}
+	std::string name = iExpression + (iVectorized ? " (vectorized)" : "");
+	report.add(measure_name("batch/row", name), row_ns, "ns");
+	report.add(measure_name("batch/column", name), batch_ns, "ns");
+	std::cout << std::setw(12) << std::fixed << std::setprecision(2) << row_ns << std::setw(12) << batch_ns << "  " << iExpression
+		<< (iVectorized ? " (vectorized vsin)" : "") << std::endl;
+	return true;
+}
+
+// Throws past a threshold, standing for a function failing in the middle of a batch
+struct Failing
+{
+	ResultType operator()(const ArgumentSpan& args) const
+	{
+		if(double(args[0]) > 10.) throw std::runtime_error("Failing");
+		return args[0];
+	}
+};
+
+// Columns bound by a batch that threw must not be read by the next evaluations of the context
+bool bench_batch_throw_output()
+{
+	UserArg arg;
+	arg.m_value = 7.;
+	Expression exp;
+	exp.register_function("Arg1", std::ref(arg));
+	exp.register_function("Failing", CompactExpressionParser::SpanFunctionType(Failing()));
+	std::vector<double> x(100), column(100, 100.), results(100);
+	for(size_t i = 0; i < x.size(); ++i) x[i] = static_cast<double>(i);
+	std::vector<CompactExpressionParser::Column> columns;
+	CompactExpressionParser::Column arg_column = { "Arg1", column.data() }, x_column = { "x", x.data() };
+	columns.push_back(arg_column);
+	columns.push_back(x_column);
+	bool thrown = false;
+	try
+	{
+		if(exp.compile("Arg1() + Failing(x)")) exp.eval_batch(columns, x.size(), results.data());
+	}
+	catch(const std::runtime_error&) { thrown = true; }
+	bool status = thrown && exp.compile("Arg1()") && exp() == 7.;
+	if(!status) std::cerr << "A batch that threw left its columns bound" << std::endl;
+	return status;
+}
+
+// One compiled expression evaluated by iThreads threads at once, each with its own context and frame
+bool bench_threads_output(const std::string& iExpression, unsigned iThreads)
+{
+	const size_t rows = 1 << 18;
+	Expression exp;
+	register_functions(exp);
+	// Nested and re-entrant runtime functions, called concurrently
+	RuntimeFunction product(exp, "product"), shifted(exp, "shifted");
+	product.compile("_1 * _2");
+	shifted.compile("product(_2, _1 + 1) - product(_1, 0.5)");
+	if(!exp.compile(iExpression))
+	{
+		std::cerr << "Failed to compile " << iExpression << std::endl;
+		return false;
+	}
+
+	CompactExpressionParser::VariableSet& vars = exp.variables();
+	size_t x = vars.declare("x"), y = vars.declare("y");
+	std::vector<double> serial(rows), parallel(rows);
+	{
+		EvaluationContext context;
+		std::vector<double> frame(vars.size());
+		for(size_t i = 0; i < rows; ++i)
+		{
+			frame[x] = (i % 1000) * 0.01; frame[y] = (i % 77) * 0.5;
+			serial[i] = exp.eval(context, frame.data());
+		}
+	}
+
+	typedef std::chrono::steady_clock clock;
+	clock::time_point start = clock::now();
+	std::vector<std::thread> threads;
+	for(unsigned t = 0; t < iThreads; ++t)
+	{
+		threads.push_back(std::thread([&, t]() {
+			EvaluationContext context;
+			std::vector<double> frame(vars.size());
+			for(size_t i = t; i < rows; i += iThreads)
+			{
+				frame[x] = (i % 1000) * 0.01; frame[y] = (i % 77) * 0.5;
+				parallel[i] = exp.eval(context, frame.data());
+			}
+		}));
+	}
+	for(std::thread& thread : threads) thread.join();
+	double seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+	for(size_t i = 0; i < rows; ++i)
+	{
+		if(!same_result(serial[i], parallel[i]))
+		{
+			std::cerr << "Threads disagree on " << iExpression << " row " << i << ": " << serial[i] << " != " << parallel[i] << std::endl;
+			return false;
+		}
+	}
+	std::ostringstream name;
+	name << "threads/" << iThreads;
+	report.add(name.str(), rows / seconds, "rows/s", true);
+	std::cout << std::setw(12) << iThreads << std::setw(14) << std::fixed << std::setprecision(0) << rows / seconds << "  " << iExpression << std::endl;
+	return true;
+}
+
+// Splits iExpression over a BatchEvaluator of iThreads workers, checked against Expression::eval_batch
+bool bench_parallel_output(const std::string& iExpression, unsigned iThreads)
+{
+	const size_t rows = 1 << 22;
+	std::vector<double> column1(rows), column2(rows), reference(rows), parallel(rows);
+	for(size_t i = 0; i < rows; ++i) { column1[i] = (i % 1000) * 0.01; column2[i] = (i % 77) * 0.5; }
+
+	Expression exp;
+	register_functions(exp);
+	exp.compile(iExpression);
+	std::vector<CompactExpressionParser::Column> columns;
+	CompactExpressionParser::Column x = { "x", column1.data() }, y = { "y", column2.data() };
+	columns.push_back(x); columns.push_back(y);
+	exp.eval_batch(columns, rows, reference.data());
+
+	CompactExpressionParser::BatchEvaluator evaluator(exp, iThreads);
+	typedef std::chrono::steady_clock clock;
+	clock::time_point start = clock::now();
+	evaluator.eval(columns, rows, parallel.data());
+	double seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+	// Streams the same rows by small blocks, reading and writing at the row index to check the order
+	size_t read = 0, written = 0;
+	bool ordered = true;
+	std::vector<std::string> names;
+	names.push_back("x"); names.push_back("y");
+	evaluator.eval_stream(names,
+		[&](double* const* oColumns, size_t iCapacity) {
+			size_t count = std::min(iCapacity, rows - read);
+			std::copy(column1.begin() + read, column1.begin() + read + count, oColumns[0]);
+			std::copy(column2.begin() + read, column2.begin() + read + count, oColumns[1]);
+			read += count;
+			return count;
+		},
+		[&](const double* iResults, size_t iRows) {
+			for(size_t i = 0; i < iRows; ++i, ++written) ordered = ordered && same_result(iResults[i], reference[written]);
+		},
+		100000);
+
+	for(size_t i = 0; i < rows; ++i)
+	{
+		if(!same_result(reference[i], parallel[i]))
+		{
+			std::cerr << "Parallel batch disagrees on " << iExpression << " row " << i << ": " << reference[i] << " != " << parallel[i] << std::endl;
+			return false;
+		}
+	}
+	if(!ordered || written != rows)
+	{
+		std::cerr << "Streamed batch disagrees on " << iExpression << std::endl;
+		return false;
+	}
+	std::ostringstream name;
+	name << "batch_evaluator/" << iThreads;
+	report.add(name.str(), rows / seconds, "rows/s", true);
+	std::cout << std::setw(12) << iThreads << std::setw(14) << std::fixed << std::setprecision(0) << rows / seconds << "  " << iExpression << std::endl;
+	return true;
+}
+
+// Updates one input at a time of a formula of iTerms terms, checking the incremental result against the virtual machine
+bool bench_incremental_output(int iTerms)
+{
+	typedef std::chrono::steady_clock clock;
+	std::ostringstream source;
+	for(int i = 0; i < iTerms; ++i) source << "(x" << i << "*1.5 - sin(x" << (i + 1) % iTerms << ")) + ";
+	source << "0*u + Arg1()";
+
+	UserArg arg;
+	Expression exp;
+	register_functions(exp);
+	exp.register_function("Arg1", std::ref(arg));
+	if(!exp.compile(source.str())) return false;
+	CompactExpressionParser::IncrementalEvaluator incremental(exp);
+	incremental.eval();
+
+	bool status = true;
+	int updates = 1000;
+	double incremental_ns = 0., full_ns = 0.;
+	size_t recomputed = 0;
+	for(int step = 0; step < updates; ++step)
+	{
+		std::ostringstream name;
+		name << "x" << (step * 7) % iTerms;
+		incremental.set(name.str(), std::sin(step * 0.1));
+		clock::time_point start = clock::now();
+		double result = incremental.eval();
+		incremental_ns += std::chrono::duration<double, std::nano>(clock::now() - start).count();
+		recomputed += incremental.recomputed();
+		start = clock::now();
+		double reference = exp();
+		full_ns += std::chrono::duration<double, std::nano>(clock::now() - start).count();
+		status = same_result(result, reference) && status;
+	}
+
+	// Changes that cannot reach the result stop on the way up, unchanged inputs compute nothing
+	incremental.set("u", 42.);
+	incremental.eval();
+	status = !incremental.changed() && incremental.recomputed() == 2 && status;
+	incremental.eval();
+	status = !incremental.changed() && incremental.recomputed() == 0 && status;
+	// Functions are called again once invalidated only
+	arg.m_value = 3.;
+	incremental.eval();
+	status = !incremental.changed() && status;
+	incremental.invalidate("Arg1");
+	status = same_result(incremental.eval(), exp()) && incremental.changed() && incremental.recomputed() == 2 && status;
+
+	std::ostringstream name;
+	name << "incremental/" << iTerms;
+	report.add(name.str() + "/full", full_ns / updates, "ns");
+	report.add(name.str() + "/update", incremental_ns / updates, "ns");
+	std::cout << std::setw(8) << iTerms << std::setw(12) << std::fixed << std::setprecision(1) << full_ns / updates
+		<< std::setw(14) << incremental_ns / updates << std::setw(12) << static_cast<double>(recomputed) / updates
+		<< "  " << (status ? "same results" : "MISMATCH") << std::endl;
+	if(!status) std::cerr << "Incremental evaluation disagrees" << std::endl;
+	return status;
+}
+
+// Calls to runtime functions, inlined when compiling, against the same formula expanded by hand
+bool bench_inline_output(const std::string& iCall, const std::string& iHand)
+{
+	Expression exp;
+	RuntimeFunction f1(exp, "f1", CompactExpressionParser::Pure), f2(exp, "f2", CompactExpressionParser::Pure),
+		f3(exp, "f3", CompactExpressionParser::Pure);
+	f1.compile("_1*_2 + 1");
+	f2.compile("f1(_1, _2) - f1(_2, 0.5)");
+	f3.compile("f2(_1 + 1, _2) * f2(_2, _1)");
+	Expression hand(exp);
+	if(!exp.compile(iCall) || !hand.compile(iHand))
+	{
+		std::cerr << "Failed to compile " << iCall << std::endl;
+		return false;
+	}
+	exp.variables()["x"] = 1.25;
+	exp.variables()["y"] = -3.5;
+	size_t call_code = exp.program()->code().size(), hand_code = hand.program()->code().size();
+	double call_ns = time_eval(exp), hand_ns = time_eval(hand);
+	double result = exp();
+	exp.set_backend(Expression::TreeWalker);
+	bool status = call_code == hand_code && same_result(result, hand()) && same_result(result, exp());
+	report.add(measure_name("inline/hand", iCall), hand_ns, "ns");
+	report.add(measure_name("inline/calls", iCall), call_ns, "ns");
+	std::cout << std::setw(12) << hand_code << std::setw(12) << call_code << std::setw(12) << std::fixed << std::setprecision(1)
+		<< hand_ns << std::setw(12) << call_ns << "  " << iCall << std::endl;
+	if(!status) std::cerr << "Inlined calls disagree with " << iHand << std::endl;
+	return status;
+}
+
+// Volatile arguments are neither repeated nor dropped, recursive calls are kept and volatile functions never inlined
+bool bench_inline_rules()
+{
+	using CompactExpressionParser::Pure;
+	Counter counter;
+	Expression exp;
+	exp.register_function("Count", std::ref(counter));
+	RuntimeFunction square(exp, "square", Pure), first(exp, "first", Pure), loop(exp, "loop", Pure);
+	square.compile("_1*_1");
+	first.compile("_1");
+	loop.compile("loop(_1 + 1)");
+
+	bool status = exp.compile("square(Count())") && exp() == 1. && counter.m_calls == 1;
+	status = exp.compile("first(2, Count())") && exp() == 2. && counter.m_calls == 2 && status;
+	status = exp.compile("square(x) + first(3)") && exp.program()->functions().empty() && status;
+	// Compiles to a call that would never end if evaluated
+	status = exp.compile("loop(1)") && exp.program()->functions().size() == 1 && status;
+
+	// Pure functions are defined once, callers of volatile ones run the current body
+	RuntimeFunction fact(exp, "fact", Pure), redefined(exp, "redefined");
+	status = fact.compile("_1 <= 1 ? 1 : _1 * fact(_1 - 1)") && !fact.compile("_1") && status;
+	status = redefined.compile("_1 <= 1 ? 1 : _1 * redefined(_1 - 1)") && status;
+	exp.variables()["x"] = 6.;
+	const Expression::Backend backends[] = { Expression::TreeWalker, Expression::VirtualMachine, Expression::Native };
+	for(Expression::Backend backend : backends)
+	{
+		exp.set_backend(backend);
+		status = exp.compile("fact(5) + fact(x) + redefined(x)") && exp() == 120. + 720. + 720. && status;
+	}
+	status = redefined.compile("_1 + 1") && exp() == 120. + 720. + 7. && status;
+	if(!status) std::cerr << "Inlining changed how volatile or recursive calls are made" << std::endl;
+	return status;
+}
+
+// Reads the first argument only, then the one it selects
+struct LazyChoose
+{
+	ResultType operator()(const CompactExpressionParser::LazyArguments& args) const { return args[double(args[0]) != 0. ? 1 : 2]; }
+};
+
+struct EagerChoose
+{
+	ResultType operator()(const ArgumentSpan& args) const { return args[double(args[0]) != 0. ? 1 : 2]; }
+};
+
+// Conditions checked on every evaluation path over a grid of inputs, calls skipped by short-circuits
+// counted, then if() timed against a registered function choosing between two costly arguments
+bool bench_conditional_output()
+{
+	const char* const sources[] = { "x > 0 ? x*2 : y - 1", "x >= y && y != 0 || x == 1", "if(x < y, hypot(x, y), sin(x)) + (x <= 0.5)",
+		"x > 0 ? (y > 0 ? 1 : 2) : y < 0 ? 3 : 4", "(x > 0 ? hypot(x, y) : 0) + hypot(x, y)", "lazy_choose(x > y, x*y, x/y) + choose(y > 0, x, y)",
+		"(x > 0 ? Length(\"ab\") : 5)*2", "1 < 2 || Count()", "x == x ? y : Count()", nullptr };
+	const double grid[] = { -1.5, 0., 0.5, 1., 2. };
+	const size_t rows = 25;
+	std::vector<double> x(rows), y(rows), batch(rows);
+	for(size_t row = 0; row < rows; ++row) { x[row] = grid[row / 5]; y[row] = grid[row % 5]; }
+	std::vector<CompactExpressionParser::Column> columns;
+	CompactExpressionParser::Column column_x = { "x", x.data() }, column_y = { "y", y.data() };
+	columns.push_back(column_x);
+	columns.push_back(column_y);
+
+	Counter counter;
+	Expression prototype;
+	register_functions(prototype);
+	prototype.register_function("Count", std::ref(counter));
+	prototype.register_function("choose", CompactExpressionParser::SpanFunctionType(EagerChoose()), CompactExpressionParser::Pure);
+	prototype.register_function("lazy_choose", CompactExpressionParser::LazyFunctionType(LazyChoose()), CompactExpressionParser::Pure);
+	prototype.register_function("slow", CompactExpressionParser::SpanFunctionType(Slow(200.)));
+	bool status = true;
+	for(const char* const* source = sources; *source; ++source)
+	{
+		Expression exp(prototype);
+		if(!exp.compile(*source))
+		{
+			std::cerr << "Failed to compile " << *source << std::endl;
+			status = false;
+			continue;
+		}
+		CompactExpressionParser::IncrementalEvaluator incremental(exp);
+		exp.eval_batch(columns, rows, batch.data());
+		for(size_t row = 0; row < rows; ++row)
+		{
+			exp.variables()["x"] = x[row]; exp.variables()["y"] = y[row];
+			incremental.set("x", x[row]); incremental.set("y", y[row]);
+			exp.set_backend(Expression::TreeWalker);
+			double reference = exp();
+			exp.set_backend(Expression::VirtualMachine);
+			double vm = exp();
+			exp.set_backend(Expression::Native);
+			double native = exp();
+			double updated = incremental.eval();
+			if(!same_result(reference, vm) || !same_result(reference, native) || !same_result(reference, batch[row]) || !same_result(reference, updated))
+			{
+				std::cerr << "Evaluations disagree on " << *source << " at x = " << x[row] << ", y = " << y[row] << ": " << reference << " "
+					<< vm << " " << native << " " << batch[row] << " " << updated << std::endl;
+				status = false;
+				break;
+			}
+		}
+	}
+	status = counter.m_calls == 0 && status;
+
+	// Operands and arguments not needed are never computed, whatever the backend
+	const struct { const char* source; int calls; } short_circuits[] = { { "x > 0 && Count()", 0 }, { "x < 0 && Count() > 0", 1 },
+		{ "x > 0 || Count()", 1 }, { "x < 0 ? 1 : Count()", 0 }, { "x < 0 ? Count() + Count() : 2", 2 }, { "lazy_choose(1, 2, Count())", 0 },
+		{ "choose(1, 2, Count())", 1 }, { nullptr, 0 } };
+	for(size_t index = 0; short_circuits[index].source; ++index)
+	{
+		Expression exp(prototype);
+		exp.variables()["x"] = -1.;
+		if(!exp.compile(short_circuits[index].source)) return false;
+		const Expression::Backend backends[] = { Expression::TreeWalker, Expression::VirtualMachine, Expression::Native };
+		for(int b = 0; b < 3; ++b)
+		{
+			exp.set_backend(backends[b]);
+			counter.m_calls = 0;
+			exp();
+			if(counter.m_calls != short_circuits[index].calls)
+			{
+				std::cerr << short_circuits[index].source << " calls Count() " << counter.m_calls << " times" << std::endl;
+				status = false;
+			}
+		}
+	}
+
+	Expression eager(prototype), lazy(prototype);
+	eager.variables()["x"] = 0.5;
+	if(!eager.compile("choose(x > 0, slow(x), slow(0 - x))") || !lazy.compile("if(x > 0, slow(x), slow(0 - x))"))
+	{
+		std::cerr << "Failed to compile choose() or if()" << std::endl;
+		return false;
+	}
+	double eager_ns = time_eval(eager), lazy_ns = time_eval(lazy);
+	status = same_result(eager(), lazy()) && status;
+	report.add("conditional/choose", eager_ns, "ns");
+	report.add("conditional/if", lazy_ns, "ns");
+	std::cout << std::setw(12) << std::fixed << std::setprecision(1) << eager_ns << std::setw(12) << lazy_ns
+		<< "  " << (status ? "same results" : "MISMATCH") << std::endl;
+	if(!status) std::cerr << "Conditional evaluation disagrees" << std::endl;
+	return status;
+}
+
+// Related formulas over the same inputs, sharing a few costly subexpressions
+std::string related_formula(int iIndex)
+{
+	static const char* const shared[] = { "hypot(x, y)", "sin(x*y - z)", "cos(z/(1 + x*x))", "(x*y - z)^2" };
+	std::ostringstream out;
+	int k = iIndex / 4 + 1;
+	switch(iIndex % 4)
+	{
+		case 0: out << shared[0] << "*" << k << " + " << shared[1]; break;
+		case 1: out << "(" << shared[1] << " - " << shared[2] << ")/(" << shared[3] << " + " << k << ")"; break;
+		case 2: out << shared[0] << "^2 - " << shared[2] << "*" << k << " + " << shared[3]; break;
+		default: out << "atan2(" << shared[1] << ", " << shared[2] << " + " << k << ") + " << shared[0]; break;
+	}
+	return out.str();
+}
+
+// Compiles iCount related formulas as separate expressions and as one ExpressionProgram, then compares both
+bool bench_program_output(int iCount)
+{
+	typedef std::chrono::steady_clock clock;
+	using CompactExpressionParser::Pure;
+	using CompactExpressionParser::UserFunctionType;
+	using CompactExpressionParser::SpanFunctionType;
+	Counter counter;
+	Expression prototype;
+	prototype.register_function("sin", UserFunctionType(Sinus()), Pure);
+	prototype.register_function("cos", UserFunctionType(Cosinus()), Pure);
+	prototype.register_function("atan2", UserFunctionType(Arctan2()), Pure);
+	prototype.register_function("hypot", SpanFunctionType(Hypot()), Pure);
+	prototype.register_function("Count", std::ref(counter));
+
+	CompactExpressionParser::ExpressionProgram program(prototype);
+	std::vector<Expression> separate(iCount, prototype);
+	size_t separate_code = 0;
+	for(int i = 0; i < iCount; ++i)
+	{
+		std::ostringstream name;
+		name << "f" << i;
+		if(!separate[i].compile(related_formula(i)) || !program.add(name.str(), related_formula(i)))
+		{
+			std::cerr << "Failed to compile " << related_formula(i) << std::endl;
+			return false;
+		}
+		separate_code += separate[i].program()->code().size();
+	}
+	size_t shared_code = program.program()->code().size();
+	bool status = !program.add("f0", "x") && !program.add("broken", "x +") && program.size() == static_cast<size_t>(iCount);
+
+	CompactExpressionParser::VariableSet& variables = prototype.variables();
+	int runs = 2000;
+	double separate_ns = 0., shared_ns = 0., sink = 0.;
+	std::vector<double> expected(iCount);
+	for(int run = 0; run < runs; ++run)
+	{
+		variables["x"] = 0.5 + run * 0.001;
+		variables["y"] = 1.5 - run * 0.002;
+		variables["z"] = std::sin(run * 0.01);
+		clock::time_point start = clock::now();
+		for(int i = 0; i < iCount; ++i) expected[i] = separate[i].eval();
+		separate_ns += std::chrono::duration<double, std::nano>(clock::now() - start).count();
+		start = clock::now();
+		const std::vector<double>& results = program.eval();
+		shared_ns += std::chrono::duration<double, std::nano>(clock::now() - start).count();
+		sink += results[0];
+		for(int i = 0; i < iCount; ++i) status = same_result(expected[i], results[i]) && status;
+	}
+	if(sink == 42.) std::cout << std::endl;
+
+	// Calls to volatile functions are never merged
+	CompactExpressionParser::ExpressionProgram ticks(prototype);
+	status = ticks.add("a", "Count() + 1") && ticks.add("b", "Count()*2") && status;
+	ticks.eval();
+	size_t b = 0;
+	status = ticks.find("b", b) && b == 1 && counter.m_calls == 2 && status;
+
+	report.add("program/separate", separate_ns / runs, "ns");
+	report.add("program/shared", shared_ns / runs, "ns");
+	std::cout << std::setw(10) << iCount << std::setw(14) << separate_code << std::setw(12) << shared_code
+		<< std::setw(14) << std::fixed << std::setprecision(0) << separate_ns / runs << std::setw(12) << shared_ns / runs
+		<< "  " << (status ? "same results" : "MISMATCH") << std::endl;
+	if(!status) std::cerr << "ExpressionProgram disagrees with separate expressions" << std::endl;
+	return status;
+}
+
+// Formulas of a bundle, all different, calling functions and reading variables
+std::string bundle_formula(int iIndex)
+{
+	std::ostringstream out;
+	int a = iIndex % 97 + 1, b = iIndex / 4 % 89 + 1;
+	switch(iIndex % 4)
+	{
+		case 0: out << "x*" << a << " + sin(y - " << b << ")"; break;
+		case 1: out << "hypot(" << a << ", x) / (y + " << b << ".5)"; break;
+		case 2: out << "(" << a << " + x*y)^2 - z/" << b; break;
+		default: out << "cos(x*" << a << ") * " << b << " + Pi()"; break;
+	}
+	return out.str();
+}
+
+// Writes iCount compiled formulas and the corpus to a bundle, loads it back and compares every result
+bool bench_bundle_output(int iCount)
+{
+	typedef std::chrono::steady_clock clock;
+	const std::string path = "cep_bench.bundle";
+	Expression exp;
+	register_functions(exp);
+	exp.variables()["x"] = 0.75; exp.variables()["y"] = -2.5; exp.variables()["z"] = 4.;
+	CompactExpressionParser::BundleWriter writer;
+	std::vector<std::string> names;
+	std::vector<double> expected;
+
+	clock::time_point start = clock::now();
+	for(int i = 0; i < iCount; ++i)
+	{
+		std::ostringstream name;
+		name << "f" << i;
+		if(!exp.compile(bundle_formula(i)) || !writer.add(name.str(), exp.program())) return false;
+		names.push_back(name.str());
+		expected.push_back(exp());
+	}
+	double compile_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+	for(const char* const* source = eval_corpus; *source; ++source)
+	{
+		if(!exp.compile(*source) || !writer.add(*source, exp.program())) return false;
+		names.push_back(*source);
+		expected.push_back(exp());
+	}
+	if(writer.add(names.front(), exp.program()) || !writer.save(path))
+	{
+		std::cerr << "Failed to write " << path << std::endl;
+		return false;
+	}
+
+	// Functions are found again by name, in another expression
+	Expression functions;
+	register_functions(functions);
+	CompactExpressionParser::ProgramBundle bundle;
+	start = clock::now();
+	bool loaded = bundle.load(path, functions);
+	double load_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+	bool status = loaded && bundle.size() == names.size();
+	if(status)
+	{
+		bundle.variables()["x"] = 0.75; bundle.variables()["y"] = -2.5; bundle.variables()["z"] = 4.;
+		for(size_t i = 0; i < names.size(); ++i)
+		{
+			size_t index;
+			if(!bundle.find(names[i], index) || index != i || bundle.name(i) != names[i] || !same_result(bundle.eval(i), expected[i]))
+			{
+				std::cerr << "Bundle disagrees on " << names[i] << std::endl;
+				status = false;
+			}
+		}
+		size_t index;
+		status = !bundle.find("missing", index) && status;
+	}
+
+	// Unknown functions and damaged files are refused
+	Expression unrelated;
+	CompactExpressionParser::ProgramBundle refused;
+	status = !refused.load(path, unrelated) && status;
+	std::ifstream in(path.c_str(), std::ios::binary);
+	std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	in.close();
+	std::ofstream(path.c_str(), std::ios::binary).write(bytes.data(), bytes.size() / 2);
+	status = !refused.load(path, functions) && status;
+	std::remove(path.c_str());
+
+	report.add("bundle/compile", compile_ms, "ms");
+	report.add("bundle/load", load_ms, "ms");
+	std::cout << std::setw(10) << names.size() << std::setw(12) << bytes.size() / 1024 << std::setw(14) << std::fixed << std::setprecision(2)
+		<< compile_ms << std::setw(12) << load_ms << "  " << (status ? "same results" : "MISMATCH") << std::endl;
+	return status;
+}
+
+// Field iColumn of row iRow of the CSV streamed by bench_stream_output: the first rows hold
+// numbers left to strtod, the next ones the formats met most often
+std::string stream_field(int iRow, int iColumn)
+{
+	static const char* const tricky[] = { "0.1", "-0", "1e22", "1e23", "9007199254740993", "123456789012345678901",
+		"4.9e-324", "1.7976931348623157e308", "  2.5 ", "", "inf", "-nan", "0x1p-3", ".5", "7.", "+3e-2", "0.000123456789" };
+	const int count = static_cast<int>(sizeof(tricky) / sizeof(tricky[0]));
+	if(iRow < count) return iColumn ? "1.5" : tricky[iRow];
+	char text[64];
+	double value = std::sin(iRow * 0.37 + iColumn) * std::pow(10., (iRow + iColumn) % 9 - 3);
+	switch((iRow + 2 * iColumn) % 4)
+	{
+		case 0: std::snprintf(text, sizeof(text), "%.6f", value); break;
+		case 1: std::snprintf(text, sizeof(text), "%d", static_cast<int>(value * 1000)); break;
+		case 2: std::snprintf(text, sizeof(text), "%.3e", value); break;
+		default: std::snprintf(text, sizeof(text), "%.17g", value);
+	}
+	return text;
+}
+
+// Reads all the rows of iReader by blocks, evaluating them as cep_stream does, returns the seconds taken
+double stream_rows(RowReader& ioReader, Expression& ioExp, std::vector<double>& oInputs, std::vector<double>& oResults)
+{
+	typedef std::chrono::steady_clock clock;
+	const size_t block = 4096;
+	const char* const names[] = { "x", "y", "z" };
+	std::vector<double> inputs(3 * block), results(block);
+	double* columns[] = { inputs.data(), inputs.data() + block, inputs.data() + 2 * block };
+	std::vector<CompactExpressionParser::Column> bound;
+	for(int column = 0; column < 3; ++column)
+	{
+		CompactExpressionParser::Column bind = { names[column], columns[column] };
+		bound.push_back(bind);
+	}
+
+	clock::time_point start = clock::now();
+	while(size_t rows = ioReader.read(columns, block))
+	{
+		ioExp.eval_batch(bound, rows, results.data());
+		for(size_t row = 0; row < rows; ++row)
+		{
+			for(int column = 0; column < 3; ++column) oInputs.push_back(columns[column][row]);
+			oResults.push_back(results[row]);
+		}
+	}
+	return std::chrono::duration<double>(clock::now() - start).count();
+}
+
+// Streams a CSV file and its binary copy through the readers of cep_stream: every field must
+// read as strtod reads it, and every result match an evaluation row by row
+bool bench_stream_output(int iRows)
+{
+	const std::string csv_path = "cep_bench.csv", binary_path = "cep_bench.bin";
+	std::vector<double> expected;
+	{
+		std::ofstream csv(csv_path.c_str(), std::ios::binary), binary(binary_path.c_str(), std::ios::binary);
+		csv << "x, label ,y,z\n";
+		for(int row = 0; row < iRows; ++row)
+		{
+			std::string fields[3];
+			for(int column = 0; column < 3; ++column)
+			{
+				fields[column] = stream_field(row, column);
+				double value = fields[column].empty() ? std::nan("") : std::strtod(fields[column].c_str(), nullptr);
+				expected.push_back(value);
+				binary.write(reinterpret_cast<const char*>(&value), sizeof(value));
+			}
+			csv << fields[0] << ",row" << row << "," << fields[1] << "," << fields[2] << (row % 7 ? "\n" : "\r\n");
+		}
+	}
+
+	Expression exp;
+	register_functions(exp);
+	bool status = exp.compile("x*y - z/4 + sin(x)");
+	std::vector<double> reference;
+	for(int row = 0; row < iRows; ++row)
+	{
+		exp.variables()["x"] = expected[3 * row];
+		exp.variables()["y"] = expected[3 * row + 1];
+		exp.variables()["z"] = expected[3 * row + 2];
+		reference.push_back(exp());
+	}
+
+	const char* const rejected[] = { "1e", "abc", "1.5x", "--1", ".", nullptr };
+	for(const char* const* text = rejected; *text; ++text)
+	{
+		double value;
+		status = !CsvReader::parse_number(*text, *text + std::strlen(*text), value) && status;
+	}
+
+	for(int format = 0; format < 2; ++format)
+	{
+		const std::string& path = format ? binary_path : csv_path;
+		InputBuffer input;
+		std::unique_ptr<RowReader> reader;
+		std::vector<size_t> selected;
+		if(format) reader.reset(new BinaryReader(input, std::vector<std::string>{ "x", "y", "z" }));
+		else reader.reset(new CsvReader(input));
+		bool opened = input.open(path) && (format || static_cast<CsvReader&>(*reader).start());
+		selected.push_back(0);
+		selected.push_back(format ? 1 : 2);
+		selected.push_back(format ? 2 : 3);
+		bool read = opened && reader->columns().size() == (format ? 3u : 4u);
+		if(read) reader->select(selected);
+
+		std::vector<double> inputs, results;
+		double seconds = read ? stream_rows(*reader, exp, inputs, results) : 0.;
+		read = read && reader->error().empty() && results.size() == reference.size();
+		for(size_t index = 0; read && index < inputs.size(); ++index)
+			read = same_result(inputs[index], expected[index]) && std::signbit(inputs[index]) == std::signbit(expected[index]);
+		for(size_t index = 0; read && index < results.size(); ++index) read = same_result(results[index], reference[index]);
+		if(!read) std::cerr << "Streaming " << path << " disagrees with strtod or eval " << reader->error() << std::endl;
+		status = read && status;
+
+		std::ifstream in(path.c_str(), std::ios::binary | std::ios::ate);
+		double megabytes = static_cast<double>(in.tellg()) / (1 << 20);
+		report.add(format ? "stream/binary" : "stream/csv", megabytes / seconds, "MB/s", true);
+		std::cout << std::setw(8) << (format ? "binary" : "csv") << std::setw(10) << iRows << std::setw(12) << std::fixed << std::setprecision(1)
+			<< megabytes << std::setw(10) << megabytes / seconds << std::setw(14) << static_cast<long long>(iRows / seconds)
+			<< "  " << (read ? "same results" : "MISMATCH") << std::endl;
+		std::remove(path.c_str());
+	}
+	return status;
+}
+
+// Compiles the corpus through an ExpressionCache: respaced sources must hit and evaluate as compiled
+bool bench_cache_output()
+{
+	CompactExpressionParser::ExpressionCache cache(16);
+	Expression prototype;
+	register_functions(prototype);
+	bool status = true;
+	for(int round = 0; round < 2; ++round)
+	{
+		for(const char* const* source = eval_corpus; *source; ++source)
+		{
+			std::string spaced;
+			bool literal = false;
+			for(const char* c = *source; *c; ++c)
+			{
+				literal = literal != (*c == '"');
+				if(round && !literal && std::strchr("+*/^(),", *c)) spaced += ' ';
+				spaced += *c;
+			}
+			Expression cached(prototype), compiled(prototype);
+			if(!cache.compile(cached, round ? spaced : *source) || !compiled.compile(*source) || !same_result(cached(), compiled()))
+			{
+				std::cerr << "Cache disagrees on " << spaced << std::endl;
+				status = false;
+			}
+		}
+	}
+	// Different functions under the same name must not share a program
+	Expression other;
+	other.register_function("Pi", Sinus());
+	status = cache.compile(other, "Pi(1)") && std::fabs(other() - std::sin(1.)) < 1e-15 && status;
+	status = !cache.compile(other, "1 +* 2") && status;
+	// Independent expressions do not share programs, which call the functions of the expression compiling them
+	Expression independent;
+	register_functions(independent);
+	status = cache.compile(independent, eval_corpus[0]) && status;
+	// The profile follows the program a hit brings in
+	Expression profiled(other);
+	profiled.set_profiling(1);
+	status = cache.compile(profiled, "Pi(1)") && profiled() == other() && status;
+	status = cache.compile(profiled, "10*3") && profiled() == 30. && status;
+	status = cache.compile(profiled, "Pi(1)") && profiled() == other() && profiled.profile()->evaluations() == 1 && status;
+
+	CompactExpressionParser::ExpressionCache::Statistics stats = cache.statistics();
+	size_t corpus = sizeof(eval_corpus) / sizeof(*eval_corpus) - 1;
+	if(stats.hits != corpus + 2 || stats.misses != corpus + 4 || stats.evictions != 0)
+	{
+		std::cerr << "Unexpected cache counters: " << stats.hits << " hits, " << stats.misses << " misses" << std::endl;
+		status = false;
+	}
+
+	// Least recently used entries go first
+	CompactExpressionParser::ExpressionCache small(2);
+	Expression exp(prototype);
+	small.compile(exp, "1"); small.compile(exp, "2"); small.compile(exp, "1"); small.compile(exp, "3");
+	small.compile(exp, "1");
+	stats = small.statistics();
+	if(stats.hits != 2 || stats.evictions != 1 || stats.size != 2)
+	{
+		std::cerr << "Unexpected cache eviction order" << std::endl;
+		status = false;
+	}
+
+	typedef std::chrono::steady_clock clock;
+	const std::string source = long_expression(64);
+	clock::time_point start = clock::now();
+	for(int i = 0; i < 1000; ++i) cache.compile(exp, source);
+	double hit_us = std::chrono::duration<double, std::micro>(clock::now() - start).count() / 1000;
+	stats = cache.statistics();
+	report.add("cache/hit", hit_us, "us");
+	std::cout << std::setw(12) << std::fixed << std::setprecision(2) << time_compile(source) << std::setw(12) << hit_us
+		<< std::setw(8) << stats.hits << std::setw(8) << stats.misses << std::setw(8) << stats.evictions << "  " << source << std::endl;
+	return status;
+}
+
+// Checks a static expression against Expression compiled from its source, then times both
+template<typename E> bool bench_static_output(const CompactExpressionParser::Static::StaticExpression<E>& iStatic)
+{
+	const std::string source = iStatic.source();
+	Expression exp;
+	register_functions(exp);
+	if(!exp.compile(source))
+	{
+		std::cerr << "Failed to compile " << source << std::endl;
+		return false;
+	}
+	exp.set_backend(Expression::Native);
+
+	const size_t rows = 4096;
+	std::vector<double> column1(rows), column2(rows), columns_result(rows), batch_result(rows);
+	for(size_t i = 0; i < rows; ++i) { column1[i] = (i % 1000) * 0.01 - 3.; column2[i] = (i % 77) * 0.5; }
+	CompactExpressionParser::VariableSet& vars = exp.variables();
+	const CompactExpressionParser::Static::VariableList variables = iStatic.variables();
+	for(size_t i = 0; i < rows; ++i)
+	{
+		double frame[] = { column1[i], column2[i] };
+		for(const std::pair<std::string, size_t>& variable : variables) vars[variable.first] = frame[variable.second];
+		if(!same_result(iStatic(frame), exp()))
+		{
+			std::cerr << "Static expression disagrees on " << source << ": " << iStatic(frame) << " != " << exp() << std::endl;
+			return false;
+		}
+	}
+
+	const double* columns[] = { column1.data(), column2.data() };
+	iStatic.eval_columns(columns, rows, columns_result.data());
+	std::vector<CompactExpressionParser::Column> named;
+	for(const std::pair<std::string, size_t>& variable : variables)
+	{
+		CompactExpressionParser::Column column = { variable.first, columns[variable.second] };
+		named.push_back(column);
+	}
+	exp.eval_batch(named, rows, batch_result.data());
+	for(size_t i = 0; i < rows; ++i)
+	{
+		if(!same_result(columns_result[i], batch_result[i]))
+		{
+			std::cerr << "Static columns disagree on " << source << " row " << i << std::endl;
+			return false;
+		}
+	}
+
+	typedef std::chrono::steady_clock clock;
+	double sink = 0.;
+	const int runs = 1 << 20;
+	clock::time_point start = clock::now();
+	for(int i = 0; i < runs; ++i)
+	{
+		double frame[] = { column1[i % rows], column2[i % rows] };
+		sink += iStatic(frame);
+	}
+	double static_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count() / runs;
+	EvaluationContext context;
+	std::vector<double> frame(vars.size());
+	size_t slots[2] = { 0, 0 };
+	for(const std::pair<std::string, size_t>& variable : variables) slots[variable.second] = vars.declare(variable.first);
+	start = clock::now();
+	for(int i = 0; i < runs; ++i)
+	{
+		frame[slots[0]] = column1[i % rows]; frame[slots[1]] = column2[i % rows];
+		sink += exp.eval(context, frame.data());
+	}
+	double native_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count() / runs;
+	if(sink == 42.) std::cout << std::endl;
+	std::cout << std::setw(12) << std::fixed << std::setprecision(1) << static_ns << std::setw(12) << native_ns << "  " << source << std::endl;
+	return true;
+}
+
+// Options: --json <file> saves the measures, --baseline <file> compares them with a former run,
+// --tolerance <fraction> sets how much worse a measure may be, 0.25 by default.
+// Exits with 1 when results disagree, 2 when a measure regressed.
+int main(int argc, char** argv)
+{
+	std::string json, baseline;
+	double tolerance = 0.25;
+	for(int arg = 1; arg < argc; ++arg)
+	{
+		std::string option = argv[arg];
+		if(arg + 1 == argc || (option != "--json" && option != "--baseline" && option != "--tolerance"))
+		{
+			std::cerr << "Usage: " << argv[0] << " [--json <file>] [--baseline <file>] [--tolerance <fraction>]" << std::endl;
+			return 1;
+		}
+		std::string value = argv[++arg];
+		if(option == "--json") json = value;
+		else if(option == "--baseline") baseline = value;
+		else tolerance = std::atof(value.c_str());
+	}
+	BenchmarkReport former;
+	if(!baseline.empty() && !former.load(baseline))
+	{
+		std::cerr << "Cannot read the baseline " << baseline << std::endl;
+		return 1;
+	}
+
+	std::cout << std::setw(8) << "shape" << std::setw(8) << "size" << std::setw(10) << "chars"
+		<< std::setw(14) << "compile(us)" << std::setw(12) << "ns/char" << std::endl;
+
+	for(int depth = 1; depth <= 4096; depth *= 4)
+		bench_compile_output("depth", depth, nested_expression(depth));
+
+	for(int length = 1; length <= 4096; length *= 4)
+		bench_compile_output("length", length, long_expression(length));
+
+	for(int density = 0; density <= 100; density += 25)
+		bench_compile_output("calls%", density, function_expression(256, density));
+
+	for(int count = 16; count <= 16384; count *= 4)
+		bench_compile_output("names", count, names_expression(count));
+
+	std::cout << std::endl << std::setw(8) << "nodes" << std::setw(12) << "tree(bytes)" << std::setw(12) << "compile(a)"
+		<< std::setw(12) << "copy(a)" << "  expression" << std::endl;
+	bool status = true;
+	for(const char* const* exp = eval_corpus; *exp; ++exp)
+		status = bench_tree_output(*exp) && status;
+	status = bench_tree_output(nested_expression(64)) && status;
+	status = bench_tree_output(long_expression(64)) && status;
+	status = bench_tree_output(long_expression(1024)) && status;
+	status = bench_deep_output(1 << 18) && status;
+
+	std::cout << std::endl << std::setw(12) << "tree(ns)" << std::setw(12) << "vm(ns)" << std::setw(12) << "native(ns)"
+		<< std::setw(12) << "vm(allocs)" << "  expression" << std::endl;
+	for(const char* const* exp = eval_corpus; *exp; ++exp)
+		status = bench_eval_output(*exp) && status;
+	status = bench_eval_output(nested_expression(64)) && status;
+	status = bench_eval_output(long_expression(64)) && status;
+	status = bench_examples_output() && status;
+
+	std::cout << std::endl << std::setw(12) << "workload" << std::setw(14) << "latency(ns)" << std::setw(14) << "rows/s" << std::endl;
+	status = bench_workload_output("numeric", "(x*1.5 - y/3)^2 + x*y - 4*(x + 1)/(y + 2)") && status;
+	status = bench_workload_output("functions", function_expression(16, 100)) && status;
+	status = bench_workload_output("strings", "Length(\"abcdefghijklmnopqrstuvwxyz0123456789\")*x + Length(\"y\")") && status;
+
+	std::cout << std::endl << std::setw(12) << "tree(ns)" << std::setw(10) << "tree(a)" << std::setw(12) << "vm(ns)"
+		<< std::setw(10) << "vm(a)" << "  expression" << std::endl;
+	status = bench_string_output("Size(Echo(\"a literal longer than sixteen characters\"))*x + Size(\"short\")") && status;
+	status = bench_string_output("Size(Join(\"Coucou \", \"Roger\")) + Length(\"Coucou Roger/mon\\\\Pote\")*x") && status;
+	status = bench_string_output("Size(Join(Echo(\"a literal longer than sixteen characters\"), \" and another one as long\"))") && status;
+
+	std::cout << std::endl << std::setw(12) << "copy(ns)" << std::setw(12) << "copy(a)" << "  expression" << std::endl;
+	status = bench_copy_output("4 + 3*x - y") && status;
+	status = bench_copy_output(long_expression(1024)) && status;
+
+	std::cout << std::endl << std::setw(12) << "call(ns)" << std::setw(12) << "hand(ns)" << std::setw(14) << "overhead(ns)" << std::endl;
+	status = bench_call_output() && status;
+
+	std::cout << std::endl << std::setw(8) << "period" << std::setw(14) << "eval(ns)" << std::setw(14) << "timed(ns)"
+		<< std::setw(12) << "slow(ns)" << "  expression: (x*3 - 1)^2 + slow(x) + sin(x)*cos(x)" << std::endl;
+	status = bench_profile_output("(x*3 - 1)^2 + slow(x) + sin(x)*cos(x)", 1) && status;
+	status = bench_profile_output("(x*3 - 1)^2 + slow(x) + sin(x)*cos(x)", 1000) && status;
+
+	{
+		std::cout << std::endl << std::setw(12) << "static(ns)" << std::setw(12) << "native(ns)" << "  expression" << std::endl;
+		CEP_VARIABLE(x, 0);
+		CEP_VARIABLE(y, 1);
+		CEP_FUNCTION(sin, [](double a) { return std::sin(a); });
+		CEP_FUNCTION(cos, [](double a) { return std::cos(a); });
+		CEP_FUNCTION(atan2, [](double a, double b) { return std::atan2(a, b); });
+		CEP_FUNCTION(hypot, [](double a, double b) { return std::sqrt(a*a + b*b); });
+		CEP_FUNCTION(Pi, []() { return std::atan2(0., -1.); });
+		status = bench_static_output(CEP_EXPR(4 + 3*x - y)) && status;
+		status = bench_static_output(CEP_EXPR(4 + 3 * x / power(y + 13.21, -1.) - (25 - y)*1.7)) && status;
+		status = bench_static_output(CEP_EXPR((power(((1+x)*3-4)/5, 2) + sin(y)*cos(2) - atan2(3,x))*10)) && status;
+		status = bench_static_output(CEP_EXPR(hypot(3, 4*x) + hypot(sin(y), Pi()))) && status;
+		status = bench_static_output(CEP_EXPR(power(x, power(y, 0.5)) / (x*x - y + 0.1))) && status;
+	}
+
+	std::cout << std::endl << std::setw(12) << "row(ns)" << std::setw(12) << "batch(ns)" << "  expression" << std::endl;
+	status = bench_batch_output("4 + 3*Arg1() - Arg2()", false) && status;
+	status = bench_batch_output("4 + 3*x - y", false) && status;
+	status = bench_batch_output("(Arg1()*Arg2() - Arg2()/2)^2 + Arg1()*1.5", false) && status;
+	status = bench_batch_output("vsin(Arg1())*Arg2() + Arg1()^2", false) && status;
+	status = bench_batch_output("vsin(Arg1())*Arg2() + Arg1()^2", true) && status;
+	status = bench_batch_output("vsin(x)*y + x^2", true) && status;
+	status = bench_batch_throw_output() && status;
+
+	std::cout << std::endl << std::setw(12) << "threads" << std::setw(14) << "rows/s" << "  expression" << std::endl;
+	for(unsigned threads = 1; threads <= 32; threads *= 2)
+		status = bench_threads_output("hypot(3, 4*x) + sin(y)*cos(x) - shifted(x, y)", threads) && status;
+
+	std::cout << std::endl << std::setw(12) << "compile(us)" << std::setw(12) << "cached(us)" << std::setw(8) << "hits"
+		<< std::setw(8) << "misses" << std::setw(8) << "evicted" << "  expression" << std::endl;
+	status = bench_cache_output() && status;
+
+	std::cout << std::endl << std::setw(8) << "terms" << std::setw(12) << "full(ns)" << std::setw(14) << "update(ns)"
+		<< std::setw(12) << "recomputed" << std::endl;
+	for(int terms = 16; terms <= 4096; terms *= 4)
+		status = bench_incremental_output(terms) && status;
+
+	std::cout << std::endl << std::setw(12) << "hand(ins)" << std::setw(12) << "calls(ins)" << std::setw(12) << "hand(ns)"
+		<< std::setw(12) << "calls(ns)" << "  expression" << std::endl;
+	status = bench_inline_output("f1(x, y) + f2(10, y)", "x*y + 1 + ((10*y + 1) - (y*0.5 + 1))") && status;
+	status = bench_inline_output("f3(x, y) + f2(y, 2)",
+		"(((x + 1)*y + 1) - (y*0.5 + 1))*((y*x + 1) - (x*0.5 + 1)) + ((y*2 + 1) - (2*0.5 + 1))") && status;
+	status = bench_inline_rules() && status;
+
+	std::cout << std::endl << std::setw(12) << "choose(ns)" << std::setw(12) << "if(ns)"
+		<< "  choose(x > 0, slow(x), slow(0 - x)) against if(x > 0, slow(x), slow(0 - x))" << std::endl;
+	status = bench_conditional_output() && status;
+
+	std::cout << std::endl << std::setw(10) << "formulas" << std::setw(14) << "separate(ins)" << std::setw(12) << "shared(ins)"
+		<< std::setw(14) << "separate(ns)" << std::setw(12) << "shared(ns)" << std::endl;
+	status = bench_program_output(200) && status;
+
+	std::cout << std::endl << std::setw(10) << "formulas" << std::setw(12) << "bundle(kB)" << std::setw(14) << "compile(ms)"
+		<< std::setw(12) << "load(ms)" << std::endl;
+	status = bench_bundle_output(50000) && status;
+
+	std::cout << std::endl << std::setw(8) << "input" << std::setw(10) << "rows" << std::setw(12) << "size(MB)" << std::setw(10) << "MB/s"
+		<< std::setw(14) << "rows/s" << "  expression: x*y - z/4 + sin(x)" << std::endl;
+	status = bench_stream_output(400000) && status;
+
+	std::cout << std::endl << std::setw(12) << "workers" << std::setw(14) << "rows/s" << "  expression (BatchEvaluator)" << std::endl;
+	unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+	for(unsigned threads = 1; threads <= std::max(8u, cores); threads *= 2)
+		status = bench_parallel_output("hypot(3, 4*x) + sin(y)*cos(x) + (x - y)^2", threads) && status;
+
+	if(!json.empty() && !report.save(json))
+	{
+		std::cerr << "Cannot write " << json << std::endl;
+		status = false;
+	}
+	size_t regressions = 0;
+	if(!baseline.empty())
+	{
+		std::cout << std::endl;
+		regressions = report.compare(former, tolerance, std::cout);
+	}
+	if(!status) return 1;
+	return regressions ? 2 : 0;
+}
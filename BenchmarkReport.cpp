@@ -0,0 +1,116 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#include "BenchmarkReport.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <sstream>
+
+namespace
+{
+	std::string quote(const std::string& iText)
+	{
+		std::string quoted(1, '"');
+		for(char c : iText)
+		{
+			if(c == '"' || c == '\\') quoted += '\\';
+			if(static_cast<unsigned char>(c) < 0x20) quoted += ' ';
+			else quoted += c;
+		}
+		return quoted + '"';
+	}
+
+	// Reads the string value of iKey in a line written by save()
+	bool read_string(const std::string& iLine, const std::string& iKey, std::string& oValue)
+	{
+		size_t at = iLine.find("\"" + iKey + "\": \"");
+		if(at == std::string::npos) return false;
+		oValue.clear();
+		for(at += iKey.size() + 5; at < iLine.size() && iLine[at] != '"'; ++at)
+		{
+			if(iLine[at] == '\\' && at + 1 < iLine.size()) ++at;
+			oValue += iLine[at];
+		}
+		return at < iLine.size();
+	}
+
+	bool read_number(const std::string& iLine, const std::string& iKey, double& oValue)
+	{
+		size_t at = iLine.find("\"" + iKey + "\": ");
+		if(at == std::string::npos) return false;
+		const char* begin = iLine.c_str() + at + iKey.size() + 4;
+		char* end = nullptr;
+		oValue = std::strtod(begin, &end);
+		return end != begin;
+	}
+}
+
+void BenchmarkReport::add(const std::string& iName, double iValue, const std::string& iUnit, bool iHigherIsBetter)
+{
+	Measure measure = { iName, iValue, iUnit, iHigherIsBetter };
+	m_measures.push_back(measure);
+}
+
+bool BenchmarkReport::save(const std::string& iPath) const
+{
+	std::ofstream out(iPath.c_str());
+	out << "{\n  \"measures\": [\n";
+	for(size_t index = 0; index < m_measures.size(); ++index)
+	{
+		const Measure& measure = m_measures[index];
+		out << "    { \"name\": " << quote(measure.name) << ", \"value\": "
+			<< std::setprecision(std::numeric_limits<double>::max_digits10) << measure.value
+			<< ", \"unit\": " << quote(measure.unit) << ", \"higher_is_better\": " << (measure.higher_is_better ? "true" : "false")
+			<< " }" << (index + 1 < m_measures.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+	return static_cast<bool>(out);
+}
+
+bool BenchmarkReport::load(const std::string& iPath)
+{
+	std::ifstream in(iPath.c_str());
+	if(!in) return false;
+	m_measures.clear();
+	std::string line;
+	while(std::getline(in, line))
+	{
+		Measure measure;
+		if(!read_string(line, "name", measure.name)) continue;
+		if(!read_number(line, "value", measure.value) || !read_string(line, "unit", measure.unit)) return false;
+		measure.higher_is_better = line.find("\"higher_is_better\": true") != std::string::npos;
+		m_measures.push_back(measure);
+	}
+	return true;
+}
+
+size_t BenchmarkReport::compare(const BenchmarkReport& iBaseline, double iTolerance, std::ostream& oOut) const
+{
+	std::map<std::string, const Measure*> baseline;
+	for(const Measure& measure : iBaseline.m_measures) baseline[measure.name] = &measure;
+
+	size_t regressions = 0, compared = 0;
+	for(const Measure& measure : m_measures)
+	{
+		std::map<std::string, const Measure*>::const_iterator found = baseline.find(measure.name);
+		if(found == baseline.end() || found->second->value <= 0. || measure.value <= 0.) continue;
+		++compared;
+		// Above 1 when worse than the baseline
+		double ratio = measure.higher_is_better ? found->second->value / measure.value : measure.value / found->second->value;
+		if(ratio <= 1. + iTolerance) continue;
+		++regressions;
+		oOut << "REGRESSION " << measure.name << ": " << found->second->value << " -> " << measure.value << " " << measure.unit
+			<< std::fixed << std::setprecision(0) << " (" << (ratio - 1.) * 100. << "% worse)" << std::defaultfloat << std::endl;
+	}
+	oOut << compared << " measures compared with the baseline, " << regressions << " regressions" << std::endl;
+	return regressions;
+}
@@ -0,0 +1,44 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#ifndef CEP_BENCHMARKREPORT_H_
+#define CEP_BENCHMARKREPORT_H_
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+/** Measures of a cep_bench run, saved as JSON and compared with a baseline.
+ *
+ * The file holds one object per measure: its name, value, unit, and whether
+ * higher values are better. Loading only reads files written by save(), one
+ * measure per line. */
+class BenchmarkReport
+{
+public:
+	struct Measure
+	{
+		std::string name;
+		double value;
+		std::string unit;
+		bool higher_is_better;
+	};
+
+	void add(const std::string& iName, double iValue, const std::string& iUnit, bool iHigherIsBetter = false);
+	bool save(const std::string& iPath) const;
+	bool load(const std::string& iPath);
+	const std::vector<Measure>& measures() const { return m_measures; }
+
+	// Writes the measures worse than the baseline by more than iTolerance (0.25 for 25%), returns how many
+	size_t compare(const BenchmarkReport& iBaseline, double iTolerance, std::ostream& oOut) const;
+
+private:
+	std::vector<Measure> m_measures;
+};
+
+#endif /* CEP_BENCHMARKREPORT_H_ */
@@ -0,0 +1,202 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#include "BatchEvaluator.h"
+
+#include <algorithm>
+#include <deque>
+#include <thread>
+
+namespace CompactExpressionParser
+{
+
+struct BatchEvaluator::Worker
+{
+	std::thread thread;
+	std::mutex mutex;
+	std::deque<size_t> chunks;
+	EvaluationContext context;
+	std::vector<Column> columns;
+};
+
+BatchEvaluator::BatchEvaluator(const Expression& iExp, unsigned iThreads) :
+m_expression(iExp),
+m_program(iExp.program()),
+m_generation(0),
+m_stop(false),
+m_frame(nullptr),
+m_results(nullptr),
+m_rows(0),
+m_chunk_rows(0),
+m_pending(0)
+{
+	if(!iThreads) iThreads = std::max(1u, std::thread::hardware_concurrency());
+	for(unsigned i = 0; i < iThreads; ++i) m_workers.emplace_back(new Worker);
+	for(std::unique_ptr<Worker>& worker : m_workers) worker->thread = std::thread(&BatchEvaluator::work, this, std::ref(*worker));
+}
+
+BatchEvaluator::~BatchEvaluator()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	for(std::unique_ptr<Worker>& worker : m_workers) worker->thread.join();
+}
+
+void BatchEvaluator::eval(const std::vector<Column>& iColumns, size_t iRows, double* oResults)
+{
+	submit(iColumns, iRows, oResults);
+	wait();
+}
+
+void BatchEvaluator::eval_stream(const std::vector<std::string>& iColumns, const RowSource& iSource, const ResultSink& iSink, size_t iBlockRows)
+{
+	iBlockRows = std::max<size_t>(iBlockRows, 1);
+	const size_t width = iColumns.size();
+	std::vector<double> inputs[2], results[2];
+	std::vector<Column> columns[2];
+	std::vector<double*> targets[2];
+	for(int b = 0; b < 2; ++b)
+	{
+		inputs[b].resize(width * iBlockRows);
+		results[b].resize(iBlockRows);
+		for(size_t c = 0; c < width; ++c)
+		{
+			Column column = { iColumns[c], &inputs[b][c * iBlockRows] };
+			columns[b].push_back(column);
+			targets[b].push_back(&inputs[b][c * iBlockRows]);
+		}
+	}
+
+	int current = 0;
+	size_t rows = iSource(targets[current].data(), iBlockRows);
+	while(rows)
+	{
+		submit(columns[current], rows, results[current].data());
+		size_t next;
+		try { next = iSource(targets[1 - current].data(), iBlockRows); }
+		catch(...) { wait(); throw; }
+		wait();
+		iSink(results[current].data(), rows);
+		current = 1 - current;
+		rows = next;
+	}
+}
+
+// Chunks are whole blocks of the evaluation context, several per worker so that stealing can balance the load
+void BatchEvaluator::submit(const std::vector<Column>& iColumns, size_t iRows, double* oResults)
+{
+	if(!iRows) return;
+	const size_t workers = m_workers.size();
+	const size_t block = EvaluationContext::BlockSize;
+	size_t blocks = (iRows + block - 1) / block;
+	m_chunk_rows = block * std::max<size_t>(1, std::min<size_t>(64, blocks / (workers * 8)));
+	size_t chunks = (iRows + m_chunk_rows - 1) / m_chunk_rows;
+
+	m_columns = iColumns;
+	m_frame = m_expression.variables().data();
+	m_results = oResults;
+	m_rows = iRows;
+	m_pending = chunks;
+	for(size_t w = 0; w < workers; ++w)
+	{
+		std::lock_guard<std::mutex> lock(m_workers[w]->mutex);
+		for(size_t chunk = w * chunks / workers; chunk < (w + 1) * chunks / workers; ++chunk) m_workers[w]->chunks.push_back(chunk);
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		++m_generation;
+	}
+	m_wake.notify_all();
+}
+
+void BatchEvaluator::wait()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done.wait(lock, [this]() { return m_pending == 0; });
+	if(m_error)
+	{
+		std::exception_ptr error = m_error;
+		m_error = nullptr;
+		std::rethrow_exception(error);
+	}
+}
+
+void BatchEvaluator::work(Worker& ioWorker)
+{
+	size_t seen = 0;
+	for(;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [&]() { return m_stop || m_generation != seen; });
+			if(m_stop) return;
+			seen = m_generation;
+		}
+		size_t chunk;
+		while(take(ioWorker, chunk))
+		{
+			run(ioWorker, chunk);
+			if(--m_pending == 0)
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_done.notify_all();
+			}
+		}
+	}
+}
+
+// Own chunks are taken from the front, stolen ones from the back of another worker
+bool BatchEvaluator::take(Worker& ioWorker, size_t& oChunk)
+{
+	{
+		std::lock_guard<std::mutex> lock(ioWorker.mutex);
+		if(!ioWorker.chunks.empty())
+		{
+			oChunk = ioWorker.chunks.front();
+			ioWorker.chunks.pop_front();
+			return true;
+		}
+	}
+	const size_t workers = m_workers.size();
+	size_t self = 0;
+	while(m_workers[self].get() != &ioWorker) ++self;
+	for(size_t i = 1; i < workers; ++i)
+	{
+		Worker& victim = *m_workers[(self + i) % workers];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if(!victim.chunks.empty())
+		{
+			oChunk = victim.chunks.back();
+			victim.chunks.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+
+void BatchEvaluator::run(Worker& ioWorker, size_t iChunk)
+{
+	size_t first = iChunk * m_chunk_rows;
+	size_t count = std::min(m_chunk_rows, m_rows - first);
+	ioWorker.columns = m_columns;
+	for(Column& column : ioWorker.columns) column.values += first;
+	try
+	{
+		m_program->eval_batch(ioWorker.context, m_frame, ioWorker.columns, count, m_results + first);
+	}
+	catch(...)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(!m_error) m_error = std::current_exception();
+	}
+}
+
+}
@@ -0,0 +1,86 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#ifndef CEP_BATCHEVALUATOR_H_
+#define CEP_BATCHEVALUATOR_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Expression.h"
+
+namespace CompactExpressionParser
+{
+
+/** Evaluates one compiled expression over many rows on a pool of threads.
+ *
+ * Rows are cut in chunks, dealt out evenly to the workers. A worker runs its own
+ * chunks in order and, once out of work, steals the last chunks of the others.
+ * Results are written at the index of their row, so they come out in order.
+ *
+ * Input columns are bound as by Expression::eval_batch. Registered functions are
+ * called from all the workers at once and must be safe to call concurrently. */
+class BatchEvaluator
+{
+public:
+	// Fills each column with up to iCapacity rows, returns the number of rows read, 0 at the end
+	typedef std::function<size_t(double* const* oColumns, size_t iCapacity)> RowSource;
+	typedef std::function<void(const double* iResults, size_t iRows)> ResultSink;
+
+	// 0 threads uses one per core
+	explicit BatchEvaluator(const Expression& iExp, unsigned iThreads = 0);
+	~BatchEvaluator();
+
+	void eval(const std::vector<Column>& iColumns, size_t iRows, double* oResults);
+	// Streams rows by blocks of iBlockRows: a block is read while the previous one is evaluated,
+	// so memory stays bounded by two blocks of inputs and results whatever the number of rows
+	void eval_stream(const std::vector<std::string>& iColumns, const RowSource& iSource, const ResultSink& iSink, size_t iBlockRows = 1 << 20);
+
+	unsigned threads() const { return static_cast<unsigned>(m_workers.size()); }
+
+private:
+	struct Worker;
+
+	BatchEvaluator(const BatchEvaluator&);
+	BatchEvaluator& operator= (const BatchEvaluator&);
+
+	void submit(const std::vector<Column>& iColumns, size_t iRows, double* oResults);
+	void wait();
+	void work(Worker& ioWorker);
+	bool take(Worker& ioWorker, size_t& oChunk);
+	void run(Worker& ioWorker, size_t iChunk);
+
+	Expression m_expression;
+	std::shared_ptr<const Program> m_program;
+	std::vector< std::unique_ptr<Worker> > m_workers;
+
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+	size_t m_generation;
+	bool m_stop;
+	std::exception_ptr m_error;
+
+	// Current job, only changed while no chunk is pending
+	std::vector<Column> m_columns;
+	const double* m_frame;
+	double* m_results;
+	size_t m_rows;
+	size_t m_chunk_rows;
+	std::atomic<size_t> m_pending;
+};
+
+}
+
+#endif /* CEP_BATCHEVALUATOR_H_ */
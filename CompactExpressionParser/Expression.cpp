@@ -7,74 +7,182 @@
 /** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
 
 #include "Expression.h"
-#include "SpiritParserDefinition.hpp"
-#include <boost/lambda/lambda.hpp>
+#include "Optimizer.h"
+#include "Parser.h"
+#include "Profile.h"
+#include "SyntaxTree.h"
 #include <functional>
 
 namespace CompactExpressionParser
 {
-namespace phoenix = boost::phoenix;
-namespace qi = boost::spirit::qi;
-namespace lambda = boost::lambda;
-using namespace std::placeholders;
+
+namespace
+{
+	// Tree of the expressions not compiled yet, shared by all of them
+	std::shared_ptr<const SyntaxTree> zero_tree()
+	{
+		static const std::shared_ptr<const SyntaxTree> tree = []()
+		{
+			std::shared_ptr<SyntaxTree> zero(new SyntaxTree);
+			zero->push_number(0.);
+			zero->compact();
+			return std::shared_ptr<const SyntaxTree>(zero);
+		}();
+		return tree;
+	}
+}
 
 Expression::Expression() :
-m_grammar(new ExpGrammar<std::string::const_iterator>),
-m_calculator(new ExpressionCalculator),
-m_result(new Unit)
+m_parser(new ExpParser),
+m_variables(new VariableSet),
+m_result(zero_tree()),
+m_program(new Program),
+m_backend(VirtualMachine)
 {}
 
 Expression::Expression(const Expression& iExp) :
-m_grammar(iExp.m_grammar),
-m_calculator(iExp.m_calculator),
-m_result(new Unit(*(iExp.m_result)))
-{}
+m_parser(iExp.m_parser),
+m_variables(iExp.m_variables),
+m_result(iExp.m_result),
+m_program(iExp.m_program),
+m_native(iExp.m_native),
+m_backend(iExp.m_backend)
+{
+	if(!iExp.m_profile) return;
+	m_profile = std::make_shared<Profile>(iExp.m_profile->period());
+	m_profile->reset(m_program, iExp.m_profile->source());
+}
 
 Expression::~Expression(){}
 
-bool Expression::compile(const std::string& iExpression)
+bool Expression::compile(const std::string& iExpression) { return compile(iExpression, false); }
+
+bool Expression::compile(const std::string& iExpression, bool iArguments)
+{
+	std::shared_ptr<SyntaxTree> parsed(new SyntaxTree);
+	if(m_profile) parsed->keep_spans();
+	if(!m_parser->parse(iExpression, *parsed, *m_variables, iArguments)) return false;
+	parsed->compact();
+	// The tree walker keeps evaluating the tree as parsed, as a reference
+	SyntaxTree optimized(*parsed);
+	optimize(optimized);
+	set_program(parsed, std::make_shared<const Program>(optimized), iExpression);
+	return true;
+}
+
+void Expression::set_program(const std::shared_ptr<const SyntaxTree>& iTree, const std::shared_ptr<const Program>& iProgram, const std::string& iSource)
+{
+	m_result = iTree;
+	m_program = iProgram;
+	update_native();
+	if(m_profile) m_profile->reset(m_program, iSource);
+}
+
+void Expression::update_native()
+{
+	if(m_backend != Native) m_native.reset();
+	else if(!m_native || m_native->program() != m_program) m_native = NativeProgram::compile(m_program);
+}
+
+double Expression::eval() { return eval(m_variables->data()); }
+
+double Expression::eval(const double* iFrame)
+{
+	if(m_profile && m_profile->sample()) return m_profile->eval(m_context, iFrame);
+	return eval(m_context, iFrame);
+}
+
+double Expression::eval(EvaluationContext& ioContext, const double* iFrame) const
+{
+	if(m_backend == TreeWalker) return ExpressionCalculator(*m_result, iFrame)();
+	if(m_native) return m_native->eval(ioContext, iFrame);
+	return m_program->eval(ioContext, iFrame);
+}
+
+ResultType Expression::run(EvaluationContext& ioContext, const double* iFrame, const ArgumentSpan* iArguments) const
 {
-	m_iter = iExpression.begin(); m_end = iExpression.end();
-	return (phrase_parse(m_iter, m_end, *m_grammar, boost::spirit::ascii::space, *m_result) && m_iter == m_end);
+	if(m_backend == TreeWalker) return ExpressionCalculator(*m_result, iFrame, iArguments)();
+	return m_program->run(ioContext, iFrame, iArguments);
 }
 
-double Expression::eval() { return (*m_calculator)(*m_result); }
 double Expression::operator() () { return eval(); }
 
-bool Expression::register_function(const std::string& iName, UserFunctionType iFunc)
+void Expression::eval_batch(const std::vector<Column>& iColumns, size_t iRows, double* oResults)
 {
-	return m_grammar->addFunction(iName,iFunc);
+	m_program->eval_batch(m_context, m_variables->data(), iColumns, iRows, oResults);
 }
 
-RuntimeFunction::RuntimeFunction(Expression& iExp, const std::string& iName)
-: m_Exp(iExp), m_name(iName)
+bool Expression::register_function(const std::string& iName, UserFunctionType iFunc, FunctionPurity iPurity)
 {
-	std::ostringstream arg_reader;
-	arg_reader << "_Binder_" << m_name;
-	m_arg_reader_name = arg_reader.str();
-	m_Exp.register_function(m_arg_reader_name,std::bind(std::mem_fn(&RuntimeFunction::ArgumentGetter),std::ref(*this),_1));
-	iExp.register_function(m_name,std::ref(*this));
+	return register_function(iName, iFunc, VectorFunctionType(), iPurity);
 }
 
-bool RuntimeFunction::compile(const std::string& iStringExpr)
+bool Expression::register_function(const std::string& iName, UserFunctionType iFunc, VectorFunctionType iVectorized, FunctionPurity iPurity)
+{
+	FunctionDefinition definition = { iFunc, SpanFunctionType(), iVectorized, iPurity, FunctionBodyType(), LazyFunctionType() };
+	return m_parser->addFunction(iName, definition);
+}
+
+bool Expression::register_function(const std::string& iName, SpanFunctionType iFunc, FunctionPurity iPurity)
+{
+	return register_function(iName, iFunc, VectorFunctionType(), iPurity);
+}
+
+bool Expression::register_function(const std::string& iName, SpanFunctionType iFunc, VectorFunctionType iVectorized, FunctionPurity iPurity)
+{
+	FunctionDefinition definition = { UserFunctionType(), iFunc, iVectorized, iPurity, FunctionBodyType(), LazyFunctionType() };
+	return m_parser->addFunction(iName, definition);
+}
+
+bool Expression::register_function(const std::string& iName, LazyFunctionType iFunc, FunctionPurity iPurity)
 {
-	std::ostringstream m_output;
-	std::string::const_iterator iter = iStringExpr.begin(); std::string::const_iterator end = iStringExpr.end();
-	bool func_parsing = qi::parse(iter,end,
-		*( (qi::char_ - '_')[ m_output << qi::_1 ] | '_' >> qi::int_[ lambda::var(m_output) << m_arg_reader_name << '(' << lambda::_1 << ')' ] )
-	);
-	if(func_parsing && iter == end)
-		return m_Exp.compile(m_output.str());
-	else
-		return false;
+	FunctionDefinition definition = { UserFunctionType(), SpanFunctionType(), VectorFunctionType(), iPurity, FunctionBodyType(), iFunc };
+	return m_parser->addFunction(iName, definition);
 }
 
-ResultType RuntimeFunction::ArgumentGetter(const std::vector<ResultType>& iIndex) {
-	return m_dynamic_args->at(static_cast<size_t>(iIndex[0]) - 1);
+void Expression::set_backend(Backend iBackend)
+{
+	m_backend = iBackend;
+	update_native();
 }
 
-ResultType RuntimeFunction::operator()(const std::vector<ResultType>& args) {
-	m_dynamic_args = &args; return m_Exp();
+std::shared_ptr<const Program> Expression::program() const { return m_program; }
+std::shared_ptr<const SyntaxTree> Expression::syntax_tree() const { return m_result; }
+std::shared_ptr<const NativeProgram> Expression::native_program() const { return m_native; }
+VariableSet& Expression::variables() { return *m_variables; }
+
+void Expression::set_profiling(size_t iPeriod)
+{
+	std::string source = m_profile ? m_profile->source() : std::string();
+	m_profile.reset();
+	if(!iPeriod) return;
+	m_profile = std::make_shared<Profile>(iPeriod);
+	m_profile->reset(m_program, source);
+}
+
+// Registered as volatile until the body of a pure function is compiled, so that its own calls are kept
+RuntimeFunction::RuntimeFunction(Expression& iExp, const std::string& iName, FunctionPurity iPurity)
+: m_name(iName), m_Exp(iExp), m_purity(iPurity), m_compiled(false)
+{
+	FunctionDefinition definition = { UserFunctionType(), SpanFunctionType(std::cref(*this)), VectorFunctionType(), Volatile,
+		[this]() { return m_Exp.m_result; }, LazyFunctionType() };
+	iExp.m_parser->addFunction(m_name, definition);
+}
+
+bool RuntimeFunction::compile(const std::string& iStringExpr)
+{
+	// Callers may have inlined the body
+	if(m_purity == Pure && m_compiled) return false;
+	if(!m_Exp.compile(iStringExpr, true)) return false;
+	m_compiled = true;
+	if(m_purity == Pure) m_Exp.m_parser->setPurity(m_name, Pure);
+	return true;
+}
+
+ResultType RuntimeFunction::operator()(const ArgumentSpan& args) const
+{
+	EvaluationContext::Nested nested;
+	return m_Exp.run(nested.context(), m_Exp.m_variables->data(), &args);
 }
 
 }
@@ -13,47 +13,108 @@
 #include <memory>
 
 #include "Interfaces.h"
+#include "NativeProgram.h"
+#include "Program.h"
+#include "VariableSet.h"
 
 namespace CompactExpressionParser
 {
 
-template <typename Iterator> struct ExpGrammar;
-struct Unit;
-struct ExpressionCalculator;
+class ExpParser;
+class Profile;
+class SyntaxTree;
 
+/** Compiled programs are immutable and shared between copies of an expression.
+ *
+ * Copies also share their registered functions and their variables, values
+ * included: an input set through the variables() of one copy is set for all of
+ * them, and compiling any copy may declare variables, moving their values.
+ * Threads may only evaluate through the const eval, each one passing its own
+ * context and its own frame, and no copy may compile meanwhile. */
 class Expression {
 public:
+	// The tree walker is kept as a reference to check the virtual machine against.
+	// Native code falls back to the virtual machine for programs it cannot translate.
+	enum Backend { VirtualMachine, TreeWalker, Native };
+
 	Expression();
 	Expression(const Expression& iExp);
 	virtual ~Expression();
 	bool compile(const std::string& iExpression);
 	double eval();
+	// Reads the variables from iFrame, laid out by the slots of variables()
+	double eval(const double* iFrame);
+	double eval(EvaluationContext& ioContext, const double* iFrame) const;
 	double operator() ();
-	bool register_function(const std::string& iName, UserFunctionType iFunc);
+	bool register_function(const std::string& iName, UserFunctionType iFunc, FunctionPurity iPurity = Volatile);
+	bool register_function(const std::string& iName, UserFunctionType iFunc, VectorFunctionType iVectorized, FunctionPurity iPurity = Volatile);
+	bool register_function(const std::string& iName, SpanFunctionType iFunc, FunctionPurity iPurity = Volatile);
+	bool register_function(const std::string& iName, SpanFunctionType iFunc, VectorFunctionType iVectorized, FunctionPurity iPurity = Volatile);
+	// Arguments are computed when the function reads them, and each time it does
+	bool register_function(const std::string& iName, LazyFunctionType iFunc, FunctionPurity iPurity = Volatile);
+	// Evaluates iRows rows, always on the virtual machine
+	void eval_batch(const std::vector<Column>& iColumns, size_t iRows, double* oResults);
+	void set_backend(Backend iBackend);
+	std::shared_ptr<const Program> program() const;
+	// Tree as parsed, before any optimization
+	std::shared_ptr<const SyntaxTree> syntax_tree() const;
+	// Set when the backend is Native and the program could be translated
+	std::shared_ptr<const NativeProgram> native_program() const;
+	// Names and values shared with the copies of this expression, like registered functions
+	VariableSet& variables();
+	// Profiles eval() and operator(), timing one evaluation in every iPeriod on the virtual machine:
+	// 1 times them all, 0 stops profiling. Evaluations given their own context are not profiled,
+	// and copies start a profile of their own. Spans of the source are recorded from the next compile on.
+	void set_profiling(size_t iPeriod);
+	// Nothing unless profiling
+	const Profile* profile() const { return m_profile.get(); }
 
 private:
-	std::shared_ptr< ExpGrammar<std::string::const_iterator> > m_grammar;
-	std::shared_ptr< ExpressionCalculator > m_calculator;
-	std::unique_ptr< Unit > m_result;
-	std::string::const_iterator m_iter, m_end;
+	friend class RuntimeFunction;
+	friend class ExpressionCache;
+	friend class ProgramBundle;
+	friend class ExpressionProgram;
+	bool compile(const std::string& iExpression, bool iArguments);
+	// Every path replacing the program goes through here, the native code and the profile following it
+	void set_program(const std::shared_ptr<const SyntaxTree>& iTree, const std::shared_ptr<const Program>& iProgram, const std::string& iSource);
+	void update_native();
+	ResultType run(EvaluationContext& ioContext, const double* iFrame, const ArgumentSpan* iArguments) const;
+
+	std::shared_ptr< ExpParser > m_parser;
+	std::shared_ptr< VariableSet > m_variables;
+	std::shared_ptr< const SyntaxTree > m_result;
+	std::shared_ptr< const Program > m_program;
+	std::shared_ptr< const NativeProgram > m_native;
+	EvaluationContext m_context;
+	Backend m_backend;
+	std::shared_ptr< Profile > m_profile;
 };
 
+/** Function written as an expression, reading its arguments as _1, _2...
+ *
+ * A pure function is compiled once: expressions compiled after its body inline
+ * it where they call the function, so that calling it costs as much as writing
+ * its formula in place, and compiling it again fails. Volatile functions may be
+ * compiled again, calls to them always running the current body.
+ *
+ * Calls that are not inlined, recursive ones among them, pass their arguments
+ * down to the body instead of storing them, and each call evaluates in a context
+ * of its own: calls may be nested, recursive, or made from several threads at once. */
 class RuntimeFunction
 {
 public:
-	RuntimeFunction(Expression& iExp, const std::string& iName);
+	RuntimeFunction(Expression& iExp, const std::string& iName, FunctionPurity iPurity = Volatile);
 	bool compile(const std::string& iStringExpr);
-	ResultType operator()(const std::vector<ResultType>& args);
+	ResultType operator()(const ArgumentSpan& args) const;
 
 private:
 	RuntimeFunction(const RuntimeFunction&);
 	RuntimeFunction& operator= (const RuntimeFunction&);
-	ResultType ArgumentGetter(const std::vector<ResultType>& iIndex);
 
 	std::string m_name;
-	std::string m_arg_reader_name;
 	Expression m_Exp;
-	const std::vector<ResultType> * m_dynamic_args;
+	FunctionPurity m_purity;
+	bool m_compiled;
 };
 
 }
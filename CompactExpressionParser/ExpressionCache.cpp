@@ -0,0 +1,154 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#include "ExpressionCache.h"
+#include "Parser.h"
+#include "SyntaxTree.h"
+
+#include <cctype>
+#include <cstring>
+
+namespace CompactExpressionParser
+{
+
+namespace
+{
+	bool is_space(char iChar) { return std::isspace(static_cast<unsigned char>(iChar)) != 0; }
+	bool is_word(char iChar) { return std::isalnum(static_cast<unsigned char>(iChar)) || iChar == '_' || iChar == '.'; }
+
+	// Spaces between two tokens can go, spaces that may split a token apart must stay: a sign
+	// followed by a number ("- 1" is not a number) or an exponent ("1e +5" is not a number either)
+	bool space_matters(const std::string& iBefore, char iAfter)
+	{
+		char before = iBefore[iBefore.size() - 1];
+		if(std::strchr("(),*/^?:", before) || std::strchr("(),*/^?:", iAfter)) return false;
+		// "< =" does not parse as "<="
+		if(std::strchr("<>=!&|", before) && std::strchr("<>=!&|", iAfter)) return true;
+		if((iAfter == '+' || iAfter == '-') && (before == 'e' || before == 'E')) return true;
+		if(before == '+' || before == '-')
+		{
+			// A sign ending an operand is a binary operator, any other one may start a number
+			char operand = iBefore.size() > 1 ? iBefore[iBefore.size() - 2] : '\0';
+			bool binary = (is_word(operand) && operand != 'e' && operand != 'E') || operand == ')' || operand == '"';
+			return !binary && is_word(iAfter);
+		}
+		return is_word(before) && is_word(iAfter);
+	}
+
+	// The variables of a cached program must have the same slots in the expression using it
+	bool same_slots(const std::vector<ProgramVariable>& iVariables, VariableSet& ioSet)
+	{
+		for(const ProgramVariable& variable : iVariables)
+		{
+			size_t slot;
+			if(!ioSet.find(variable.name, slot)) slot = ioSet.declare(variable.name);
+			if(slot != variable.slot) return false;
+		}
+		return true;
+	}
+}
+
+ExpressionCache::ExpressionCache(size_t iCapacity) :
+m_capacity(iCapacity ? iCapacity : 1),
+m_hits(0),
+m_misses(0),
+m_evictions(0)
+{}
+
+std::string ExpressionCache::normalize(const std::string& iSource)
+{
+	std::string result;
+	result.reserve(iSource.size());
+	bool pending_space = false;
+	for(std::string::const_iterator iter = iSource.begin(); iter != iSource.end(); ++iter)
+	{
+		if(is_space(*iter)) { pending_space = !result.empty(); continue; }
+		if(pending_space && space_matters(result, *iter)) result += ' ';
+		pending_space = false;
+		result += *iter;
+		// String literals are kept as they are, up to their closing quote
+		if(*iter != '"') continue;
+		while(++iter != iSource.end())
+		{
+			result += *iter;
+			if(*iter == '"') break;
+			if(*iter == '\\' && iter + 1 != iSource.end()) result += *++iter;
+		}
+		if(iter == iSource.end()) break;
+	}
+	return result;
+}
+
+bool ExpressionCache::compile(Expression& ioExp, const std::string& iSource)
+{
+	// Identifies the function objects themselves, shared by the copies of an expression only
+	size_t functions = ioExp.m_parser->functions_id();
+	std::string key(reinterpret_cast<const char*>(&functions), sizeof(functions));
+	key.append(normalize(iSource));
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::unordered_map<std::string, EntryList::iterator>::iterator found = m_index.find(key);
+		if(found != m_index.end() && same_slots(found->second->variables, *ioExp.m_variables))
+		{
+			m_entries.splice(m_entries.begin(), m_entries, found->second);
+			ioExp.set_program(found->second->tree, found->second->program, iSource);
+			++m_hits;
+			return true;
+		}
+		++m_misses;
+	}
+
+	// Compiled without holding the lock, other threads keep being served meanwhile
+	if(!ioExp.compile(iSource, false)) return false;
+	// Variables read by the tree as parsed, a superset of the ones read by the optimized program
+	Entry entry = { key, ioExp.m_result, ioExp.m_program, std::vector<ProgramVariable>() };
+	for(const SyntaxVariable& variable : entry.tree->variables())
+	{
+		ProgramVariable read = { variable.name, variable.slot };
+		entry.variables.push_back(read);
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::unordered_map<std::string, EntryList::iterator>::iterator found = m_index.find(key);
+	if(found != m_index.end())
+	{
+		m_entries.erase(found->second);
+		m_index.erase(found);
+	}
+	m_entries.push_front(entry);
+	m_index[key] = m_entries.begin();
+	while(m_entries.size() > m_capacity)
+	{
+		m_index.erase(m_entries.back().key);
+		m_entries.pop_back();
+		++m_evictions;
+	}
+	return true;
+}
+
+std::shared_ptr<const Program> ExpressionCache::program(Expression& ioExp, const std::string& iSource)
+{
+	return compile(ioExp, iSource) ? ioExp.program() : std::shared_ptr<const Program>();
+}
+
+ExpressionCache::Statistics ExpressionCache::statistics() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Statistics statistics = { m_hits, m_misses, m_evictions, m_entries.size() };
+	return statistics;
+}
+
+void ExpressionCache::clear()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_entries.clear();
+	m_index.clear();
+}
+
+}
@@ -0,0 +1,86 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#ifndef CEP_EXPRESSIONCACHE_H_
+#define CEP_EXPRESSIONCACHE_H_
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Expression.h"
+
+namespace CompactExpressionParser
+{
+
+/** Compiled expressions by source text, least recently used ones evicted first.
+ *
+ * Sources are keyed once normalized, whitespace that cannot change their meaning
+ * being removed, together with the set of functions registered in the expression
+ * compiling them. A hit hands the shared program over without parsing again, as
+ * long as the variables it reads have the same slots in the expression.
+ *
+ * Programs call the very function objects they were compiled with, so entries are
+ * only shared by expressions sharing their registered functions: the copies of an
+ * expression, until one of them registers another function. Independent expressions
+ * registering the same names do not share entries, since their functions may hold
+ * different state; register the functions once on a prototype and cache its copies.
+ *
+ * The cache can be shared by several threads; each expression given to it must
+ * only be used by one thread at a time, as when compiling it directly. */
+class ExpressionCache
+{
+public:
+	struct Statistics
+	{
+		size_t hits;
+		size_t misses;
+		size_t evictions;
+		size_t size;
+	};
+
+	explicit ExpressionCache(size_t iCapacity = 1024);
+
+	// Same as ioExp.compile(iSource), the program being taken from the cache when possible
+	bool compile(Expression& ioExp, const std::string& iSource);
+	std::shared_ptr<const Program> program(Expression& ioExp, const std::string& iSource);
+
+	Statistics statistics() const;
+	size_t capacity() const { return m_capacity; }
+	void clear();
+
+	static std::string normalize(const std::string& iSource);
+
+private:
+	struct Entry
+	{
+		std::string key;
+		std::shared_ptr<const SyntaxTree> tree;
+		std::shared_ptr<const Program> program;
+		std::vector<ProgramVariable> variables;
+	};
+	typedef std::list<Entry> EntryList;
+
+	ExpressionCache(const ExpressionCache&);
+	ExpressionCache& operator= (const ExpressionCache&);
+
+	size_t m_capacity;
+	mutable std::mutex m_mutex;
+	EntryList m_entries;  // Most recently used first
+	std::unordered_map<std::string, EntryList::iterator> m_index;
+	size_t m_hits;
+	size_t m_misses;
+	size_t m_evictions;
+};
+
+}
+
+#endif /* CEP_EXPRESSIONCACHE_H_ */
@@ -0,0 +1,67 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#include "ExpressionProgram.h"
+#include "Expression.h"
+#include "Optimizer.h"
+#include "Parser.h"
+
+namespace CompactExpressionParser
+{
+
+ExpressionProgram::ExpressionProgram(const Expression& iPrototype) :
+m_parser(iPrototype.m_parser),
+m_variables(iPrototype.m_variables)
+{}
+
+bool ExpressionProgram::add(const std::string& iName, const std::string& iExpression)
+{
+	if(m_index.count(iName)) return false;
+	SyntaxTree parsed;
+	if(!m_parser->parse(iExpression, parsed, *m_variables)) return false;
+	optimize(parsed);
+	m_forest.append(parsed);
+	m_roots.push_back(m_forest.root());
+	m_index[iName] = m_names.size();
+	m_names.push_back(iName);
+	m_program.reset();
+	return true;
+}
+
+bool ExpressionProgram::find(const std::string& iName, size_t& oIndex) const
+{
+	std::map<std::string, size_t>::const_iterator found = m_index.find(iName);
+	if(found == m_index.end()) return false;
+	oIndex = found->second;
+	return true;
+}
+
+std::shared_ptr<const Program> ExpressionProgram::program()
+{
+	if(!m_program && !m_roots.empty())
+	{
+		m_forest.compact();
+		m_program = std::make_shared<const Program>(m_forest, m_roots);
+	}
+	return m_program;
+}
+
+const std::vector<double>& ExpressionProgram::eval()
+{
+	program();
+	m_results.resize(m_roots.size());
+	eval(m_context, m_variables->data(), m_results.data());
+	return m_results;
+}
+
+void ExpressionProgram::eval(EvaluationContext& ioContext, const double* iFrame, double* oResults) const
+{
+	if(m_program) m_program->eval_outputs(ioContext, iFrame, oResults);
+}
+
+}
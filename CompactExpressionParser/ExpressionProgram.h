@@ -0,0 +1,75 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#ifndef CEP_EXPRESSIONPROGRAM_H_
+#define CEP_EXPRESSIONPROGRAM_H_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Program.h"
+#include "SyntaxTree.h"
+#include "VariableSet.h"
+
+namespace CompactExpressionParser
+{
+
+class Expression;
+class ExpParser;
+
+/** Set of named expressions compiled together and evaluated in a single pass.
+ *
+ * Each expression is parsed and optimized on its own, then appended to a
+ * forest holding all of them. The whole forest is lowered to one program:
+ * structurally equal subtrees are computed once whichever expressions they
+ * come from, calls to volatile functions excepted, and every output is read
+ * from the stacks at the end of the run.
+ *
+ * Functions and variables are the ones of the expression given on construction,
+ * shared with it and with its copies. */
+class ExpressionProgram
+{
+public:
+	explicit ExpressionProgram(const Expression& iPrototype);
+
+	// Fails when the expression does not parse or the name is already taken
+	bool add(const std::string& iName, const std::string& iExpression);
+	size_t size() const { return m_names.size(); }
+	const std::string& name(size_t iIndex) const { return m_names[iIndex]; }
+	bool find(const std::string& iName, size_t& oIndex) const;
+
+	// One result per expression, in the order they were added
+	const std::vector<double>& eval();
+	// Runs the program built by the last call to program() or eval(), writing size() doubles to oResults.
+	// Writes nothing when expressions were added since.
+	void eval(EvaluationContext& ioContext, const double* iFrame, double* oResults) const;
+	// Lowers every expression again once some were added since the last call, the program being kept until then
+	std::shared_ptr<const Program> program();
+	VariableSet& variables() { return *m_variables; }
+
+private:
+	ExpressionProgram(const ExpressionProgram&);
+	ExpressionProgram& operator= (const ExpressionProgram&);
+
+	std::shared_ptr<ExpParser> m_parser;
+	std::shared_ptr<VariableSet> m_variables;
+	SyntaxTree m_forest;
+	std::vector<std::uint32_t> m_roots;
+	std::vector<std::string> m_names;
+	std::map<std::string, size_t> m_index;
+	std::shared_ptr<const Program> m_program;  // Null once expressions were added since the last lowering
+	std::vector<double> m_results;
+	EvaluationContext m_context;
+};
+
+}
+
+#endif /* CEP_EXPRESSIONPROGRAM_H_ */
@@ -0,0 +1,240 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#include "IncrementalEvaluator.h"
+#include "Operators.h"
+#include "Optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace CompactExpressionParser
+{
+
+namespace
+{
+	// Tells 0 from -0, and takes NaN as equal to itself
+	bool same_number(double iLeft, double iRight)
+	{
+		if(std::isnan(iLeft) || std::isnan(iRight)) return std::isnan(iLeft) && std::isnan(iRight);
+		return iLeft == iRight && std::signbit(iLeft) == std::signbit(iRight);
+	}
+
+	bool same_result(const ResultType& iLeft, const ResultType& iRight)
+	{
+		if(iLeft.IsNumber() != iRight.IsNumber()) return false;
+		if(iLeft.IsNumber()) return same_number(iLeft, iRight);
+		return iLeft.StringView() == iRight.StringView();
+	}
+}
+
+const std::uint32_t IncrementalEvaluator::NoParent;
+
+IncrementalEvaluator::IncrementalEvaluator(const Expression& iExp) :
+m_exp(iExp),
+m_tree(*iExp.syntax_tree()),
+m_frame(nullptr),
+m_first_marked(0),
+m_evaluations(0),
+m_evaluated(false),
+m_changed(false),
+m_recomputed(0)
+{
+	optimize(m_tree);
+	m_tree.guards(m_guards);
+	m_parents.assign(m_tree.size(), NoParent);
+	m_numbers.resize(m_tree.size());
+	m_values.resize(m_tree.size());
+	reset();
+	m_changes.assign(m_tree.size(), 0);
+	m_readers.resize(m_tree.variables().size());
+	m_calls.resize(m_tree.functions().size());
+	m_inputs.resize(m_tree.variables().size());
+	m_operands_begin.reserve(m_tree.size() + 1);
+
+	std::vector<std::uint32_t> roots;
+	for(std::uint32_t node = 0; node < m_tree.size(); ++node)
+	{
+		m_operands_begin.push_back(static_cast<std::uint32_t>(m_operands.size()));
+		// Guarded nodes have neither operands nor parent: their inputs mark the node guarding them
+		std::uint32_t reader = m_guards[node] == SyntaxTree::Unguarded ? node : m_guards[node];
+		switch(m_tree.node(node).kind)
+		{
+			case SyntaxNode::Number: case SyntaxNode::String: case SyntaxNode::Argument: break;
+			case SyntaxNode::Variable: m_readers[m_tree.node(node).operand].push_back(reader); break;
+			case SyntaxNode::Call:
+				m_calls[m_tree.node(node).operand].push_back(reader);
+				if(reader != node || m_tree.is_lazy(node)) break;
+				m_tree.arguments(node, roots);
+				m_operands.insert(m_operands.end(), roots.begin(), roots.end());
+				break;
+			case SyntaxNode::Select:
+				if(reader == node) m_operands.push_back(m_tree.first(m_tree.left(node)) - 1);
+				break;
+			case SyntaxNode::And: case SyntaxNode::Or:
+				if(reader == node) m_operands.push_back(m_tree.left(node));
+				break;
+			default:
+				if(reader != node) break;
+				m_operands.push_back(m_tree.left(node));
+				m_operands.push_back(m_tree.right(node));
+		}
+		for(size_t operand = m_operands_begin.back(); operand < m_operands.size(); ++operand) m_parents[m_operands[operand]] = node;
+	}
+	m_operands_begin.push_back(static_cast<std::uint32_t>(m_operands.size()));
+}
+
+double IncrementalEvaluator::eval()
+{
+	m_frame = m_exp.variables().data();
+	const std::vector<SyntaxVariable>& variables = m_tree.variables();
+	for(size_t variable = 0; variable < variables.size(); ++variable)
+	{
+		double value = m_frame[variables[variable].slot];
+		if(m_evaluated && same_number(value, m_inputs[variable])) continue;
+		m_inputs[variable] = value;
+		for(std::uint32_t node : m_readers[variable]) mark(node);
+	}
+
+	// Marked nodes are all between the lowest one and the root
+	m_recomputed = 0;
+	++m_evaluations;
+	try
+	{
+		for(std::uint32_t node = m_first_marked; node < m_tree.size(); ++node)
+			if(m_states[node] != Clean) refresh(node);
+	}
+	catch(...)
+	{
+		// Results computed before the failure are lost for the nodes above: everything is computed again next time
+		reset();
+		m_first_marked = 0;
+		m_evaluated = false;
+		throw;
+	}
+	m_changed = m_changes[m_tree.root()] == m_evaluations;
+	m_first_marked = static_cast<std::uint32_t>(m_tree.size());
+	m_evaluated = true;
+	return operand(m_tree.root());
+}
+
+ResultType IncrementalEvaluator::result() const
+{
+	return is_number(m_tree.root()) ? ResultType(m_numbers[m_tree.root()]) : m_values[m_tree.root()];
+}
+
+void IncrementalEvaluator::invalidate(const std::string& iFunction)
+{
+	const std::vector<SyntaxFunction>& functions = m_tree.functions();
+	for(size_t function = 0; function < functions.size(); ++function)
+		if(functions[function].name == iFunction)
+			for(std::uint32_t node : m_calls[function]) mark(node);
+}
+
+void IncrementalEvaluator::invalidate_volatile()
+{
+	const std::vector<SyntaxFunction>& functions = m_tree.functions();
+	for(size_t function = 0; function < functions.size(); ++function)
+		if(functions[function].definition.purity != Pure)
+			for(std::uint32_t node : m_calls[function]) mark(node);
+}
+
+void IncrementalEvaluator::reset()
+{
+	m_states.resize(m_tree.size());
+	for(std::uint32_t node = 0; node < m_tree.size(); ++node) m_states[node] = m_guards[node] == SyntaxTree::Unguarded ? Dirty : Clean;
+}
+
+// Ancestors of a node to compute again are on the path: marking stops at the first one already marked
+void IncrementalEvaluator::mark(std::uint32_t iNode)
+{
+	m_states[iNode] = Dirty;
+	m_first_marked = std::min(m_first_marked, iNode);
+	for(std::uint32_t node = m_parents[iNode]; node != NoParent && m_states[node] == Clean; node = m_parents[node])
+		m_states[node] = Path;
+}
+
+// Returns true when the result of the node changed. Operands come first in postfix order, they are already refreshed.
+bool IncrementalEvaluator::refresh(std::uint32_t iNode)
+{
+	std::uint8_t state = m_states[iNode];
+	m_states[iNode] = Clean;
+	if(state != Dirty)
+	{
+		bool operands = false;
+		for(std::uint32_t operand = m_operands_begin[iNode]; operand < m_operands_begin[iNode + 1] && !operands; ++operand)
+			operands = m_changes[m_operands[operand]] == m_evaluations;
+		if(!operands) return false;
+	}
+	++m_recomputed;
+	if(is_number(iNode))
+	{
+		double number = compute_number(iNode);
+		if(m_evaluated && same_number(number, m_numbers[iNode])) return false;
+		m_numbers[iNode] = number;
+	}
+	else
+	{
+		ResultType value = compute_value(iNode);
+		if(m_evaluated && same_result(value, m_values[iNode])) return false;
+		m_values[iNode] = value;
+	}
+	m_changes[iNode] = m_evaluations;
+	return true;
+}
+
+double IncrementalEvaluator::compute_number(std::uint32_t iNode) const
+{
+	switch(m_tree.node(iNode).kind)
+	{
+		case SyntaxNode::Number: return m_tree.number(iNode);
+		case SyntaxNode::Variable: return m_frame[m_tree.variable(iNode).slot];
+		case SyntaxNode::Add: return add::apply(operand(m_tree.left(iNode)), operand(m_tree.right(iNode)));
+		case SyntaxNode::Sub: return sub::apply(operand(m_tree.left(iNode)), operand(m_tree.right(iNode)));
+		case SyntaxNode::Mult: return mult::apply(operand(m_tree.left(iNode)), operand(m_tree.right(iNode)));
+		case SyntaxNode::Divide: return divide::apply(operand(m_tree.left(iNode)), operand(m_tree.right(iNode)));
+		case SyntaxNode::Less: return less::apply(operand(m_tree.left(iNode)), operand(m_tree.right(iNode)));
+		case SyntaxNode::LessEqual: return less_equal::apply(operand(m_tree.left(iNode)), operand(m_tree.right(iNode)));
+		case SyntaxNode::Greater: return greater::apply(operand(m_tree.left(iNode)), operand(m_tree.right(iNode)));
+		case SyntaxNode::GreaterEqual: return greater_equal::apply(operand(m_tree.left(iNode)), operand(m_tree.right(iNode)));
+		case SyntaxNode::Equal: return equal::apply(operand(m_tree.left(iNode)), operand(m_tree.right(iNode)));
+		case SyntaxNode::NotEqual: return not_equal::apply(operand(m_tree.left(iNode)), operand(m_tree.right(iNode)));
+		case SyntaxNode::And:
+			return truth(operand(m_tree.left(iNode))) && truth(compute_guarded(m_tree.right(iNode))) ? 1. : 0.;
+		case SyntaxNode::Or:
+			return truth(operand(m_tree.left(iNode))) || truth(compute_guarded(m_tree.right(iNode))) ? 1. : 0.;
+		default: return power::apply(operand(m_tree.left(iNode)), operand(m_tree.right(iNode)));
+	}
+}
+
+ResultType IncrementalEvaluator::compute_value(std::uint32_t iNode)
+{
+	switch(m_tree.node(iNode).kind)
+	{
+		case SyntaxNode::String: return m_tree.string(iNode);
+		case SyntaxNode::Argument: throw std::out_of_range("Function argument");
+		// The condition is the only operand kept, the branches are the last two nodes under the selection
+		case SyntaxNode::Select:
+			return compute_guarded(truth(operand(m_operands[m_operands_begin[iNode]])) ? m_tree.left(iNode) : m_tree.right(iNode));
+		default:
+		{
+			if(m_tree.is_lazy(iNode)) return compute_guarded(iNode);
+			m_arguments.clear();
+			for(std::uint32_t operand = m_operands_begin[iNode]; operand < m_operands_begin[iNode + 1]; ++operand)
+			{
+				std::uint32_t arg = m_operands[operand];
+				if(is_number(arg)) m_arguments.push_back(m_numbers[arg]);
+				else m_arguments.push_back(m_values[arg]);
+			}
+			return m_tree.function(iNode).definition.invoke(m_arguments.data(), m_arguments.size(), m_scratch);
+		}
+	}
+}
+
+}
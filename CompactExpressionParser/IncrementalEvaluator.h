@@ -0,0 +1,102 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#ifndef CEP_INCREMENTALEVALUATOR_H_
+#define CEP_INCREMENTALEVALUATOR_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Expression.h"
+#include "SyntaxTree.h"
+
+namespace CompactExpressionParser
+{
+
+/** Evaluates an expression again after some of its inputs changed, computing only what depends on them.
+ *
+ * The result of every subtree is kept. Inputs are the variables, compared on each
+ * evaluation with the values seen by the previous one, and the function calls,
+ * made again only when their arguments change or after invalidate() for their
+ * function: functions such as UserArg, reading a state of their own, must be
+ * invalidated whenever that state changes. Changed inputs mark the path up to
+ * the root; evaluating walks that path only, and stops going up as soon as a
+ * subtree gives the same result as before.
+ *
+ * Subtrees computed only under a condition, the operands of && and || past the
+ * first, the branches of "c ? a : b" and the arguments of lazy functions, keep no
+ * result: the conditional node computes them again whenever its inputs change,
+ * the inputs they read being its own.
+ *
+ * The evaluator works on the expression as compiled when it is built, and reads
+ * its variables from the expression. */
+class IncrementalEvaluator
+{
+public:
+	explicit IncrementalEvaluator(const Expression& iExp);
+
+	double eval();
+	ResultType result() const;
+	// Whether the last evaluation gave another result than the one before it
+	bool changed() const { return m_changed; }
+	// Subtrees computed again by the last evaluation
+	size_t recomputed() const { return m_recomputed; }
+
+	void set(const std::string& iVariable, double iValue) { m_exp.variables()[iVariable] = iValue; }
+	// Calls to iFunction are made again by the next evaluation
+	void invalidate(const std::string& iFunction);
+	// Every call to a volatile function is made again by the next evaluation
+	void invalidate_volatile();
+
+private:
+	// Nodes to compute again, and the ones only on the path to them
+	enum State { Clean, Path, Dirty };
+	static const std::uint32_t NoParent = 0xFFFFFFFF;
+
+	void reset();
+	void mark(std::uint32_t iNode);
+	bool refresh(std::uint32_t iNode);
+	double compute_number(std::uint32_t iNode) const;
+	ResultType compute_value(std::uint32_t iNode);
+	// Subtree under a condition, computed as a whole
+	ResultType compute_guarded(std::uint32_t iNode) const { return ExpressionCalculator(m_tree, m_frame).evaluate(iNode); }
+	// Numbers, variables and operations give doubles, kept apart from the results of calls, selections and strings
+	bool is_number(std::uint32_t iNode) const
+	{
+		std::uint8_t kind = m_tree.node(iNode).kind;
+		return kind != SyntaxNode::String && kind != SyntaxNode::Argument && kind != SyntaxNode::Call && kind != SyntaxNode::Select;
+	}
+	double operand(std::uint32_t iNode) const { return is_number(iNode) ? m_numbers[iNode] : static_cast<double>(m_values[iNode]); }
+
+	Expression m_exp;
+	SyntaxTree m_tree;
+	std::vector<std::uint32_t> m_parents;
+	std::vector<std::uint32_t> m_guards;                  // See SyntaxTree::guards()
+	std::vector<std::uint32_t> m_operands;                // Roots of the operands of each node, in order
+	std::vector<std::uint32_t> m_operands_begin;          // By node, one more than nodes
+	std::vector<double> m_numbers;
+	std::vector<ResultType> m_values;
+	std::vector<std::uint8_t> m_states;
+	std::vector<std::uint32_t> m_changes;                 // Last evaluation that changed each node
+	std::vector< std::vector<std::uint32_t> > m_readers;  // Nodes reading each variable of the tree
+	std::vector< std::vector<std::uint32_t> > m_calls;    // Nodes calling each function of the tree
+	std::vector<double> m_inputs;                         // Variables as seen by the last evaluation
+	std::vector<ResultType> m_arguments;
+	std::vector<ResultType> m_scratch;
+	const double* m_frame;
+	std::uint32_t m_first_marked;
+	std::uint32_t m_evaluations;
+	bool m_evaluated;
+	bool m_changed;
+	size_t m_recomputed;
+};
+
+}
+
+#endif /* CEP_INCREMENTALEVALUATOR_H_ */
@@ -7,23 +7,108 @@
 /** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
 #include "Interfaces.h"
 
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
 namespace CompactExpressionParser {
 
-ResultType::ResultType() {}
-ResultType::ResultType(double value) : value_(value) {}
-ResultType::ResultType(std::string const& value) : value_(value) {}
-ResultType& ResultType::operator= (double value) { value_ = value; return *this; }
-ResultType& ResultType::operator= (std::string const& value) { value_ = value; return *this; }
-bool ResultType::IsNumber() const { return nullptr != boost::get<double>(&value_); }
+const size_t ResultType::SmallCapacity;
+
+// Allocated with its characters right after it
+struct ResultType::SharedString {
+  std::atomic<size_t> references;
+  size_t size;
+
+  const char* chars() const { return reinterpret_cast<const char*>(this + 1); }
+  char* chars() { return reinterpret_cast<char*>(this + 1); }
+};
+
+ResultType::ResultType(std::string const& value) : kind_(Number) { assign(value.data(), value.size()); }
+ResultType::ResultType(const char* data, size_t size) : kind_(Number) { assign(data, size); }
+
+ResultType& ResultType::operator= (ResultType const& other) {
+  if (this == &other) return *this;
+  if (kind_ == Shared) release();
+  copy(other);
+  return *this;
+}
+
+ResultType& ResultType::operator= (std::string const& value) {
+  if (kind_ == Shared) release();
+  assign(value.data(), value.size());
+  return *this;
+}
+
+ResultType::operator std::string () const {
+  boost::string_view view = StringView();
+  return std::string(view.data(), view.size());
+}
+
+boost::string_view ResultType::StringView() const {
+  if (kind_ == Small) return boost::string_view(small_, size_);
+  if (kind_ == Shared) return boost::string_view(shared_->chars(), shared_->size);
+  return boost::string_view();
+}
+
+// Numbers and small strings are copied as they are, shared strings gain a reference
+void ResultType::copy(ResultType const& other) {
+  std::memcpy(static_cast<void*>(this), &other, sizeof(ResultType));
+  if (kind_ == Shared) shared_->references.fetch_add(1, std::memory_order_relaxed);
+}
+
+// The current value is already released
+void ResultType::assign(const char* data, size_t size) {
+  if (size <= SmallCapacity) {
+    std::memcpy(small_, data, size);
+    size_ = static_cast<std::uint8_t>(size);
+    kind_ = Small;
+    return;
+  }
+  SharedString* shared = new (::operator new(sizeof(SharedString) + size)) SharedString;
+  shared->references.store(1, std::memory_order_relaxed);
+  shared->size = size;
+  std::memcpy(shared->chars(), data, size);
+  shared_ = shared;
+  kind_ = Shared;
+}
+
+void ResultType::release() {
+  if (shared_->references.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+  shared_->~SharedString();
+  ::operator delete(shared_);
+}
 
-ResultType::operator double () const { 
-  double const * pv = boost::get<double>(&value_);
-  return pv ? *pv : 0.;
+void ResultType::swap(ResultType& other) noexcept {
+  char bytes[sizeof(ResultType)];
+  std::memcpy(bytes, static_cast<void*>(this), sizeof(ResultType));
+  std::memcpy(static_cast<void*>(this), &other, sizeof(ResultType));
+  std::memcpy(static_cast<void*>(&other), bytes, sizeof(ResultType));
 }
 
-ResultType::operator std::string () const { 
-  std::string const * pv = boost::get<std::string>(&value_);
-  return pv ? *pv : "";
+namespace {
+// Lazy arguments over values already computed
+class ComputedArguments : public LazyArguments {
+  const ResultType* begin_;
+  size_t size_;
+
+ public:
+  ComputedArguments(const ResultType* begin, size_t size) : begin_(begin), size_(size) {}
+  size_t size() const { return size_; }
+  ResultType operator[](size_t index) const {
+    if (index >= size_) throw std::out_of_range("Function argument");
+    return begin_[index];
+  }
+};
+}  // namespace
+
+ResultType FunctionDefinition::invoke(const ResultType* iArgs, size_t iCount, std::vector<ResultType>& ioScratch) const {
+  if (span) return span(ArgumentSpan(iArgs, iCount));
+  if (lazy) return lazy(ComputedArguments(iArgs, iCount));
+  // Assigning within the capacity kept from previous calls does not allocate
+  ioScratch.assign(iArgs, iArgs + iCount);
+  return func(ioScratch);
 }
 
 };  // namespace CompactExpressionParser
@@ -9,27 +9,132 @@
 #ifndef CEP_INTERFACES_H_
 #define CEP_INTERFACES_H_
 
+#include <cstdint>
 #include <vector>
 #include <string>
-#include <boost/variant.hpp>
+#include <boost/utility/string_view.hpp>
 #include <functional>
+#include <memory>
 
 namespace CompactExpressionParser {
-class ResultType { 
-  boost::variant<double, std::string> value_;
+class SyntaxTree;
 
+// A double or a string. Strings of up to SmallCapacity characters are stored in place,
+// longer ones are shared by the copies: copying a result never allocates, and string
+// literals are built once, when compiling.
+class ResultType {
  public:
-  ResultType();
-  ResultType(double value);
+  static const size_t SmallCapacity = 16;
+
+  ResultType() : number_(0.), size_(0), kind_(Number) {}
+  ResultType(double value) : number_(value), size_(0), kind_(Number) {}
   ResultType(std::string const& value);
-  ResultType& operator= (double value);
+  ResultType(const char* data, size_t size);
+  ResultType(ResultType const& other) { copy(other); }
+  ResultType(ResultType&& other) noexcept : number_(0.), size_(0), kind_(Number) { swap(other); }
+  ~ResultType() { if (kind_ == Shared) release(); }
+  ResultType& operator= (ResultType const& other);
+  ResultType& operator= (ResultType&& other) noexcept { swap(other); return *this; }
+  ResultType& operator= (double value) {
+    if (kind_ == Shared) release();
+    number_ = value;
+    kind_ = Number;
+    return *this;
+  }
   ResultType& operator= (std::string const& value);
-  bool IsNumber() const;
-  operator double () const;
+  bool IsNumber() const { return kind_ == Number; }
+  operator double () const { return kind_ == Number ? number_ : 0.; }
   operator std::string () const;
+  // Characters of a string, read in place as long as the result is neither changed nor destroyed.
+  // Empty for numbers.
+  boost::string_view StringView() const;
+
+ private:
+  enum Kind { Number, Small, Shared };
+  struct SharedString;
+
+  void copy(ResultType const& other);
+  void assign(const char* data, size_t size);
+  void release();
+  void swap(ResultType& other) noexcept;
+
+  union {
+    double number_;
+    SharedString* shared_;
+    char small_[SmallCapacity];
+  };
+  std::uint8_t size_;  // Of a small string
+  std::uint8_t kind_;
 };
 
 typedef std::function< ResultType (const std::vector<ResultType>&) > UserFunctionType;
+
+// Non-owning view over the arguments of a call, which stay on the evaluation stack
+class ArgumentSpan {
+  const ResultType* begin_;
+  size_t size_;
+
+ public:
+  ArgumentSpan(const ResultType* begin, size_t size) : begin_(begin), size_(size) {}
+  size_t size() const { return size_; }
+  bool empty() const { return 0 == size_; }
+  const ResultType& operator[](size_t index) const { return begin_[index]; }
+  const ResultType* begin() const { return begin_; }
+  const ResultType* end() const { return begin_ + size_; }
+};
+
+// Calling convention without any allocation: prefer it to UserFunctionType
+typedef std::function< ResultType (const ArgumentSpan&) > SpanFunctionType;
+
+// Arguments of a lazy function, each one computed when read, and again each time it is read
+class LazyArguments {
+ public:
+  virtual ~LazyArguments() {}
+  virtual size_t size() const = 0;
+  virtual ResultType operator[](size_t index) const = 0;
+};
+
+// Calling convention of functions reading only some of their arguments, such as a choice among them
+typedef std::function< ResultType (const LazyArguments&) > LazyFunctionType;
+
+// Optional columnar version of a function: iArgs holds one column of iCount values per argument
+typedef std::function< void (const double* const* iArgs, size_t iCount, double* oResults) > VectorFunctionType;
+
+// Pure functions always return the same result for the same arguments and have no side
+// effect: calls with constant arguments are made once, when compiling
+enum FunctionPurity { Volatile, Pure };
+
+// Body of a function written as an expression, reading its arguments as _1, _2...
+typedef std::function< std::shared_ptr<const SyntaxTree> () > FunctionBodyType;
+
+// Only one of func, span and lazy is set. Functions with a body are inlined by their callers when possible.
+struct FunctionDefinition
+{
+  UserFunctionType func;
+  SpanFunctionType span;
+  VectorFunctionType vectorized;
+  FunctionPurity purity;
+  FunctionBodyType body;
+  LazyFunctionType lazy;
+
+  // ioScratch is only used to hand the arguments over to a UserFunctionType.
+  // Lazy functions are given arguments already computed.
+  ResultType invoke(const ResultType* iArgs, size_t iCount, std::vector<ResultType>& ioScratch) const;
+};
+
+// Characters [begin, end) of the source of an expression
+struct SourceSpan
+{
+  std::uint32_t begin;
+  std::uint32_t end;
+};
+
+// A named input column of a batch evaluation
+struct Column
+{
+  std::string name;
+  const double* values;
+};
 }  // namespace CompactExpressionParser
 
 #endif /* CEP_INTERFACES_H_ */
@@ -0,0 +1,352 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#include "NativeProgram.h"
+#include "Operators.h"
+
+#include <cstring>
+#include <exception>
+#include <initializer_list>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define CEP_NATIVE_X86_64
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace CompactExpressionParser
+{
+
+namespace
+{
+	// Handed to the generated code, then to the trampolines it calls
+	struct NativeState
+	{
+		const Program* program;
+		const NativeProgram::CallSite* calls;
+		const NativeProgram::ValueCopy* copies;
+		double* boxed;
+		ResultType* values;
+		ResultType* value_locals;
+		std::vector<ResultType>* scratch;
+		std::exception_ptr error;
+	};
+
+	// Exceptions must not unwind through the generated code: they are kept until it returns
+	int native_call(NativeState* ioState, std::uint32_t iSite)
+	{
+		try
+		{
+			const NativeProgram::CallSite& call = ioState->calls[iSite];
+			ResultType* args = ioState->values + call.first;
+			const double* boxed = ioState->boxed + call.first;
+			for(std::uint32_t arg = 0; arg < call.arity; ++arg) if(call.boxed[arg]) args[arg] = boxed[arg];
+			*args = ioState->program->functions()[call.function].definition.invoke(args, call.arity, *ioState->scratch);
+			ioState->boxed[call.first] = *args;
+			return 0;
+		}
+		catch(...)
+		{
+			ioState->error = std::current_exception();
+			return 1;
+		}
+	}
+
+	int native_copy(NativeState* ioState, std::uint32_t iCopy)
+	{
+		try
+		{
+			const NativeProgram::ValueCopy& copy = ioState->copies[iCopy];
+			if(copy.store) ioState->value_locals[copy.to] = ioState->values[copy.from];
+			else ioState->values[copy.to] = ioState->value_locals[copy.from];
+			return 0;
+		}
+		catch(...)
+		{
+			ioState->error = std::current_exception();
+			return 1;
+		}
+	}
+
+	double native_power(double iLeft, double iRight) { return power::apply(iLeft, iRight); }
+}
+
+#ifdef CEP_NATIVE_X86_64
+
+// Translates the instructions one by one, the number stack being mapped to xmm registers
+struct NativeAssembler
+{
+	enum Register { rax = 0, rdx = 2, rbx = 3, rsi = 6, rdi = 7, r12 = 12, r13 = 13 };
+	static const unsigned Registers = 16;
+
+	NativeAssembler(NativeProgram& ioNative) : m_native(ioNative), m_numbers(0)
+	{
+		const Program& program = *ioNative.m_program;
+		m_value_doubles = program.number_locals();
+		m_boxed = m_value_doubles + program.value_locals();
+		m_spill = m_boxed + program.value_stack_size();
+		ioNative.m_doubles = m_spill + Registers;
+	}
+
+	bool assemble()
+	{
+		const Program& program = *m_native.m_program;
+		// Prologue: three pushes keep the stack aligned on 16 bytes for the calls
+		bytes({ 0x53, 0x41, 0x54, 0x41, 0x55 });            // push rbx; push r12; push r13
+		bytes({ 0x48, 0x89, 0xFB, 0x49, 0x89, 0xF4, 0x49, 0x89, 0xD5 }); // mov rbx, rdi; mov r12, rsi; mov r13, rdx
+
+		for(const Instruction& instruction : program.code())
+		{
+			switch(instruction.code)
+			{
+				case Instruction::PushNumber:
+				{
+					if(!push()) return false;
+					std::uint64_t bits;
+					std::memcpy(&bits, &program.numbers()[instruction.operand], sizeof(bits));
+					bytes({ 0x48, 0xB8 }); qword(bits);                // mov rax, imm64
+					byte(0x66); rex(true, top(), rax); bytes({ 0x0F, 0x6E }); byte(0xC0 | ((top() & 7) << 3)); // movq xmm, rax
+					break;
+				}
+				case Instruction::LoadVariable:
+					if(!push()) return false;
+					sse_memory(0xF2, 0x10, top(), r12, 8 * instruction.operand);
+					break;
+				case Instruction::Add: arithmetic(0x58); break;
+				case Instruction::Sub: arithmetic(0x5C); break;
+				case Instruction::Mult: arithmetic(0x59); break;
+				case Instruction::Divide: arithmetic(0x5E); break;
+				case Instruction::Power:
+				{
+					spill(m_numbers);
+					sse_memory(0xF2, 0x10, 0, r13, slot(m_spill + m_numbers - 2));
+					sse_memory(0xF2, 0x10, 1, r13, slot(m_spill + m_numbers - 1));
+					call(reinterpret_cast<const void*>(&native_power), false, 0);
+					--m_numbers;
+					if(top() != 0) sse_registers(0x66, 0x28, top(), 0);  // movapd
+					reload(m_numbers - 1);
+					break;
+				}
+				case Instruction::StoreNumber: sse_memory(0xF2, 0x11, top(), r13, slot(instruction.operand)); break;
+				case Instruction::LoadNumber:
+					if(!push()) return false;
+					sse_memory(0xF2, 0x10, top(), r13, slot(instruction.operand));
+					break;
+				case Instruction::Box:
+					sse_memory(0xF2, 0x11, top(), r13, slot(m_boxed + m_values.size()));
+					m_values.push_back(true);
+					--m_numbers;
+					break;
+				case Instruction::Unbox:
+					if(!push()) return false;
+					sse_memory(0xF2, 0x10, top(), r13, slot(m_boxed + m_values.size() - 1));
+					m_values.pop_back();
+					break;
+				case Instruction::Call:
+				{
+					NativeProgram::CallSite site;
+					site.function = instruction.operand;
+					site.arity = instruction.arity;
+					site.first = static_cast<std::uint32_t>(m_values.size() - instruction.arity);
+					site.boxed.assign(m_values.begin() + site.first, m_values.end());
+					m_native.m_calls.push_back(site);
+					spill(m_numbers);
+					call(reinterpret_cast<const void*>(&native_call), true, static_cast<std::uint32_t>(m_native.m_calls.size() - 1));
+					reload(m_numbers);
+					m_values.resize(site.first);
+					m_values.push_back(false);
+					break;
+				}
+				case Instruction::StoreValue:
+				{
+					if(m_value_locals.size() <= instruction.operand) m_value_locals.resize(instruction.operand + 1);
+					m_value_locals[instruction.operand] = m_values.back();
+					copy_double(slot(m_boxed + m_values.size() - 1), slot(m_value_doubles + instruction.operand));
+					if(!m_values.back()) copy_value(static_cast<std::uint32_t>(m_values.size() - 1), instruction.operand, true);
+					break;
+				}
+				case Instruction::LoadValue:
+				{
+					bool boxed = m_value_locals[instruction.operand];
+					copy_double(slot(m_value_doubles + instruction.operand), slot(m_boxed + m_values.size()));
+					if(!boxed) copy_value(instruction.operand, static_cast<std::uint32_t>(m_values.size()), false);
+					m_values.push_back(boxed);
+					break;
+				}
+				default: return false;  // Strings, function arguments, comparisons and jumps are left to the interpreter
+			}
+		}
+
+		// The boxed result is converted to a double when the call returning it is made
+		if(program.boxed_result()) sse_memory(0xF2, 0x10, 0, r13, slot(m_boxed));
+		for(size_t jump : m_exits) patch(jump, m_code.size());
+		bytes({ 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3 });      // pop r13; pop r12; pop rbx; ret
+		return true;
+	}
+
+	bool push()
+	{
+		if(m_numbers == Registers) return false;
+		++m_numbers;
+		return true;
+	}
+	unsigned top() const { return m_numbers - 1; }
+	static std::int32_t slot(size_t iIndex) { return static_cast<std::int32_t>(8 * iIndex); }
+
+	void arithmetic(std::uint8_t iOp)
+	{
+		sse_registers(0xF2, iOp, m_numbers - 2, m_numbers - 1);
+		--m_numbers;
+	}
+
+	// Every xmm register is lost across a call
+	void spill(unsigned iCount) { for(unsigned i = 0; i < iCount; ++i) sse_memory(0xF2, 0x11, i, r13, slot(m_spill + i)); }
+	void reload(unsigned iCount) { for(unsigned i = 0; i < iCount; ++i) sse_memory(0xF2, 0x10, i, r13, slot(m_spill + i)); }
+
+	// Trampolines take the state and an index, and return non zero when an exception was caught
+	void call(const void* iFunction, bool iTrampoline, std::uint32_t iIndex)
+	{
+		if(iTrampoline)
+		{
+			bytes({ 0x48, 0x89, 0xDF });                   // mov rdi, rbx
+			byte(0xBE); dword(iIndex);                     // mov esi, imm32
+		}
+		bytes({ 0x48, 0xB8 }); qword(reinterpret_cast<std::uintptr_t>(iFunction)); // mov rax, imm64
+		bytes({ 0xFF, 0xD0 });                             // call rax
+		if(!iTrampoline) return;
+		bytes({ 0x85, 0xC0, 0x0F, 0x85 });                 // test eax, eax; jnz exit
+		m_exits.push_back(m_code.size());
+		dword(0);
+	}
+
+	void copy_value(std::uint32_t iFrom, std::uint32_t iTo, bool iStore)
+	{
+		NativeProgram::ValueCopy copy = { iFrom, iTo, iStore };
+		m_native.m_copies.push_back(copy);
+		spill(m_numbers);
+		call(reinterpret_cast<const void*>(&native_copy), true, static_cast<std::uint32_t>(m_native.m_copies.size() - 1));
+		reload(m_numbers);
+	}
+
+	void copy_double(std::int32_t iFrom, std::int32_t iTo)
+	{
+		rex(true, rax, r13); byte(0x8B); memory(rax, r13, iFrom);  // mov rax, [r13 + from]
+		rex(true, rax, r13); byte(0x89); memory(rax, r13, iTo);    // mov [r13 + to], rax
+	}
+
+	void sse_memory(std::uint8_t iPrefix, std::uint8_t iOp, unsigned iXmm, unsigned iBase, std::int32_t iDisplacement)
+	{
+		byte(iPrefix); rex(false, iXmm, iBase); byte(0x0F); byte(iOp);
+		memory(iXmm, iBase, iDisplacement);
+	}
+
+	void sse_registers(std::uint8_t iPrefix, std::uint8_t iOp, unsigned iDestination, unsigned iSource)
+	{
+		byte(iPrefix); rex(false, iDestination, iSource); byte(0x0F); byte(iOp);
+		byte(0xC0 | ((iDestination & 7) << 3) | (iSource & 7));
+	}
+
+	void rex(bool iWide, unsigned iReg, unsigned iBase)
+	{
+		std::uint8_t prefix = 0x40 | (iWide ? 8 : 0) | ((iReg >> 3) << 2) | (iBase >> 3);
+		if(prefix != 0x40) byte(prefix);
+	}
+
+	// [base + disp32], r12 needing a SIB byte
+	void memory(unsigned iReg, unsigned iBase, std::int32_t iDisplacement)
+	{
+		byte(0x80 | ((iReg & 7) << 3) | (iBase & 7));
+		if((iBase & 7) == 4) byte(0x24);
+		dword(static_cast<std::uint32_t>(iDisplacement));
+	}
+
+	void patch(size_t iAt, size_t iTarget)
+	{
+		std::uint32_t offset = static_cast<std::uint32_t>(iTarget - (iAt + 4));
+		std::memcpy(&m_code[iAt], &offset, 4);
+	}
+
+	void byte(std::uint8_t iByte) { m_code.push_back(iByte); }
+	void bytes(std::initializer_list<std::uint8_t> iBytes) { m_code.insert(m_code.end(), iBytes); }
+	void dword(std::uint32_t iValue) { for(int i = 0; i < 4; ++i) byte(static_cast<std::uint8_t>(iValue >> (8 * i))); }
+	void qword(std::uint64_t iValue) { for(int i = 0; i < 8; ++i) byte(static_cast<std::uint8_t>(iValue >> (8 * i))); }
+
+	NativeProgram& m_native;
+	std::vector<std::uint8_t> m_code;
+	std::vector<size_t> m_exits;
+	unsigned m_numbers;
+	std::vector<bool> m_values;        // Whether each value stack slot only holds a boxed number
+	std::vector<bool> m_value_locals;
+	// Layout of the double buffer: number locals, value locals, value stack, saved registers
+	size_t m_value_doubles;
+	size_t m_boxed;
+	size_t m_spill;
+};
+
+#endif
+
+NativeProgram::NativeProgram(const std::shared_ptr<const Program>& iProgram) :
+m_program(iProgram),
+m_doubles(0),
+m_code(nullptr),
+m_code_size(0),
+m_entry(nullptr)
+{}
+
+NativeProgram::~NativeProgram()
+{
+#ifdef CEP_NATIVE_X86_64
+	if(m_code) munmap(m_code, m_code_size);
+#endif
+}
+
+std::shared_ptr<const NativeProgram> NativeProgram::compile(const std::shared_ptr<const Program>& iProgram)
+{
+#ifdef CEP_NATIVE_X86_64
+	if(!iProgram->outputs().empty()) return std::shared_ptr<const NativeProgram>();
+	std::shared_ptr<NativeProgram> native(new NativeProgram(iProgram));
+	NativeAssembler assembler(*native);
+	if(!assembler.assemble()) return std::shared_ptr<const NativeProgram>();
+
+	// Written then made executable, never both at once
+	size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	size_t size = (assembler.m_code.size() + page - 1) / page * page;
+	void* code = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(code == MAP_FAILED) return std::shared_ptr<const NativeProgram>();
+	std::memcpy(code, assembler.m_code.data(), assembler.m_code.size());
+	if(mprotect(code, size, PROT_READ | PROT_EXEC))
+	{
+		munmap(code, size);
+		return std::shared_ptr<const NativeProgram>();
+	}
+	native->m_code = code;
+	native->m_code_size = size;
+	native->m_entry = reinterpret_cast<double (*)(void*, const double*, double*)>(code);
+	return native;
+#else
+	return std::shared_ptr<const NativeProgram>();
+#endif
+}
+
+double NativeProgram::eval(EvaluationContext& ioContext, const double* iFrame) const
+{
+	const Program& program = *m_program;
+	if(ioContext.m_native_doubles.size() < m_doubles) ioContext.m_native_doubles.resize(m_doubles);
+	if(ioContext.m_values.size() < program.value_stack_size()) ioContext.m_values.resize(program.value_stack_size());
+	if(ioContext.m_value_locals.size() < program.value_locals()) ioContext.m_value_locals.resize(program.value_locals());
+
+	double* doubles = ioContext.m_native_doubles.data();
+	NativeState state = { &program, m_calls.data(), m_copies.data(),
+		doubles + program.number_locals() + program.value_locals(),
+		ioContext.m_values.data(), ioContext.m_value_locals.data(), &ioContext.m_scalar_arguments, std::exception_ptr() };
+	double result = m_entry(&state, iFrame, doubles);
+	if(state.error) std::rethrow_exception(state.error);
+	return result;
+}
+
+}
@@ -0,0 +1,77 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#ifndef CEP_NATIVEPROGRAM_H_
+#define CEP_NATIVEPROGRAM_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Program.h"
+
+namespace CompactExpressionParser
+{
+
+/** Program translated to x86-64 machine code.
+ *
+ * The number stack lives in the SSE registers, xmm0 to xmm15, arithmetic being
+ * done in place. Locals, boxed values and registers saved across calls live in
+ * a buffer of the EvaluationContext. Registered functions and pow are called
+ * through small trampolines, which also catch the exceptions of user functions
+ * and rethrow them once out of the generated code.
+ *
+ * Like programs, native programs never change once built and can be shared
+ * between threads. */
+class NativeProgram
+{
+public:
+	// Returns nothing when the program cannot be translated: string literals, function arguments, comparisons
+	// and conditions, more than 16 numbers on the stack, several outputs, or any other platform than x86-64 System V
+	static std::shared_ptr<const NativeProgram> compile(const std::shared_ptr<const Program>& iProgram);
+	~NativeProgram();
+
+	double eval(EvaluationContext& ioContext, const double* iFrame) const;
+
+	const std::shared_ptr<const Program>& program() const { return m_program; }
+	size_t code_size() const { return m_code_size; }
+
+	struct CallSite
+	{
+		std::uint32_t function;
+		std::uint32_t arity;
+		std::uint32_t first;       // Value stack index of the first argument
+		std::vector<bool> boxed;   // Arguments boxed from a number, only held by the double buffer
+	};
+
+	struct ValueCopy
+	{
+		std::uint32_t from;
+		std::uint32_t to;
+		bool store;                // Value stack to local when set, local to value stack otherwise
+	};
+
+private:
+	NativeProgram(const std::shared_ptr<const Program>& iProgram);
+	NativeProgram(const NativeProgram&);
+	NativeProgram& operator= (const NativeProgram&);
+
+	std::shared_ptr<const Program> m_program;
+	std::vector<CallSite> m_calls;
+	std::vector<ValueCopy> m_copies;
+	size_t m_doubles;
+	void* m_code;
+	size_t m_code_size;
+	double (*m_entry)(void* ioState, const double* iFrame, double* ioDoubles);
+
+	friend struct NativeAssembler;
+};
+
+}
+
+#endif /* CEP_NATIVEPROGRAM_H_ */
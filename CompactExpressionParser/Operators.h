@@ -0,0 +1,38 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#ifndef CEP_OPERATORS_H_
+#define CEP_OPERATORS_H_
+
+#include <cmath>
+
+namespace CompactExpressionParser
+{
+
+// Operator tags of the syntax tree. Every evaluation backend goes through apply()
+// so that all of them compute exactly the same thing.
+struct add { static double apply(double iLeft, double iRight) { return iLeft + iRight; } };
+struct sub { static double apply(double iLeft, double iRight) { return iLeft - iRight; } };
+struct mult { static double apply(double iLeft, double iRight) { return iLeft * iRight; } };
+struct divide { static double apply(double iLeft, double iRight) { return iLeft / iRight; } };
+struct power { static double apply(double iLeft, double iRight) { return std::pow(iLeft, iRight); } };
+
+// Comparisons give 1 or 0, NaN comparing as the hardware does: only != holds
+struct less { static double apply(double iLeft, double iRight) { return iLeft < iRight ? 1. : 0.; } };
+struct less_equal { static double apply(double iLeft, double iRight) { return iLeft <= iRight ? 1. : 0.; } };
+struct greater { static double apply(double iLeft, double iRight) { return iLeft > iRight ? 1. : 0.; } };
+struct greater_equal { static double apply(double iLeft, double iRight) { return iLeft >= iRight ? 1. : 0.; } };
+struct equal { static double apply(double iLeft, double iRight) { return iLeft == iRight ? 1. : 0.; } };
+struct not_equal { static double apply(double iLeft, double iRight) { return iLeft != iRight ? 1. : 0.; } };
+
+// Conditions hold for any number but 0, NaN included
+inline bool truth(double iValue) { return iValue != 0.; }
+
+}
+
+#endif /* CEP_OPERATORS_H_ */
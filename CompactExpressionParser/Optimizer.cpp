@@ -0,0 +1,418 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#include "Optimizer.h"
+#include "Operators.h"
+#include "SyntaxTree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace CompactExpressionParser
+{
+
+/** Copies a tree, replacing the calls to pure functions written as expressions with their body.
+ *
+ * The arguments of an inlined body are subtrees of the tree it is called from, read
+ * through a chain of scopes: bodies inlined in bodies copy the arguments of the
+ * outer call wherever theirs read them. */
+class FunctionInliner
+{
+public:
+	// Nodes past which nothing more is inlined, bodies reading arguments several times growing the tree
+	static const size_t Limit = 1 << 16;
+
+	explicit FunctionInliner(const SyntaxTree& iTree) : m_in(iTree), m_site()
+	{
+		if(iTree.has_spans()) m_out.keep_spans();
+	}
+
+	bool needed() const
+	{
+		for(const SyntaxFunction& function : m_in.functions())
+			if(inlined(function.definition)) return true;
+		return false;
+	}
+
+	SyntaxTree inline_calls()
+	{
+		copy(m_in, m_in.root(), nullptr);
+		return m_out;
+	}
+
+private:
+	struct Scope
+	{
+		const SyntaxTree* tree;
+		std::vector<std::uint32_t> arguments;  // Roots in tree
+		const Scope* parent;                   // Scope of the arguments themselves
+	};
+
+	void copy(const SyntaxTree& iTree, std::uint32_t iIndex, const Scope* iScope)
+	{
+		const SyntaxNode& node = iTree.node(iIndex);
+		switch(node.kind)
+		{
+			case SyntaxNode::Number: m_out.push_number(iTree.number(iIndex)); break;
+			case SyntaxNode::String: m_out.push_string(iTree.string(iIndex)); break;
+			case SyntaxNode::Variable: m_out.push_variable(iTree.variable(iIndex).name, iTree.variable(iIndex).slot); break;
+			case SyntaxNode::Argument:
+				if(iScope) copy(*iScope->tree, iScope->arguments[node.operand], iScope->parent);
+				else m_out.push_argument(node.operand);
+				break;
+			case SyntaxNode::Call: copy_call(iTree, iIndex, iScope); break;
+			case SyntaxNode::Select:
+			{
+				std::vector<std::uint32_t> operands;
+				iTree.arguments(iIndex, operands);
+				for(std::uint32_t operand : operands) copy(iTree, operand, iScope);
+				m_out.push_select();
+				break;
+			}
+			default:
+				copy(iTree, iTree.left(iIndex), iScope);
+				copy(iTree, iTree.right(iIndex), iScope);
+				m_out.push_operation(static_cast<SyntaxNode::Kind>(node.kind));
+		}
+		// Nodes of the bodies come from other sources, they stand for the call they are inlined in
+		if(m_out.has_spans() && !(node.kind == SyntaxNode::Argument && iScope)) m_out.set_span(m_out.root(), &iTree == &m_in ? m_in.span(iIndex) : m_site);
+	}
+
+	void copy_call(const SyntaxTree& iTree, std::uint32_t iIndex, const Scope* iScope)
+	{
+		const SyntaxFunction& function = iTree.function(iIndex);
+		Scope scope = { &iTree, std::vector<std::uint32_t>(), iScope };
+		iTree.arguments(iIndex, scope.arguments);
+		std::shared_ptr<const SyntaxTree> body;
+		if(inlined(function.definition) && m_out.size() < Limit && !inlining(function.name)) body = function.definition.body();
+		if(body && inlinable(*body, scope))
+		{
+			SourceSpan site = m_site;
+			if(&iTree == &m_in && m_in.has_spans()) m_site = m_in.span(iIndex);
+			m_inlined.push_back(function.name);
+			copy(*body, body->root(), &scope);
+			m_inlined.pop_back();
+			m_site = site;
+			return;
+		}
+		for(std::uint32_t arg : scope.arguments) copy(iTree, arg, iScope);
+		m_out.push_call(function.name, function.definition, scope.arguments.size());
+	}
+
+	// Bodies of volatile functions may be compiled again, calls to them read the current one
+	static bool inlined(const FunctionDefinition& iDefinition) { return iDefinition.body && iDefinition.purity == Pure; }
+
+	// Recursive calls are kept
+	bool inlining(const std::string& iName) const { return std::find(m_inlined.begin(), m_inlined.end(), iName) != m_inlined.end(); }
+
+	// Arguments calling volatile functions must be read once by the body, outside of any branch
+	// since calls compute them anyway, and be the only volatile calls
+	bool inlinable(const SyntaxTree& iBody, const Scope& iScope)
+	{
+		std::vector<size_t> reads(iScope.arguments.size(), 0);
+		std::vector<bool> guarded(iScope.arguments.size(), false);
+		std::vector<std::uint32_t> guards;
+		iBody.guards(guards);
+		for(std::uint32_t index = 0; index < iBody.size(); ++index)
+		{
+			const SyntaxNode& node = iBody.node(index);
+			if(node.kind != SyntaxNode::Argument) continue;
+			if(node.operand >= reads.size()) return false;
+			++reads[node.operand];
+			if(guards[index] != SyntaxTree::Unguarded) guarded[node.operand] = true;
+		}
+		size_t volatiles = 0;
+		for(size_t arg = 0; arg < reads.size(); ++arg)
+		{
+			if(!calls_volatile(*iScope.tree, iScope.arguments[arg], iScope.parent)) continue;
+			if(reads[arg] != 1 || guarded[arg] || ++volatiles > 1) return false;
+		}
+		return 0 == volatiles || !calls_volatile(iBody, iBody.root(), nullptr);
+	}
+
+	// Looks into the arguments read too
+	static bool calls_volatile(const SyntaxTree& iTree, std::uint32_t iIndex, const Scope* iScope)
+	{
+		for(std::uint32_t index = iTree.first(iIndex); index <= iIndex; ++index)
+		{
+			const SyntaxNode& node = iTree.node(index);
+			if(node.kind == SyntaxNode::Argument && iScope && calls_volatile(*iScope->tree, iScope->arguments[node.operand], iScope->parent)) return true;
+			if(node.kind == SyntaxNode::Call && iTree.function(index).definition.purity != Pure) return true;
+		}
+		return false;
+	}
+
+	const SyntaxTree& m_in;
+	SyntaxTree m_out;
+	std::vector<std::string> m_inlined;  // Bodies being copied
+	SourceSpan m_site;                   // Call of the tree being inlined
+};
+
+/** Copies a tree in postfix order, folding each node as soon as its operands are copied.
+ *
+ * Operands are the subtrees on top of the output, their purity being kept on a stack
+ * alongside: folding truncates the output and pushes a constant, and dropping an operand
+ * removes its nodes, sizes being relative to each node so that nothing needs fixing. */
+class TreeFolder
+{
+public:
+	TreeFolder(const SyntaxTree& iTree) : m_in(iTree)
+	{
+		m_out.m_numbers = iTree.m_numbers;
+		m_out.m_strings = iTree.m_strings;
+		m_out.m_variables = iTree.m_variables;
+		m_out.m_functions = iTree.m_functions;
+		m_out.m_spanned = iTree.m_spanned;
+		m_out.m_nodes.reserve(iTree.size());
+	}
+
+	SyntaxTree fold();
+
+private:
+	bool is_constant(std::uint32_t iIndex) const
+	{
+		return m_out.node(iIndex).kind == SyntaxNode::Number || m_out.node(iIndex).kind == SyntaxNode::String;
+	}
+
+	ResultType constant(std::uint32_t iIndex) const
+	{
+		if(m_out.node(iIndex).kind == SyntaxNode::Number) return m_out.number(iIndex);
+		return m_out.string(iIndex);
+	}
+
+	// Compares signs as well, so that 0 and -0 are told apart
+	bool is_number(std::uint32_t iIndex, double iValue) const
+	{
+		if(m_out.node(iIndex).kind != SyntaxNode::Number) return false;
+		double number = m_out.number(iIndex);
+		return number == iValue && std::signbit(number) == std::signbit(iValue);
+	}
+
+	// Results of function calls and arguments may be strings, which become 0 in arithmetic
+	bool is_numeric(std::uint32_t iIndex) const { return !m_out.is_boxed(iIndex); }
+
+	// Drops the nodes from iFirst on and pushes a constant instead
+	void replace(std::uint32_t iFirst, double iValue)
+	{
+		m_out.truncate(iFirst);
+		m_out.push_number(iValue);
+	}
+
+	enum Simplification { None, KeepLeft, KeepRight, One };
+
+	// x + -0, x - 0, x*1, x/1 and x^1 are x for every double. x + 0 is not: -0 + 0 is 0.
+	// Comparisons are only computed when both operands are constant
+	template<typename T> Simplification simplify(std::uint32_t, std::uint32_t, bool, bool) const { return None; }
+
+	template<typename T> void fold_operation(SyntaxNode::Kind iKind)
+	{
+		std::uint32_t right = m_out.root();
+		std::uint32_t left = m_out.first(right) - 1;
+		bool right_pure = m_pure.back();
+		m_pure.pop_back();
+		bool left_pure = m_pure.back();
+		m_pure.back() = left_pure && right_pure;
+
+		if(is_constant(left) && is_constant(right))
+		{
+			replace(m_out.first(left), T::apply(constant(left), constant(right)));
+			return;
+		}
+		switch(simplify<T>(left, right, left_pure, right_pure))
+		{
+			case None: m_out.push_operation(iKind); break;
+			case KeepLeft: m_out.truncate(m_out.first(right)); break;
+			case KeepRight: m_out.erase(m_out.first(left), m_out.first(right)); break;
+			case One: replace(m_out.first(left), 1.); break;
+		}
+	}
+
+	// A constant left operand decides whether the right one is needed at all
+	void fold_logical(SyntaxNode::Kind iKind)
+	{
+		std::uint32_t right = m_out.root();
+		std::uint32_t left = m_out.first(right) - 1;
+		bool right_pure = m_pure.back();
+		m_pure.pop_back();
+		bool left_pure = m_pure.back();
+		m_pure.back() = left_pure && right_pure;
+
+		if(is_constant(left))
+		{
+			bool decided = truth(constant(left)) == (iKind == SyntaxNode::Or);
+			if(decided)
+			{
+				m_pure.back() = true;
+				replace(m_out.first(left), iKind == SyntaxNode::Or ? 1. : 0.);
+				return;
+			}
+			if(is_constant(right))
+			{
+				replace(m_out.first(left), truth(constant(right)) ? 1. : 0.);
+				return;
+			}
+		}
+		m_out.push_operation(iKind);
+	}
+
+	// Only the branch taken is kept after a constant condition
+	void fold_select()
+	{
+		std::uint32_t otherwise = m_out.root();
+		std::uint32_t then = m_out.first(otherwise) - 1;
+		std::uint32_t condition = m_out.first(then) - 1;
+		bool otherwise_pure = m_pure.back();
+		m_pure.pop_back();
+		bool then_pure = m_pure.back();
+		m_pure.pop_back();
+		bool condition_pure = m_pure.back();
+
+		if(is_constant(condition))
+		{
+			if(truth(constant(condition)))
+			{
+				m_out.truncate(m_out.first(otherwise));
+				m_out.erase(m_out.first(condition), m_out.first(then));
+				m_pure.back() = then_pure;
+			}
+			else
+			{
+				m_out.erase(m_out.first(condition), m_out.first(otherwise));
+				m_pure.back() = otherwise_pure;
+			}
+			return;
+		}
+		m_pure.back() = condition_pure && then_pure && otherwise_pure;
+		m_out.push_select();
+	}
+
+	void fold_call(const SyntaxNode& iNode)
+	{
+		std::vector<std::uint32_t> roots(iNode.arity);
+		std::uint32_t first = static_cast<std::uint32_t>(m_out.size());
+		for(size_t arg = roots.size(); arg > 0; --arg)
+		{
+			roots[arg - 1] = first - 1;
+			first = m_out.first(first - 1);
+		}
+
+		const SyntaxFunction& function = m_in.m_functions[iNode.operand];
+		bool pure = function.definition.purity == Pure;
+		bool arguments_constant = true;
+		for(std::uint32_t root : roots)
+		{
+			pure = m_pure.back() && pure;
+			m_pure.pop_back();
+			arguments_constant = arguments_constant && is_constant(root);
+		}
+		m_pure.push_back(pure);
+
+		if(function.definition.purity == Pure && arguments_constant)
+		{
+			std::vector<ResultType> args, scratch;
+			for(std::uint32_t root : roots) args.push_back(constant(root));
+			try
+			{
+				ResultType result = function.definition.invoke(args.data(), args.size(), scratch);
+				m_out.truncate(first);
+				if(result.IsNumber()) m_out.push_number(result);
+				else m_out.push_string(result);
+				return;
+			}
+			catch(...)
+			{
+				// Left to fail at evaluation time, as it would without folding
+			}
+		}
+		m_out.push(SyntaxNode::Call, iNode.operand, static_cast<std::uint32_t>(m_out.size()) - first + 1, iNode.arity);
+	}
+
+	const SyntaxTree& m_in;
+	SyntaxTree m_out;
+	std::vector<bool> m_pure;
+};
+
+template<> TreeFolder::Simplification TreeFolder::simplify<add>(std::uint32_t iLeft, std::uint32_t iRight, bool, bool) const
+{
+	if(is_number(iRight, -0.) && is_numeric(iLeft)) return KeepLeft;
+	if(is_number(iLeft, -0.) && is_numeric(iRight)) return KeepRight;
+	return None;
+}
+
+template<> TreeFolder::Simplification TreeFolder::simplify<sub>(std::uint32_t iLeft, std::uint32_t iRight, bool, bool) const
+{
+	if(is_number(iRight, 0.) && is_numeric(iLeft)) return KeepLeft;
+	return None;
+}
+
+template<> TreeFolder::Simplification TreeFolder::simplify<mult>(std::uint32_t iLeft, std::uint32_t iRight, bool, bool) const
+{
+	if(is_number(iRight, 1.) && is_numeric(iLeft)) return KeepLeft;
+	if(is_number(iLeft, 1.) && is_numeric(iRight)) return KeepRight;
+	return None;
+}
+
+template<> TreeFolder::Simplification TreeFolder::simplify<divide>(std::uint32_t iLeft, std::uint32_t iRight, bool, bool) const
+{
+	if(is_number(iRight, 1.) && is_numeric(iLeft)) return KeepLeft;
+	return None;
+}
+
+// pow(x, 0) and pow(1, y) are 1 even for NaN, the other operand is dropped if it has no side effect
+template<> TreeFolder::Simplification TreeFolder::simplify<power>(std::uint32_t iLeft, std::uint32_t iRight, bool iLeftPure, bool iRightPure) const
+{
+	if(is_number(iRight, 1.) && is_numeric(iLeft)) return KeepLeft;
+	if((is_number(iRight, 0.) || is_number(iRight, -0.)) && iLeftPure) return One;
+	if(is_number(iLeft, 1.) && iRightPure) return One;
+	return None;
+}
+
+SyntaxTree TreeFolder::fold()
+{
+	for(std::uint32_t index = 0; index < m_in.size(); ++index)
+	{
+		const SyntaxNode& node = m_in.node(index);
+		switch(node.kind)
+		{
+			case SyntaxNode::Add: fold_operation<add>(SyntaxNode::Add); break;
+			case SyntaxNode::Sub: fold_operation<sub>(SyntaxNode::Sub); break;
+			case SyntaxNode::Mult: fold_operation<mult>(SyntaxNode::Mult); break;
+			case SyntaxNode::Divide: fold_operation<divide>(SyntaxNode::Divide); break;
+			case SyntaxNode::Power: fold_operation<power>(SyntaxNode::Power); break;
+			case SyntaxNode::Less: fold_operation<less>(SyntaxNode::Less); break;
+			case SyntaxNode::LessEqual: fold_operation<less_equal>(SyntaxNode::LessEqual); break;
+			case SyntaxNode::Greater: fold_operation<greater>(SyntaxNode::Greater); break;
+			case SyntaxNode::GreaterEqual: fold_operation<greater_equal>(SyntaxNode::GreaterEqual); break;
+			case SyntaxNode::Equal: fold_operation<equal>(SyntaxNode::Equal); break;
+			case SyntaxNode::NotEqual: fold_operation<not_equal>(SyntaxNode::NotEqual); break;
+			case SyntaxNode::And: fold_logical(SyntaxNode::And); break;
+			case SyntaxNode::Or: fold_logical(SyntaxNode::Or); break;
+			case SyntaxNode::Select: fold_select(); break;
+			case SyntaxNode::Call: fold_call(node); break;
+			default:
+				m_out.m_nodes.push_back(node);
+				if(m_out.m_spanned) m_out.m_spans.push_back(SourceSpan());
+				m_pure.push_back(true);
+		}
+		// Whatever it was folded to, the result stands for the whole node
+		if(m_out.m_spanned) m_out.m_spans.back() = m_in.m_spans[index];
+	}
+	return m_out;
+}
+
+void optimize(SyntaxTree& ioTree)
+{
+	FunctionInliner inliner(ioTree);
+	if(inliner.needed()) ioTree = inliner.inline_calls();
+	ioTree = TreeFolder(ioTree).fold();
+}
+
+}
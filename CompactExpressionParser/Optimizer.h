@@ -0,0 +1,33 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#ifndef CEP_OPTIMIZER_H_
+#define CEP_OPTIMIZER_H_
+
+namespace CompactExpressionParser
+{
+
+class SyntaxTree;
+
+/** Simplifies a syntax tree without changing what it evaluates to.
+ *
+ * Constant operations are computed, calls to pure functions with constant
+ * arguments are made, and identities which hold for every double (x*1, x/1,
+ * x-0, x^1...) are removed. Subtrees calling volatile functions are never
+ * dropped, except branches a constant condition never takes.
+ *
+ * Calls to functions written as expressions are first replaced with their body,
+ * arguments being copied where the body reads them. Recursive calls are kept,
+ * as well as calls where a volatile function would be called another number
+ * of times or in another order, or only under a condition, or where the body
+ * reads a missing argument. */
+void optimize(SyntaxTree& ioTree);
+
+}
+
+#endif /* CEP_OPTIMIZER_H_ */
@@ -0,0 +1,305 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#include "Parser.h"
+#include "SyntaxTree.h"
+#include "VariableSet.h"
+
+#include <atomic>
+#include <cctype>
+#include <cstddef>
+#include <cstring>
+#include <utility>
+#include <boost/spirit/include/qi.hpp>
+
+namespace CompactExpressionParser
+{
+namespace qi = boost::spirit::qi;
+
+namespace
+{
+	typedef std::string::const_iterator Iterator;
+
+	std::atomic<size_t> last_functions_id(0);
+
+	// Lexemes are kept as Spirit rules so literals are read exactly as the former grammar did
+	struct StringLexer
+	{
+		StringLexer()
+		{
+			unesc_char.add("\\a", '\a')("\\b", '\b')("\\f", '\f')("\\n", '\n')
+				("\\r", '\r')("\\t", '\t')("\\v", '\v')
+				("\\\\", '\\')("\\\'", '\'')("\\\"", '\"')
+				(" ",' ')("/",'/')
+				;
+			string_value = '"' >> *(unesc_char | qi::alnum | "\\x" >> qi::hex) >> '"';
+		}
+
+		qi::rule<Iterator, std::string()> string_value;
+		qi::symbols<char const, char const> unesc_char;
+	};
+
+	class ParseState
+	{
+	public:
+		ParseState(const std::string& iExpression, const std::map<std::string, FunctionDefinition>& iFunctions, VariableSet& ioVariables,
+			bool iArguments, SyntaxTree& oTree)
+		: m_begin(iExpression.begin()), m_iter(iExpression.begin()), m_end(iExpression.end()), m_functions(iFunctions), m_variables(ioVariables), m_arguments(iArguments), m_tree(oTree)
+		{}
+
+		bool parse()
+		{
+			if(!parseConditional()) return false;
+			skipSpaces();
+			if(m_iter != m_end) return false;
+			// Only expressions parsed in full declare their variables, in the order of the slots given
+			for(const std::string& name : m_undeclared) m_variables.declare(name);
+			return true;
+		}
+
+	private:
+		struct Operator
+		{
+			const char* text;
+			SyntaxNode::Kind kind;
+			unsigned precedence;
+		};
+
+		// Reads the binary operator starting at the current position, without moving past it
+		const Operator* peekOperator()
+		{
+			static const Operator operators[] = {
+				{ "||", SyntaxNode::Or, 1 }, { "&&", SyntaxNode::And, 2 },
+				{ "==", SyntaxNode::Equal, 3 }, { "!=", SyntaxNode::NotEqual, 3 },
+				{ "<=", SyntaxNode::LessEqual, 4 }, { ">=", SyntaxNode::GreaterEqual, 4 },
+				{ "<", SyntaxNode::Less, 4 }, { ">", SyntaxNode::Greater, 4 },
+				{ "+", SyntaxNode::Add, 5 }, { "-", SyntaxNode::Sub, 5 },
+				{ "*", SyntaxNode::Mult, 6 }, { "/", SyntaxNode::Divide, 6 },
+				{ "^", SyntaxNode::Power, 7 } };
+
+			skipSpaces();
+			for(const Operator& op : operators)
+			{
+				Iterator iter = m_iter;
+				const char* text = op.text;
+				while(*text && iter != m_end && *iter == *text) { ++iter; ++text; }
+				if(!*text) return &op;
+			}
+			return nullptr;
+		}
+
+		static bool isIdentifierStart(char iChar) { return std::isalpha(static_cast<unsigned char>(iChar)) || iChar == '_'; }
+		static bool isIdentifierChar(char iChar) { return std::isalnum(static_cast<unsigned char>(iChar)) || iChar == '_'; }
+
+		// Words read as numbers by qi::double_
+		static bool isNumberWord(const std::string& iWord)
+		{
+			std::string word(iWord);
+			for(char& c : word) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+			return word == "nan" || word == "inf" || word == "infinity";
+		}
+
+		void skipSpaces() { while(m_iter != m_end && std::isspace(static_cast<unsigned char>(*m_iter))) ++m_iter; }
+		bool peek(char iChar) { skipSpaces(); return m_iter != m_end && *m_iter == iChar; }
+		bool accept(char iChar) { if(!peek(iChar)) return false; ++m_iter; return true; }
+
+		// "condition ? then : otherwise" binds the loosest, and is right associative
+		bool parseConditional()
+		{
+			if(!parseBinary(1)) return false;
+			if(!accept('?')) return true;
+			if(!parseConditional() || !accept(':') || !parseConditional()) return false;
+			m_tree.push_select();
+			return true;
+		}
+
+		// '^' is right associative, the other operators are left associative
+		bool parseBinary(unsigned iMinPrecedence)
+		{
+			if(!parseOperand()) return false;
+			for(;;)
+			{
+				const Operator* op = peekOperator();
+				if(!op || op->precedence < iMinPrecedence) return true;
+				m_iter += static_cast<std::ptrdiff_t>(std::strlen(op->text));
+				if(!parseBinary(op->kind == SyntaxNode::Power ? op->precedence : op->precedence + 1)) return false;
+				m_tree.push_operation(op->kind);
+			}
+		}
+
+		// Operands span their source text, parentheses included
+		bool parseOperand()
+		{
+			skipSpaces();
+			Iterator begin = m_iter;
+			if(!parsePrimary()) return false;
+			SourceSpan span = { offset(begin), offset(m_iter) };
+			m_tree.set_span(m_tree.root(), span);
+			return true;
+		}
+
+		std::uint32_t offset(Iterator iIter) const { return static_cast<std::uint32_t>(iIter - m_begin); }
+
+		bool parsePrimary()
+		{
+			if(m_iter == m_end) return false;
+
+			if(isIdentifierStart(*m_iter))
+			{
+				Iterator begin = m_iter;
+				while(m_iter != m_end && isIdentifierChar(*m_iter)) ++m_iter;
+				std::string name(begin, m_iter);
+				if(!isNumberWord(name)) return parseIdentifier(name);
+				m_iter = begin;
+			}
+
+			double number;
+			if(qi::parse(m_iter, m_end, qi::double_, number))
+			{
+				m_tree.push_number(number);
+				return true;
+			}
+
+			if(accept('('))
+				return parseConditional() && accept(')');
+
+			if(*m_iter == '"')
+			{
+				std::string text;
+				if(!qi::parse(m_iter, m_end, lexer().string_value, text)) return false;
+				m_tree.push_string(text);
+				return true;
+			}
+
+			return false;
+		}
+
+		// Placeholders _1, _2... of the arguments of a function body
+		static bool isArgument(const std::string& iName, size_t& oIndex)
+		{
+			if(iName.size() < 2 || iName[0] != '_' || iName[1] == '0') return false;
+			oIndex = 0;
+			for(size_t i = 1; i < iName.size(); ++i)
+			{
+				if(!std::isdigit(static_cast<unsigned char>(iName[i]))) return false;
+				oIndex = oIndex * 10 + static_cast<size_t>(iName[i] - '0');
+			}
+			--oIndex;
+			return true;
+		}
+
+		// A registered function name must be followed by its arguments, any other name is a variable
+		bool parseIdentifier(const std::string& iName)
+		{
+			size_t index;
+			if(isArgument(iName, index))
+			{
+				if(!m_arguments || peek('(')) return false;
+				m_tree.push_argument(index);
+				return true;
+			}
+
+			std::map<std::string, FunctionDefinition>::const_iterator func = m_functions.find(iName);
+			if(func == m_functions.end() && iName == "if" && peek('(')) return parseIf();
+			if(!accept('('))
+			{
+				if(func != m_functions.end()) return false;
+				m_tree.push_variable(iName, slot(iName));
+				return true;
+			}
+			if(func == m_functions.end()) return false;
+
+			size_t arity = 0;
+			if(!accept(')'))
+			{
+				do
+				{
+					if(!parseConditional()) return false;
+					++arity;
+				} while(accept(','));
+				if(!accept(')')) return false;
+			}
+
+			// Arities are stored on 16 bits
+			if(arity > 0xFFFF) return false;
+			m_tree.push_call(func->first, func->second, arity);
+			return true;
+		}
+
+		// Unknown variables are given the slots following the declared ones
+		size_t slot(const std::string& iName)
+		{
+			size_t found;
+			if(m_variables.find(iName, found)) return found;
+			std::map<std::string, size_t>::const_iterator pending = m_pending.find(iName);
+			if(pending != m_pending.end()) return pending->second;
+			size_t next = m_variables.size() + m_undeclared.size();
+			m_pending.insert(std::make_pair(iName, next));
+			m_undeclared.push_back(iName);
+			return next;
+		}
+
+		// "if(condition, then, otherwise)", unless a function of that name is registered
+		bool parseIf()
+		{
+			accept('(');
+			if(!parseConditional() || !accept(',') || !parseConditional() || !accept(',') || !parseConditional() || !accept(')')) return false;
+			m_tree.push_select();
+			return true;
+		}
+
+		static const StringLexer& lexer()
+		{
+			static const StringLexer instance;
+			return instance;
+		}
+
+		Iterator m_begin, m_iter, m_end;
+		const std::map<std::string, FunctionDefinition>& m_functions;
+		VariableSet& m_variables;
+		std::map<std::string, size_t> m_pending;  // Slots of m_undeclared
+		std::vector<std::string> m_undeclared;
+		bool m_arguments;
+		SyntaxTree& m_tree;
+	};
+}
+
+ExpParser::ExpParser() : m_functions_id(++last_functions_id) {}
+
+bool ExpParser::parse(const std::string& iExpression, SyntaxTree& oResult, VariableSet& ioVariables, bool iArguments) const
+{
+	bool spanned = oResult.has_spans();
+	oResult = SyntaxTree();
+	if(spanned) oResult.keep_spans();
+	return ParseState(iExpression, m_functions, ioVariables, iArguments, oResult).parse();
+}
+
+bool ExpParser::addFunction(const std::string& iName, const FunctionDefinition& iDefinition)
+{
+	std::string::const_iterator iter = iName.begin(); std::string::const_iterator end = iName.end();
+	bool func_name_is_valid = ( qi::parse(iter,end, (qi::alpha | '_') >> *(qi::alnum | '_')) && iter == end);
+	// Like the former symbols table, the first registration of a name wins
+	if(func_name_is_valid && m_functions.insert(std::make_pair(iName, iDefinition)).second) m_functions_id = ++last_functions_id;
+	return func_name_is_valid;
+}
+
+void ExpParser::setPurity(const std::string& iName, FunctionPurity iPurity)
+{
+	std::map<std::string, FunctionDefinition>::iterator found = m_functions.find(iName);
+	if(found == m_functions.end()) return;
+	found->second.purity = iPurity;
+	m_functions_id = ++last_functions_id;
+}
+
+const FunctionDefinition* ExpParser::findFunction(const std::string& iName) const
+{
+	std::map<std::string, FunctionDefinition>::const_iterator found = m_functions.find(iName);
+	return found == m_functions.end() ? nullptr : &found->second;
+}
+
+}
@@ -0,0 +1,57 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#ifndef CEP_PARSER_H_
+#define CEP_PARSER_H_
+
+#include <map>
+#include <string>
+
+#include "Interfaces.h"
+
+namespace CompactExpressionParser
+{
+
+class SyntaxTree;
+class VariableSet;
+
+/** Precedence climbing parser producing a SyntaxTree.
+ *
+ * Each token is read exactly once and no alternative is ever re-parsed, so
+ * compiling is linear in the length of the input whatever the nesting depth.
+ * Numbers and string literals are still read with Spirit so that lexemes are
+ * accepted exactly as before. Identifiers not followed by an argument list are
+ * variables, resolved to their slot in ioVariables, where the unknown ones are
+ * declared only if the whole input parses. The placeholders _1, _2...
+ * are read as the arguments of a function body, only when iArguments is set.
+ * Source spans are recorded when oResult keeps them.
+ *
+ * From the loosest: "c ? a : b", ||, &&, == and !=, the other comparisons, then
+ * + -, * / and ^. "if(c, a, b)" is the same as "c ? a : b", unless a function
+ * named "if" is registered. */
+class ExpParser
+{
+public:
+	ExpParser();
+	bool parse(const std::string& iExpression, SyntaxTree& oResult, VariableSet& ioVariables, bool iArguments = false) const;
+	bool addFunction(const std::string& iName, const FunctionDefinition& iDefinition);
+	// Registered definition of a function, nothing if the name is unknown
+	const FunctionDefinition* findFunction(const std::string& iName) const;
+	// Identifies the set of registered functions: changes on each registration, never reused
+	size_t functions_id() const { return m_functions_id; }
+	// Changes the purity of a registered function, giving the functions another id
+	void setPurity(const std::string& iName, FunctionPurity iPurity);
+
+private:
+	std::map<std::string, FunctionDefinition> m_functions;
+	size_t m_functions_id;
+};
+
+}
+
+#endif /* CEP_PARSER_H_ */
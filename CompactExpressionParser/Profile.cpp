@@ -0,0 +1,171 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#include "Profile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <map>
+
+namespace CompactExpressionParser
+{
+
+namespace
+{
+	// Average time between two consecutive reads of the clock
+	double clock_cost()
+	{
+		static const double cost = []()
+		{
+			typedef std::chrono::steady_clock clock;
+			const int reads = 10000;
+			clock::time_point start = clock::now(), last = start;
+			for(int read = 0; read < reads; ++read) last = clock::now();
+			return std::chrono::duration<double, std::nano>(last - start).count() / reads;
+		}();
+		return cost;
+	}
+
+	bool is_arithmetic(std::uint16_t iCode)
+	{
+		return (iCode >= Instruction::Add && iCode <= Instruction::Power) || (iCode >= Instruction::Less && iCode <= Instruction::Truth);
+	}
+	bool is_call(std::uint16_t iCode) { return iCode == Instruction::Call || iCode == Instruction::LazyCall; }
+	bool is_move(std::uint16_t iCode) { return !is_arithmetic(iCode) && !is_call(iCode); }
+
+	bool costlier_span(const Profile::SpanCost& iLeft, const Profile::SpanCost& iRight) { return iLeft.total_ns > iRight.total_ns; }
+	bool costlier_function(const Profile::FunctionCost& iLeft, const Profile::FunctionCost& iRight) { return iLeft.ns > iRight.ns; }
+
+	// Source text on a single line, cut when too long
+	std::string excerpt(const std::string& iText)
+	{
+		std::string text = iText.size() > 60 ? iText.substr(0, 57) + "..." : iText;
+		std::replace(text.begin(), text.end(), '\n', ' ');
+		return text;
+	}
+}
+
+Profile::Profile(size_t iPeriod) :
+m_period(std::max<size_t>(iPeriod, 1)),
+m_program(std::make_shared<const Program>()),
+m_evaluations(0),
+m_timed(0),
+m_clock_ns(clock_cost())
+{}
+
+void Profile::reset(const std::shared_ptr<const Program>& iProgram, const std::string& iSource)
+{
+	m_program = iProgram;
+	m_source = iSource;
+	m_times.runs.assign(iProgram->code().size(), 0);
+	m_times.nanoseconds.assign(iProgram->code().size(), 0.);
+	m_evaluations = 0;
+	m_timed = 0;
+}
+
+double Profile::eval(EvaluationContext& ioContext, const double* iFrame)
+{
+	++m_timed;
+	return m_program->eval(ioContext, iFrame, m_times);
+}
+
+double Profile::instruction_ns(size_t iInstruction) const
+{
+	if(!m_timed) return 0.;
+	double ns = m_times.nanoseconds[iInstruction] - m_times.runs[iInstruction] * m_clock_ns;
+	return std::max(ns, 0.) / m_timed;
+}
+
+double Profile::sum_ns(bool (*iKind)(std::uint16_t)) const
+{
+	double ns = 0.;
+	ArrayView<Instruction> code = m_program->code();
+	for(size_t instruction = 0; instruction < code.size(); ++instruction)
+		if(iKind(code[instruction].code)) ns += instruction_ns(instruction);
+	return ns;
+}
+
+double Profile::total_ns() const { return arithmetic_ns() + calls_ns() + moves_ns(); }
+double Profile::arithmetic_ns() const { return sum_ns(is_arithmetic); }
+double Profile::calls_ns() const { return sum_ns(is_call); }
+double Profile::moves_ns() const { return sum_ns(is_move); }
+
+std::vector<Profile::SpanCost> Profile::spans() const
+{
+	std::vector<SpanCost> costs;
+	const std::vector<SourceSpan>& spans = m_program->spans();
+	if(spans.empty() || !m_timed) return costs;
+
+	std::map<std::pair<std::uint32_t, std::uint32_t>, size_t> indices;
+	for(size_t instruction = 0; instruction < spans.size(); ++instruction)
+	{
+		std::pair<std::uint32_t, std::uint32_t> key(spans[instruction].begin, spans[instruction].end);
+		std::map<std::pair<std::uint32_t, std::uint32_t>, size_t>::iterator found = indices.find(key);
+		if(found == indices.end())
+		{
+			SpanCost cost = { spans[instruction], std::string(), 0., 0., 0. };
+			if(key.second <= m_source.size() && key.first < key.second) cost.text = m_source.substr(key.first, key.second - key.first);
+			found = indices.insert(std::make_pair(key, costs.size())).first;
+			costs.push_back(cost);
+		}
+		costs[found->second].runs += static_cast<double>(m_times.runs[instruction]) / m_timed;
+		costs[found->second].self_ns += instruction_ns(instruction);
+	}
+	// Spans of subtrees lie within the span of their parent
+	for(SpanCost& outer : costs)
+		for(const SpanCost& inner : costs)
+			if(inner.span.begin >= outer.span.begin && inner.span.end <= outer.span.end) outer.total_ns += inner.self_ns;
+	std::stable_sort(costs.begin(), costs.end(), costlier_span);
+	return costs;
+}
+
+std::vector<Profile::FunctionCost> Profile::functions() const
+{
+	const std::vector<ProgramFunction>& functions = m_program->functions();
+	std::vector<FunctionCost> costs(functions.size());
+	for(size_t function = 0; function < functions.size(); ++function) costs[function].name = functions[function].name;
+	ArrayView<Instruction> code = m_program->code();
+	for(size_t instruction = 0; instruction < code.size(); ++instruction)
+	{
+		if(!is_call(code[instruction].code) || !m_timed) continue;
+		// The arguments of lazy functions are computed while the function runs, and charged to it
+		std::uint32_t function = code[instruction].operand;
+		if(code[instruction].code == Instruction::LazyCall) function = m_program->lazy_calls()[function].function;
+		FunctionCost& cost = costs[function];
+		cost.calls += static_cast<double>(m_times.runs[instruction]) / m_timed;
+		cost.ns += instruction_ns(instruction);
+	}
+	std::stable_sort(costs.begin(), costs.end(), costlier_function);
+	return costs;
+}
+
+void Profile::report(std::ostream& oOut, size_t iTop) const
+{
+	std::ios::fmtflags flags = oOut.flags();
+	std::streamsize precision = oOut.precision();
+	oOut << std::fixed << std::setprecision(1);
+	oOut << m_evaluations << " evaluations, " << m_timed << " timed, " << total_ns() << " ns each: "
+		<< arithmetic_ns() << " arithmetic, " << calls_ns() << " calls, " << moves_ns() << " moves" << std::endl;
+
+	std::vector<SpanCost> spans = this->spans();
+	if(spans.empty()) oOut << "No source spans: compile the expression once profiling is enabled" << std::endl;
+	else oOut << std::setw(12) << "total(ns)" << std::setw(12) << "self(ns)" << std::setw(8) << "runs" << "  source" << std::endl;
+	for(size_t span = 0; span < spans.size() && span < iTop; ++span)
+		oOut << std::setw(12) << spans[span].total_ns << std::setw(12) << spans[span].self_ns << std::setw(8) << spans[span].runs
+			<< "  " << excerpt(spans[span].text) << std::endl;
+
+	std::vector<FunctionCost> functions = this->functions();
+	if(!functions.empty()) oOut << std::setw(12) << "ns" << std::setw(12) << "calls" << "  function" << std::endl;
+	for(const FunctionCost& function : functions)
+		oOut << std::setw(12) << function.ns << std::setw(12) << function.calls << "  " << function.name << std::endl;
+	oOut.flags(flags);
+	oOut.precision(precision);
+}
+
+}
@@ -0,0 +1,92 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#ifndef CEP_PROFILE_H_
+#define CEP_PROFILE_H_
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Program.h"
+
+namespace CompactExpressionParser
+{
+
+/** Evaluations of a program, all counted and one in every period timed instruction by instruction.
+ *
+ * Timed evaluations run on the virtual machine and read the clock before each
+ * instruction: a period of 1 times them all, a larger one samples them and
+ * only costs a counter to the others. The cost of reading the clock, measured
+ * once, is taken off every instruction.
+ *
+ * Time is charged to the span of source text each instruction comes from, a
+ * subtree found several times to its first occurrence, and calls to the function
+ * called, nested evaluations included. Spans are only known for programs compiled
+ * once profiling was enabled. */
+class Profile
+{
+public:
+	struct SpanCost
+	{
+		SourceSpan span;
+		std::string text;
+		double runs;      // Instructions of the span itself, per timed evaluation
+		double self_ns;   // Per timed evaluation
+		double total_ns;  // Spans inside this one included
+	};
+
+	struct FunctionCost
+	{
+		std::string name;
+		double calls;     // Per timed evaluation
+		double ns;
+	};
+
+	explicit Profile(size_t iPeriod);
+	// Starts again on another program, compiled from iSource
+	void reset(const std::shared_ptr<const Program>& iProgram, const std::string& iSource);
+	// Counts an evaluation, true when it must be timed
+	bool sample() { return 0 == m_evaluations++ % m_period; }
+	double eval(EvaluationContext& ioContext, const double* iFrame);
+
+	size_t period() const { return m_period; }
+	const std::string& source() const { return m_source; }
+	std::uint64_t evaluations() const { return m_evaluations; }
+	std::uint64_t timed() const { return m_timed; }
+
+	// Per timed evaluation
+	double total_ns() const;
+	double arithmetic_ns() const;
+	double calls_ns() const;
+	// Constants, variables and locals pushed, values moved between the stacks
+	double moves_ns() const;
+	// Costliest first
+	std::vector<SpanCost> spans() const;
+	std::vector<FunctionCost> functions() const;
+	// The spans taking the most time, then the functions
+	void report(std::ostream& oOut, size_t iTop = 10) const;
+
+private:
+	double instruction_ns(size_t iInstruction) const;
+	double sum_ns(bool (*iKind)(std::uint16_t)) const;
+
+	size_t m_period;
+	std::shared_ptr<const Program> m_program;
+	std::string m_source;
+	InstructionTimes m_times;
+	std::uint64_t m_evaluations;
+	std::uint64_t m_timed;
+	double m_clock_ns;  // Cost of reading the clock
+};
+
+}
+
+#endif /* CEP_PROFILE_H_ */
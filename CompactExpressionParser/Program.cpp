@@ -0,0 +1,928 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#include "Program.h"
+#include "Operators.h"
+#include "SyntaxTree.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <stdexcept>
+
+namespace CompactExpressionParser
+{
+
+namespace
+{
+	Instruction::OpCode operation_code(std::uint8_t iKind)
+	{
+		switch(iKind)
+		{
+			case SyntaxNode::Add: return Instruction::Add;
+			case SyntaxNode::Sub: return Instruction::Sub;
+			case SyntaxNode::Mult: return Instruction::Mult;
+			case SyntaxNode::Divide: return Instruction::Divide;
+			case SyntaxNode::Less: return Instruction::Less;
+			case SyntaxNode::LessEqual: return Instruction::LessEqual;
+			case SyntaxNode::Greater: return Instruction::Greater;
+			case SyntaxNode::GreaterEqual: return Instruction::GreaterEqual;
+			case SyntaxNode::Equal: return Instruction::Equal;
+			case SyntaxNode::NotEqual: return Instruction::NotEqual;
+			case SyntaxNode::And: return Instruction::AndThen;
+			case SyntaxNode::Or: return Instruction::OrElse;
+			default: return Instruction::Power;
+		}
+	}
+
+	bool is_branching(const Instruction& iInstruction)
+	{
+		return iInstruction.code >= Instruction::Jump && iInstruction.code <= Instruction::LazyCall;
+	}
+
+	// Instructions that cannot run over the columns of a block
+	bool is_row_only(const Instruction& iInstruction)
+	{
+		return is_branching(iInstruction) || iInstruction.code == Instruction::PushString || iInstruction.code == Instruction::LoadArgument;
+	}
+
+	struct NoProbe
+	{
+		void enter(size_t) {}
+		void leave() {}
+	};
+
+	// Charges the time since the previous instruction to it
+	class TimingProbe
+	{
+	public:
+		typedef std::chrono::steady_clock clock;
+
+		explicit TimingProbe(InstructionTimes& ioTimes) : m_times(ioTimes), m_current(0), m_running(false) {}
+		void enter(size_t iInstruction)
+		{
+			charge();
+			++m_times.runs[iInstruction];
+			m_current = iInstruction;
+			m_running = true;
+		}
+		void leave() { charge(); m_running = false; }
+
+	private:
+		void charge()
+		{
+			clock::time_point now = clock::now();
+			if(m_running) m_times.nanoseconds[m_current] += std::chrono::duration<double, std::nano>(now - m_start).count();
+			m_start = now;
+		}
+
+		InstructionTimes& m_times;
+		size_t m_current;
+		bool m_running;
+		clock::time_point m_start;
+	};
+}
+
+// Gives the same identifier to structurally equal subtrees and counts their occurrences.
+// Calls to volatile functions, and subtrees containing them, are always unique.
+struct SubtreeIdentifier
+{
+	// Nodes come in postfix order, the children of a node are identified before it
+	explicit SubtreeIdentifier(const SyntaxTree& iTree) : m_tree(iTree), m_ids(iTree.size())
+	{
+		for(std::uint32_t index = 0; index < iTree.size(); ++index) m_ids[index] = identify(index);
+	}
+
+	std::uint32_t identify(std::uint32_t iIndex)
+	{
+		const SyntaxNode& node = m_tree.node(iIndex);
+		switch(node.kind)
+		{
+			case SyntaxNode::Number: return intern(key('n').append(bytes(m_tree.number(iIndex))));
+			case SyntaxNode::String:
+			{
+				boost::string_view text = m_tree.string(iIndex).StringView();
+				return intern(key('s').append(text.data(), text.size()));
+			}
+			case SyntaxNode::Variable: return intern(key('v').append(bytes(m_tree.variable(iIndex).slot)));
+			case SyntaxNode::Argument: return intern(key('a').append(bytes(node.operand)));
+			case SyntaxNode::Call:
+			{
+				const SyntaxFunction& function = m_tree.function(iIndex);
+				std::string id = key('f').append(function.name).append(1, '\0');
+				std::vector<std::uint32_t> args;
+				m_tree.arguments(iIndex, args);
+				for(std::uint32_t arg : args) id.append(bytes(m_ids[arg]));
+				if(function.definition.purity == Pure) return intern(id);
+				m_counts.push_back(1);
+				return static_cast<std::uint32_t>(m_counts.size() - 1);
+			}
+			case SyntaxNode::Select:
+			{
+				std::string id = key('?');
+				std::vector<std::uint32_t> operands;
+				m_tree.arguments(iIndex, operands);
+				for(std::uint32_t operand : operands) id.append(bytes(m_ids[operand]));
+				return intern(id);
+			}
+			default:
+			{
+				std::string id = key(static_cast<char>(operation_code(node.kind)));
+				id.append(bytes(m_ids[m_tree.left(iIndex)]));
+				id.append(bytes(m_ids[m_tree.right(iIndex)]));
+				return intern(id);
+			}
+		}
+	}
+
+	static std::string key(char iKind) { return std::string(1, iKind); }
+	template<typename T> static std::string bytes(const T& iValue) { return std::string(reinterpret_cast<const char*>(&iValue), sizeof(T)); }
+
+	std::uint32_t intern(const std::string& iKey)
+	{
+		std::map<std::string, std::uint32_t>::iterator found = m_keys.find(iKey);
+		if(found != m_keys.end()) { ++m_counts[found->second]; return found->second; }
+		m_counts.push_back(1);
+		return m_keys[iKey] = static_cast<std::uint32_t>(m_counts.size() - 1);
+	}
+
+	// Occurrences of the subtree rooted at a node
+	size_t occurrences(std::uint32_t iIndex) const { return m_counts[m_ids[iIndex]]; }
+
+	// Recounts occurrences the way they are lowered: nothing below a repeated occurrence
+	// of a shared subtree is emitted, so occurrences found there are not counted, and
+	// the arguments of lazy calls are lowered apart
+	void count_lowered(const std::vector<std::uint32_t>& iRoots)
+	{
+		std::vector<std::uint32_t> all(m_counts.size(), 0);
+		m_counts.swap(all);
+		// Nodes left to count, on a stack of their own so that deep trees are counted as well
+		std::vector<std::uint32_t> pending(iRoots.rbegin(), iRoots.rend());
+		std::vector<std::uint32_t> args;
+		while(!pending.empty())
+		{
+			std::uint32_t index = pending.back();
+			pending.pop_back();
+			const SyntaxNode& node = m_tree.node(index);
+			if(node.kind < SyntaxNode::Add) continue;
+			std::uint32_t id = m_ids[index];
+			if(++m_counts[id] != 1 && all[id] > 1) continue;
+			if(node.kind == SyntaxNode::Call && m_tree.is_lazy(index)) continue;
+			if(node.kind != SyntaxNode::Call && node.kind != SyntaxNode::Select)
+			{
+				pending.push_back(m_tree.right(index));
+				pending.push_back(m_tree.left(index));
+				continue;
+			}
+			m_tree.arguments(index, args);
+			pending.insert(pending.end(), args.rbegin(), args.rend());
+		}
+	}
+
+	const SyntaxTree& m_tree;
+	std::map<std::string, std::uint32_t> m_keys;
+	std::vector<std::uint32_t> m_ids;     // By node
+	std::vector<std::uint32_t> m_counts;  // By identifier
+};
+
+// Emits the tree in postfix order while tracking the deepest use of both stacks.
+// Lowering a node returns true when it leaves its result on the value stack.
+struct ProgramLowering
+{
+	ProgramLowering(Program& ioProgram, const SyntaxTree& iTree, const SubtreeIdentifier& iSubtrees)
+	: m_program(ioProgram), m_tree(iTree), m_subtrees(iSubtrees), m_numbers(0), m_values(0), m_node(0) {}
+
+	// Lowers every root, results staying on the stacks, then hands the tables over to the program
+	bool lower(const std::vector<std::uint32_t>& iRoots)
+	{
+		bool boxed = false;
+		for(std::uint32_t root : iRoots)
+		{
+			boxed = lower(root);
+			ProgramOutput output = { static_cast<std::uint32_t>((boxed ? m_values : m_numbers) - 1), boxed };
+			m_program.m_outputs.push_back(output);
+		}
+		if(iRoots.size() < 2) m_program.m_outputs.clear();
+		m_program.m_functions = std::make_shared< const std::vector<ProgramFunction> >(m_functions);
+		m_program.m_variables = std::make_shared< const std::vector<ProgramVariable> >(m_variables);
+		return boxed;
+	}
+
+	// Where the user of a result wants it
+	enum Stack { AnyStack, NumberStack, ValueStack };
+
+	// A node being lowered, one operand at a time: nodes wait on a stack of tasks rather
+	// than on the native stack, so that trees as deep as long sums are lowered as well
+	struct Task
+	{
+		std::uint32_t node;
+		Stack stack;
+		size_t step;                            // Operands lowered so far
+		std::pair<std::uint32_t, bool> shared;  // See local()
+		bool boxed;
+		size_t jump;                            // Jumps waiting for their target
+		size_t end;
+		std::vector<std::uint32_t> operands;    // Of calls and selections
+		std::map<std::uint32_t, std::uint32_t> locals;  // Known before the branch being lowered
+	};
+
+	// Instructions are emitted for the node being lowered, Box and Unbox for the one using the result
+	bool lower(std::uint32_t iRoot)
+	{
+		bool boxed = push_task(iRoot, AnyStack);
+		while(!m_tasks.empty())
+		{
+			size_t task = m_tasks.size() - 1;
+			m_node = m_tasks[task].node;
+			if(!step(task)) continue;
+			boxed = m_tasks[task].boxed;
+			Stack stack = m_tasks[task].stack;
+			m_tasks.pop_back();
+			if(!m_tasks.empty()) m_node = m_tasks.back().node;
+			boxed = move_to(stack, boxed);
+		}
+		return boxed;
+	}
+
+	// Always false: the task is only started by the next step
+	bool push_task(std::uint32_t iIndex, Stack iStack)
+	{
+		m_tasks.push_back(Task());
+		m_tasks.back().node = iIndex;
+		m_tasks.back().stack = iStack;
+		m_tasks.back().step = 0;
+		m_tasks.back().boxed = false;
+		return false;
+	}
+
+	// Moves a result to the stack its user wants, returns whether it ends boxed
+	bool move_to(Stack iStack, bool iBoxed)
+	{
+		if(iBoxed && iStack == NumberStack)
+		{
+			emit(Instruction::Unbox, 0, 0);
+			m_values -= 1;
+			push_number();
+			return false;
+		}
+		if(!iBoxed && iStack == ValueStack)
+		{
+			emit(Instruction::Box, 0, 0);
+			m_numbers -= 1;
+			push_value();
+			return true;
+		}
+		return iBoxed;
+	}
+
+	// Runs the next step of a task, true once the node is lowered. Tasks pushed on top
+	// may move the one being run, which is not used past them.
+	bool step(size_t iTask)
+	{
+		Task& task = m_tasks[iTask];
+		const SyntaxNode& node = m_tree.node(task.node);
+		switch(node.kind)
+		{
+			case SyntaxNode::Number:
+				emit(Instruction::PushNumber, 0, static_cast<std::uint32_t>(m_program.m_numbers.size()));
+				m_program.m_numbers.push_back(m_tree.number(task.node));
+				push_number();
+				task.boxed = false;
+				return true;
+			case SyntaxNode::String:
+				emit(Instruction::PushString, 0, literal(task.node));
+				push_value();
+				task.boxed = true;
+				return true;
+			case SyntaxNode::Variable:
+				task.boxed = lower_variable(m_tree.variable(task.node));
+				return true;
+			case SyntaxNode::Argument:
+				emit(Instruction::LoadArgument, 0, node.operand);
+				push_value();
+				task.boxed = true;
+				return true;
+			case SyntaxNode::Call:
+				if(!m_tree.is_lazy(task.node)) return step_call(task);
+				task.boxed = lower_lazy_call(task.node);
+				return true;
+			case SyntaxNode::And: case SyntaxNode::Or: return step_logical(task);
+			case SyntaxNode::Select: return step_select(task);
+			default: return step_operation(task);
+		}
+	}
+
+	bool lower_variable(const SyntaxVariable& iVariable)
+	{
+		emit(Instruction::LoadVariable, 0, iVariable.slot);
+		add_variable(iVariable.name, iVariable.slot);
+		push_number();
+		return false;
+	}
+
+	void add_variable(const std::string& iName, std::uint32_t iSlot)
+	{
+		if(iSlot >= m_read.size()) m_read.resize(iSlot + 1, false);
+		if(m_read[iSlot]) return;
+		m_read[iSlot] = true;
+		ProgramVariable variable = { iName, iSlot };
+		m_variables.push_back(variable);
+	}
+
+	// First step of a node that may be shared, true when it is loaded from its local instead
+	bool loaded(Task& ioTask, bool iBoxed)
+	{
+		ioTask.boxed = iBoxed;
+		ioTask.shared = local(ioTask.node, iBoxed ? m_program.m_value_locals : m_program.m_number_locals);
+		if(ioTask.shared.second) return false;
+		emit(iBoxed ? Instruction::LoadValue : Instruction::LoadNumber, 0, ioTask.shared.first);
+		if(iBoxed) push_value();
+		else push_number();
+		return true;
+	}
+
+	// Last step of a node, stored when shared
+	bool lowered(const Task& iTask)
+	{
+		if(iTask.shared.first != NoLocal) emit(iTask.boxed ? Instruction::StoreValue : Instruction::StoreNumber, 0, iTask.shared.first);
+		return true;
+	}
+
+	// Locals first stored by code that may be jumped over are forgotten once past it
+	void enter_branch(Task& ioTask) { ioTask.locals = m_locals; }
+	void leave_branch(Task& ioTask) { m_locals.swap(ioTask.locals); }
+
+	// <left> AndThen end, <right> Truth, end: the left operand stays when it decides
+	bool step_logical(Task& ioTask)
+	{
+		switch(ioTask.step++)
+		{
+			case 0: return loaded(ioTask, false) || push_task(m_tree.left(ioTask.node), NumberStack);
+			case 1:
+				ioTask.jump = m_program.m_code.size();
+				emit(operation_code(m_tree.node(ioTask.node).kind), 0, 0);
+				m_numbers -= 1;
+				enter_branch(ioTask);
+				return push_task(m_tree.right(ioTask.node), NumberStack);
+			default:
+				leave_branch(ioTask);
+				emit(Instruction::Truth, 0, 0);
+				m_program.m_code[ioTask.jump].operand = static_cast<std::uint32_t>(m_program.m_code.size());
+				return lowered(ioTask);
+		}
+	}
+
+	// <condition> JumpIfZero otherwise, <then> Jump end, otherwise: <otherwise> end:
+	// Both branches leave their result on the same stack
+	bool step_select(Task& ioTask)
+	{
+		Stack branch = ioTask.boxed ? ValueStack : NumberStack;
+		switch(ioTask.step++)
+		{
+			case 0:
+				if(loaded(ioTask, m_tree.is_boxed(ioTask.node))) return true;
+				m_tree.arguments(ioTask.node, ioTask.operands);
+				return push_task(ioTask.operands[0], NumberStack);
+			case 1:
+				ioTask.jump = m_program.m_code.size();
+				emit(Instruction::JumpIfZero, 0, 0);
+				m_numbers -= 1;
+				enter_branch(ioTask);
+				return push_task(ioTask.operands[1], branch);
+			case 2:
+				leave_branch(ioTask);
+				ioTask.end = m_program.m_code.size();
+				emit(Instruction::Jump, 0, 0);
+				m_program.m_code[ioTask.jump].operand = static_cast<std::uint32_t>(m_program.m_code.size());
+				if(ioTask.boxed) m_values -= 1;
+				else m_numbers -= 1;
+				enter_branch(ioTask);
+				return push_task(ioTask.operands[2], branch);
+			default:
+				leave_branch(ioTask);
+				m_program.m_code[ioTask.end].operand = static_cast<std::uint32_t>(m_program.m_code.size());
+				return lowered(ioTask);
+		}
+	}
+
+	// Arguments become programs of their own, the variables they read being read by this one
+	bool lower_lazy_call(std::uint32_t iIndex)
+	{
+		std::pair<std::uint32_t, bool> shared = local(iIndex, m_program.m_value_locals);
+		if(!shared.second)
+		{
+			emit(Instruction::LoadValue, 0, shared.first);
+			push_value();
+			return true;
+		}
+		ProgramLazyCall call;
+		call.function = function_index(m_tree.function(iIndex));
+		std::vector<std::uint32_t> args;
+		m_tree.arguments(iIndex, args);
+		for(std::uint32_t arg : args)
+		{
+			call.arguments.push_back(std::make_shared<const Program>(m_tree, std::vector<std::uint32_t>(1, arg)));
+			for(const ProgramVariable& variable : call.arguments.back()->variables()) add_variable(variable.name, variable.slot);
+		}
+		emit(Instruction::LazyCall, static_cast<std::uint16_t>(args.size()), static_cast<std::uint32_t>(m_program.m_lazy_calls.size()));
+		m_program.m_lazy_calls.push_back(call);
+		push_value();
+		if(shared.first != NoLocal) emit(Instruction::StoreValue, 0, shared.first);
+		return true;
+	}
+
+	bool step_operation(Task& ioTask)
+	{
+		switch(ioTask.step++)
+		{
+			case 0: return loaded(ioTask, false) || push_task(m_tree.left(ioTask.node), NumberStack);
+			case 1: return push_task(m_tree.right(ioTask.node), NumberStack);
+			default:
+				emit(operation_code(m_tree.node(ioTask.node).kind), 0, 0);
+				m_numbers -= 1;
+				return lowered(ioTask);
+		}
+	}
+
+	bool step_call(Task& ioTask)
+	{
+		if(0 == ioTask.step)
+		{
+			if(loaded(ioTask, true)) return true;
+			m_tree.arguments(ioTask.node, ioTask.operands);
+		}
+		if(ioTask.step < ioTask.operands.size()) return push_task(ioTask.operands[ioTask.step++], ValueStack);
+		emit(Instruction::Call, static_cast<std::uint16_t>(ioTask.operands.size()), function_index(m_tree.function(ioTask.node)));
+		m_values -= ioTask.operands.size();
+		push_value();
+		return lowered(ioTask);
+	}
+
+	static const std::uint32_t NoLocal = 0xFFFFFFFF;
+
+	// Returns the local holding the subtree rooted at iIndex, or NoLocal if it is not shared,
+	// and whether the subtree must be computed (first occurrence) or loaded
+	std::pair<std::uint32_t, bool> local(std::uint32_t iIndex, size_t& ioLocals)
+	{
+		if(m_subtrees.occurrences(iIndex) < 2) return std::make_pair(NoLocal, true);
+		std::uint32_t id = m_subtrees.m_ids[iIndex];
+		std::map<std::uint32_t, std::uint32_t>::const_iterator found = m_locals.find(id);
+		if(found != m_locals.end()) return std::make_pair(found->second, false);
+		std::uint32_t index = static_cast<std::uint32_t>(ioLocals++);
+		m_locals[id] = index;
+		return std::make_pair(index, true);
+	}
+
+	void push_number()
+	{
+		m_program.m_number_stack_size = std::max(m_program.m_number_stack_size, ++m_numbers);
+	}
+
+	void push_value()
+	{
+		m_program.m_value_stack_size = std::max(m_program.m_value_stack_size, ++m_values);
+	}
+
+	void emit(Instruction::OpCode iCode, std::uint16_t iArity, std::uint32_t iOperand)
+	{
+		Instruction instruction = { static_cast<std::uint16_t>(iCode), iArity, iOperand };
+		m_program.m_code.push_back(instruction);
+		if(m_tree.has_spans()) m_program.m_spans.push_back(m_tree.span(m_node));
+	}
+
+	// Equal literals share one entry of the string table
+	std::uint32_t literal(std::uint32_t iIndex)
+	{
+		std::map<std::uint32_t, std::uint32_t>::const_iterator found = m_literals.find(m_subtrees.m_ids[iIndex]);
+		if(found != m_literals.end()) return found->second;
+		std::uint32_t index = static_cast<std::uint32_t>(m_program.m_strings.size());
+		m_program.m_strings.push_back(m_tree.string(iIndex));
+		return m_literals[m_subtrees.m_ids[iIndex]] = index;
+	}
+
+	std::uint32_t function_index(const SyntaxFunction& iFunction)
+	{
+		for(size_t index = 0; index < m_functions.size(); ++index)
+			if(m_functions[index].name == iFunction.name) return static_cast<std::uint32_t>(index);
+		ProgramFunction function = { iFunction.name, iFunction.definition };
+		m_functions.push_back(function);
+		return static_cast<std::uint32_t>(m_functions.size() - 1);
+	}
+
+	Program& m_program;
+	const SyntaxTree& m_tree;
+	const SubtreeIdentifier& m_subtrees;
+	std::map<std::uint32_t, std::uint32_t> m_locals;
+	std::map<std::uint32_t, std::uint32_t> m_literals;  // Subtree identifier to string table
+	std::vector<ProgramFunction> m_functions;
+	std::vector<Task> m_tasks;
+	std::vector<ProgramVariable> m_variables;
+	std::vector<bool> m_read;  // By slot, whether m_variables holds it
+	size_t m_numbers;
+	size_t m_values;
+	std::uint32_t m_node;
+};
+
+Program::Program() : m_number_stack_size(0), m_value_stack_size(0), m_number_locals(0), m_value_locals(0), m_boxed_result(false)
+{
+	SyntaxTree zero;
+	zero.push_number(0.);
+	lower(zero, std::vector<std::uint32_t>(1, zero.root()));
+}
+
+Program::Program(const SyntaxTree& iTree) : m_number_stack_size(0), m_value_stack_size(0), m_number_locals(0), m_value_locals(0), m_boxed_result(false)
+{
+	lower(iTree, std::vector<std::uint32_t>(1, iTree.root()));
+}
+
+Program::Program(const SyntaxTree& iTree, const std::vector<std::uint32_t>& iRoots) :
+m_number_stack_size(0), m_value_stack_size(0), m_number_locals(0), m_value_locals(0), m_boxed_result(false)
+{
+	lower(iTree, iRoots);
+}
+
+Program::Program(const std::shared_ptr<const void>& iImage) :
+m_number_stack_size(0), m_value_stack_size(0), m_number_locals(0), m_value_locals(0), m_boxed_result(false), m_image(iImage)
+{}
+
+void Program::lower(const SyntaxTree& iTree, const std::vector<std::uint32_t>& iRoots)
+{
+	SubtreeIdentifier subtrees(iTree);
+	subtrees.count_lowered(iRoots);
+	ProgramLowering lowering(*this, iTree, subtrees);
+	m_boxed_result = lowering.lower(iRoots);
+	m_code_view = ArrayView<Instruction>(m_code);
+	m_numbers_view = ArrayView<double>(m_numbers);
+}
+
+namespace
+{
+	// Contexts lent to nested evaluations, by nesting level
+	thread_local std::vector< std::unique_ptr<EvaluationContext> > nested_contexts;
+	thread_local size_t nesting_level = 0;
+
+	template<typename T> void apply_columns(double* __restrict ioLeft, const double* __restrict iRight, size_t iCount)
+	{
+		for(size_t i = 0; i < iCount; ++i) ioLeft[i] = T::apply(ioLeft[i], iRight[i]);
+	}
+
+	// Unbinds the columns of a batch when it ends, were it by an exception thrown from a function
+	class BoundColumns
+	{
+	public:
+		BoundColumns(std::vector<const double*>& ioFunctions, std::vector<const double*>& ioVariables) :
+		m_functions(ioFunctions), m_variables(ioVariables) {}
+		~BoundColumns() { m_functions.clear(); m_variables.clear(); }
+
+	private:
+		BoundColumns(const BoundColumns&);
+		BoundColumns& operator= (const BoundColumns&);
+		std::vector<const double*>& m_functions;
+		std::vector<const double*>& m_variables;
+	};
+
+	// Arguments of a lazy call, each one run when read, with the frame and the arguments of the caller
+	class ThunkArguments : public LazyArguments
+	{
+	public:
+		ThunkArguments(const ProgramLazyCall& iCall, const double* iFrame, const ArgumentSpan* iArguments) :
+		m_call(iCall), m_frame(iFrame), m_arguments(iArguments) {}
+
+		virtual size_t size() const { return m_call.arguments.size(); }
+		virtual ResultType operator[](size_t iIndex) const
+		{
+			if(iIndex >= m_call.arguments.size()) throw std::out_of_range("Function argument");
+			EvaluationContext::Nested nested;
+			return m_call.arguments[iIndex]->run(nested.context(), m_frame, m_arguments);
+		}
+
+	private:
+		const ProgramLazyCall& m_call;
+		const double* m_frame;
+		const ArgumentSpan* m_arguments;
+	};
+}
+
+size_t Program::frame_size() const
+{
+	size_t size = 0;
+	for(const ProgramVariable& variable : *m_variables) size = std::max<size_t>(size, variable.slot + 1);
+	return size;
+}
+
+double Program::eval(EvaluationContext& ioContext, const double* iFrame) const
+{
+	std::pair<double*, ResultType*> top = ioContext.execute(*this, iFrame, nullptr);
+	return m_boxed_result ? static_cast<double>(*top.second) : *top.first;
+}
+
+ResultType Program::run(EvaluationContext& ioContext, const double* iFrame, const ArgumentSpan* iArguments) const
+{
+	std::pair<double*, ResultType*> top = ioContext.execute(*this, iFrame, iArguments);
+	return m_boxed_result ? *top.second : ResultType(*top.first);
+}
+
+void Program::eval_outputs(EvaluationContext& ioContext, const double* iFrame, double* oResults) const
+{
+	if(m_outputs.empty())
+	{
+		*oResults = eval(ioContext, iFrame);
+		return;
+	}
+	ioContext.execute(*this, iFrame, nullptr);
+	for(const ProgramOutput& output : m_outputs)
+		*oResults++ = output.boxed ? static_cast<double>(ioContext.m_values[output.slot]) : ioContext.m_numbers[output.slot];
+}
+
+double Program::eval(EvaluationContext& ioContext, const double* iFrame, InstructionTimes& ioTimes) const
+{
+	ioTimes.runs.resize(m_code_view.size());
+	ioTimes.nanoseconds.resize(m_code_view.size());
+	TimingProbe probe(ioTimes);
+	std::pair<double*, ResultType*> top = ioContext.execute(*this, iFrame, nullptr, 0, probe);
+	return m_boxed_result ? static_cast<double>(*top.second) : *top.first;
+}
+
+void Program::eval_batch(EvaluationContext& ioContext, const double* iFrame, const std::vector<Column>& iColumns, size_t iRows, double* oResults) const
+{
+	ioContext.eval_batch(*this, iFrame, iColumns, iRows, oResults);
+}
+
+EvaluationContext::Nested::Nested()
+{
+	if(nested_contexts.size() <= nesting_level) nested_contexts.emplace_back(new EvaluationContext);
+	m_context = nested_contexts[nesting_level++].get();
+}
+
+EvaluationContext::Nested::~Nested() { --nesting_level; }
+
+void EvaluationContext::eval_batch(const Program& iProgram, const double* iFrame, const std::vector<Column>& iColumns, size_t iRows, double* oResults)
+{
+	const std::vector<ProgramFunction>& functions = iProgram.functions();
+	const std::vector<ProgramVariable>& variables = iProgram.variables();
+	BoundColumns bound(m_bound, m_bound_variables);
+	m_bound.assign(functions.size(), nullptr);
+	m_bound_variables.assign(iProgram.frame_size(), nullptr);
+	for(const Column& column : iColumns)
+	{
+		for(size_t index = 0; index < functions.size(); ++index)
+			if(functions[index].name == column.name) m_bound[index] = column.values;
+		for(const ProgramVariable& variable : variables)
+			if(variable.name == column.name) m_bound_variables[variable.slot] = column.values;
+	}
+
+	// Rows evaluated one at a time read their variables from a copy of the frame
+	m_row_frame.assign(iProgram.frame_size(), 0.);
+	for(const ProgramVariable& variable : variables) m_row_frame[variable.slot] = iFrame[variable.slot];
+
+	// Strings cannot live in columns, and rows of a block take different branches:
+	// such programs are evaluated one row at a time. Decided before any call, so that none runs twice.
+	bool rows = std::any_of(iProgram.code().begin(), iProgram.code().end(), is_row_only);
+	for(size_t row = 0; row < iRows; row += BlockSize)
+	{
+		size_t count = std::min(BlockSize, iRows - row);
+		if(!rows) execute_block(iProgram, iFrame, row, count, oResults + row);
+		else
+		{
+			for(size_t i = row; i < row + count; ++i)
+			{
+				for(const ProgramVariable& variable : variables)
+					if(m_bound_variables[variable.slot]) m_row_frame[variable.slot] = m_bound_variables[variable.slot][i];
+				std::pair<double*, ResultType*> top = execute(iProgram, m_row_frame.data(), nullptr, i);
+				oResults[i] = iProgram.boxed_result() ? static_cast<double>(*top.second) : *top.first;
+			}
+		}
+	}
+}
+
+// Number slot k is column k, value slot k is column number_stack_size() + k
+void EvaluationContext::execute_block(const Program& iProgram, const double* iFrame, size_t iRow, size_t iCount, double* oResults)
+{
+	size_t columns = iProgram.number_stack_size() + iProgram.value_stack_size() + iProgram.number_locals() + iProgram.value_locals() + 1;
+	if(m_columns.size() < columns * BlockSize) m_columns.resize(columns * BlockSize);
+
+	const double* constants = iProgram.numbers().data();
+	const std::vector<ProgramFunction>& functions = iProgram.functions();
+	double* number = m_columns.data() - BlockSize;
+	double* value = m_columns.data() + (iProgram.number_stack_size() - 1) * BlockSize;
+	double* number_locals = m_columns.data() + (iProgram.number_stack_size() + iProgram.value_stack_size()) * BlockSize;
+	double* value_locals = number_locals + iProgram.number_locals() * BlockSize;
+	double* scratch = m_columns.data() + (columns - 1) * BlockSize;
+
+	for(const Instruction& instruction : iProgram.code())
+	{
+		switch(instruction.code)
+		{
+			case Instruction::PushNumber: number += BlockSize; std::fill(number, number + iCount, constants[instruction.operand]); break;
+			// Programs holding these are evaluated one row at a time
+			case Instruction::PushString: case Instruction::LoadArgument:
+			case Instruction::Jump: case Instruction::JumpIfZero: case Instruction::AndThen: case Instruction::OrElse:
+			case Instruction::LazyCall: break;
+			case Instruction::LoadVariable:
+			{
+				number += BlockSize;
+				const double* bound = m_bound_variables[instruction.operand];
+				if(bound) std::copy(bound + iRow, bound + iRow + iCount, number);
+				else std::fill(number, number + iCount, iFrame[instruction.operand]);
+				break;
+			}
+			case Instruction::Box: value += BlockSize; std::copy(number, number + iCount, value); number -= BlockSize; break;
+			case Instruction::Unbox: number += BlockSize; std::copy(value, value + iCount, number); value -= BlockSize; break;
+			case Instruction::StoreNumber: std::copy(number, number + iCount, number_locals + instruction.operand * BlockSize); break;
+			case Instruction::LoadNumber: number += BlockSize; std::copy_n(number_locals + instruction.operand * BlockSize, iCount, number); break;
+			case Instruction::StoreValue: std::copy(value, value + iCount, value_locals + instruction.operand * BlockSize); break;
+			case Instruction::LoadValue: value += BlockSize; std::copy_n(value_locals + instruction.operand * BlockSize, iCount, value); break;
+			case Instruction::Add: number -= BlockSize; apply_columns<add>(number, number + BlockSize, iCount); break;
+			case Instruction::Sub: number -= BlockSize; apply_columns<sub>(number, number + BlockSize, iCount); break;
+			case Instruction::Mult: number -= BlockSize; apply_columns<mult>(number, number + BlockSize, iCount); break;
+			case Instruction::Divide: number -= BlockSize; apply_columns<divide>(number, number + BlockSize, iCount); break;
+			case Instruction::Power: number -= BlockSize; apply_columns<power>(number, number + BlockSize, iCount); break;
+			case Instruction::Less: number -= BlockSize; apply_columns<less>(number, number + BlockSize, iCount); break;
+			case Instruction::LessEqual: number -= BlockSize; apply_columns<less_equal>(number, number + BlockSize, iCount); break;
+			case Instruction::Greater: number -= BlockSize; apply_columns<greater>(number, number + BlockSize, iCount); break;
+			case Instruction::GreaterEqual: number -= BlockSize; apply_columns<greater_equal>(number, number + BlockSize, iCount); break;
+			case Instruction::Equal: number -= BlockSize; apply_columns<equal>(number, number + BlockSize, iCount); break;
+			case Instruction::NotEqual: number -= BlockSize; apply_columns<not_equal>(number, number + BlockSize, iCount); break;
+			case Instruction::Truth: for(size_t i = 0; i < iCount; ++i) number[i] = truth(number[i]) ? 1. : 0.; break;
+			case Instruction::Call:
+			{
+				double* args = value + BlockSize - instruction.arity * BlockSize;
+				const FunctionDefinition& definition = functions[instruction.operand].definition;
+				const double* bound = instruction.arity ? nullptr : m_bound[instruction.operand];
+				if(bound)
+					std::copy(bound + iRow, bound + iRow + iCount, args);
+				else if(definition.vectorized)
+				{
+					m_arguments.resize(instruction.arity);
+					for(size_t arg = 0; arg < instruction.arity; ++arg) m_arguments[arg] = args + arg * BlockSize;
+					definition.vectorized(m_arguments.data(), iCount, scratch);
+					std::copy(scratch, scratch + iCount, args);
+				}
+				else
+				{
+					m_row_arguments.resize(instruction.arity);
+					for(size_t i = 0; i < iCount; ++i)
+					{
+						for(size_t arg = 0; arg < instruction.arity; ++arg) m_row_arguments[arg] = args[arg * BlockSize + i];
+						ResultType result = definition.invoke(m_row_arguments.data(), instruction.arity, m_scalar_arguments);
+						if(!result.IsNumber())
+						{
+							finish_block(iProgram, iRow, iCount, &instruction - iProgram.code().data(), i, result, number, args, oResults);
+							return;
+						}
+						scratch[i] = result;
+					}
+					std::copy(scratch, scratch + iCount, args);
+				}
+				value = args;
+				break;
+			}
+		}
+	}
+
+	const double* result = iProgram.boxed_result() ? value : number;
+	std::copy(result, result + iCount, oResults);
+}
+
+// The call at iCall returned a string on row iFailed of the block: every row goes on alone from this call, its
+// stacks and locals read from the columns, rows before iFailed keeping the result they already got
+void EvaluationContext::finish_block(const Program& iProgram, size_t iRow, size_t iCount, size_t iCall, size_t iFailed,
+	const ResultType& iResult, const double* iNumber, const double* iArguments, double* oResults)
+{
+	reserve_stacks(iProgram);
+	const Instruction& call = iProgram.code()[iCall];
+	const double* numbers = m_columns.data();
+	const double* values = numbers + iProgram.number_stack_size() * BlockSize;
+	const double* number_locals = values + iProgram.value_stack_size() * BlockSize;
+	const double* value_locals = number_locals + iProgram.number_locals() * BlockSize;
+	const double* computed = value_locals + iProgram.value_locals() * BlockSize;
+	size_t number_depth = (iNumber + BlockSize - numbers) / BlockSize;
+	size_t value_depth = (iArguments - values) / BlockSize;  // Below the arguments of the call
+	const std::vector<ProgramVariable>& variables = iProgram.variables();
+	NoProbe probe;
+
+	for(size_t i = 0; i < iCount; ++i)
+	{
+		for(const ProgramVariable& variable : variables)
+			if(m_bound_variables[variable.slot]) m_row_frame[variable.slot] = m_bound_variables[variable.slot][iRow + i];
+		for(size_t k = 0; k < number_depth; ++k) m_numbers[k] = numbers[k * BlockSize + i];
+		for(size_t k = 0; k < value_depth; ++k) m_values[k] = values[k * BlockSize + i];
+		for(size_t k = 0; k < iProgram.number_locals(); ++k) m_number_locals[k] = number_locals[k * BlockSize + i];
+		for(size_t k = 0; k < iProgram.value_locals(); ++k) m_value_locals[k] = value_locals[k * BlockSize + i];
+
+		// Rows after the failing one have not made the call yet
+		size_t start = iCall + 1, depth = value_depth + 1;
+		if(i < iFailed) m_values[value_depth] = computed[i];
+		else if(i == iFailed) m_values[value_depth] = iResult;
+		else
+		{
+			for(size_t arg = 0; arg < call.arity; ++arg) m_values[value_depth + arg] = iArguments[arg * BlockSize + i];
+			start = iCall;
+			depth = value_depth + call.arity;
+		}
+		std::pair<double*, ResultType*> top = execute(iProgram, m_row_frame.data(), nullptr, iRow + i, probe, start, number_depth, depth);
+		oResults[i] = iProgram.boxed_result() ? static_cast<double>(*top.second) : *top.first;
+	}
+}
+
+void EvaluationContext::reserve_stacks(const Program& iProgram)
+{
+	if(m_numbers.size() < iProgram.number_stack_size()) m_numbers.resize(iProgram.number_stack_size());
+	if(m_values.size() < iProgram.value_stack_size()) m_values.resize(iProgram.value_stack_size());
+	if(m_number_locals.size() < iProgram.number_locals()) m_number_locals.resize(iProgram.number_locals());
+	if(m_value_locals.size() < iProgram.value_locals()) m_value_locals.resize(iProgram.value_locals());
+}
+
+
+std::pair<double*, ResultType*> EvaluationContext::execute(const Program& iProgram, const double* iFrame, const ArgumentSpan* iArguments, size_t iRow)
+{
+	NoProbe probe;
+	return execute(iProgram, iFrame, iArguments, iRow, probe);
+}
+
+template<typename Probe> std::pair<double*, ResultType*> EvaluationContext::execute(const Program& iProgram, const double* iFrame,
+	const ArgumentSpan* iArguments, size_t iRow, Probe& ioProbe, size_t iStart, size_t iNumbers, size_t iValues)
+{
+	reserve_stacks(iProgram);
+
+	const double* constants = iProgram.numbers().data();
+	const std::vector<ResultType>& strings = iProgram.strings();
+	const std::vector<ProgramFunction>& functions = iProgram.functions();
+	double* number = m_numbers.data() - 1 + iNumbers;
+	ResultType* value = m_values.data() - 1 + iValues;
+
+	const Instruction* code = iProgram.code().data();
+	const Instruction* end = code + iProgram.code().size();
+	for(const Instruction* next = code + iStart; next != end;)
+	{
+		const Instruction& instruction = *next++;
+		ioProbe.enter(&instruction - code);
+		switch(instruction.code)
+		{
+			case Instruction::PushNumber: *++number = constants[instruction.operand]; break;
+			case Instruction::PushString: *++value = strings[instruction.operand]; break;
+			case Instruction::LoadVariable: *++number = iFrame[instruction.operand]; break;
+			case Instruction::Box: *++value = *number--; break;
+			case Instruction::Unbox: *++number = *value--; break;
+			case Instruction::StoreNumber: m_number_locals[instruction.operand] = *number; break;
+			case Instruction::LoadNumber: *++number = m_number_locals[instruction.operand]; break;
+			case Instruction::StoreValue: m_value_locals[instruction.operand] = *value; break;
+			case Instruction::LoadValue: *++value = m_value_locals[instruction.operand]; break;
+			case Instruction::LoadArgument:
+				if(!iArguments || instruction.operand >= iArguments->size()) throw std::out_of_range("Function argument");
+				*++value = (*iArguments)[instruction.operand];
+				break;
+			case Instruction::Add: number[-1] = add::apply(number[-1], *number); --number; break;
+			case Instruction::Sub: number[-1] = sub::apply(number[-1], *number); --number; break;
+			case Instruction::Mult: number[-1] = mult::apply(number[-1], *number); --number; break;
+			case Instruction::Divide: number[-1] = divide::apply(number[-1], *number); --number; break;
+			case Instruction::Power: number[-1] = power::apply(number[-1], *number); --number; break;
+			case Instruction::Less: number[-1] = less::apply(number[-1], *number); --number; break;
+			case Instruction::LessEqual: number[-1] = less_equal::apply(number[-1], *number); --number; break;
+			case Instruction::Greater: number[-1] = greater::apply(number[-1], *number); --number; break;
+			case Instruction::GreaterEqual: number[-1] = greater_equal::apply(number[-1], *number); --number; break;
+			case Instruction::Equal: number[-1] = equal::apply(number[-1], *number); --number; break;
+			case Instruction::NotEqual: number[-1] = not_equal::apply(number[-1], *number); --number; break;
+			case Instruction::Truth: *number = truth(*number) ? 1. : 0.; break;
+			case Instruction::Jump: next = code + instruction.operand; break;
+			case Instruction::JumpIfZero: if(!truth(*number--)) next = code + instruction.operand; break;
+			case Instruction::AndThen:
+				if(truth(*number)) --number;
+				else { *number = 0.; next = code + instruction.operand; }
+				break;
+			case Instruction::OrElse:
+				if(!truth(*number)) --number;
+				else { *number = 1.; next = code + instruction.operand; }
+				break;
+			case Instruction::LazyCall:
+			{
+				const ProgramLazyCall& call = iProgram.lazy_calls()[instruction.operand];
+				if(!m_bound.empty() && !instruction.arity && m_bound[call.function])
+					*++value = m_bound[call.function][iRow];
+				else
+					*++value = functions[call.function].definition.lazy(ThunkArguments(call, iFrame, iArguments));
+				break;
+			}
+			case Instruction::Call:
+			{
+				ResultType* args = value + 1 - instruction.arity;
+				if(!m_bound.empty() && !instruction.arity && m_bound[instruction.operand])
+					*args = m_bound[instruction.operand][iRow];
+				else
+					*args = functions[instruction.operand].definition.invoke(args, instruction.arity, m_scalar_arguments);
+				value = args;
+				break;
+			}
+		}
+	}
+	ioProbe.leave();
+	return std::make_pair(number, value);
+}
+
+}
@@ -0,0 +1,244 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#ifndef CEP_PROGRAM_H_
+#define CEP_PROGRAM_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Interfaces.h"
+
+namespace CompactExpressionParser
+{
+
+class SyntaxTree;
+class EvaluationContext;
+
+struct Instruction
+{
+	enum OpCode { PushNumber, PushString, LoadVariable, Box, Unbox, Add, Sub, Mult, Divide, Power, Call,
+		StoreNumber, LoadNumber, StoreValue, LoadValue, LoadArgument,
+		Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual, Truth, Jump, JumpIfZero, AndThen, OrElse, LazyCall };
+
+	std::uint16_t code;
+	std::uint16_t arity;    // Call and LazyCall only
+	std::uint32_t operand;  // Index in the constant pool, the function table, the frame, the locals, the arguments,
+	                        // the lazy calls, or the instruction jumped to
+};
+
+struct ProgramFunction
+{
+	std::string name;
+	FunctionDefinition definition;
+};
+
+struct ProgramVariable
+{
+	std::string name;
+	std::uint32_t slot;
+};
+
+class Program;
+
+// Call to a lazy function: each argument is a program of its own, run only when the function reads it
+struct ProgramLazyCall
+{
+	std::uint32_t function;  // In the function table
+	std::vector< std::shared_ptr<const Program> > arguments;
+};
+
+// Read only view over an array owned elsewhere: a vector, or a mapped file
+template<typename T> class ArrayView
+{
+public:
+	ArrayView() : m_data(nullptr), m_size(0) {}
+	ArrayView(const T* iData, size_t iSize) : m_data(iData), m_size(iSize) {}
+	ArrayView(const std::vector<T>& iVector) : m_data(iVector.data()), m_size(iVector.size()) {}
+
+	const T* data() const { return m_data; }
+	size_t size() const { return m_size; }
+	bool empty() const { return 0 == m_size; }
+	const T* begin() const { return m_data; }
+	const T* end() const { return m_data + m_size; }
+	const T& operator[](size_t iIndex) const { return m_data[iIndex]; }
+
+private:
+	const T* m_data;
+	size_t m_size;
+};
+
+// Runs and time of each instruction of a program, summed over the evaluations timed
+struct InstructionTimes
+{
+	std::vector<std::uint64_t> runs;
+	std::vector<double> nanoseconds;
+};
+
+// Stack slot holding the result of one root of a program lowered from several of them
+struct ProgramOutput
+{
+	std::uint32_t slot;
+	bool boxed;  // On the value stack
+};
+
+/** Postfix, contiguous form of a syntax tree.
+ *
+ * Instructions only hold indices: literals live in the constant pools and
+ * functions in a table shared by all the call sites of the same name.
+ * Arithmetic runs on a stack of doubles; strings, function arguments and
+ * results live on a second stack of ResultType, Box and Unbox moving values
+ * from one to the other.
+ *
+ * Subtrees found several times are computed once: the first occurrence copies
+ * its result in a local (StoreNumber, StoreValue) that the others read back
+ * (LoadNumber, LoadValue). Subtrees calling volatile functions are not shared.
+ *
+ * Conditions jump over the code they do not need: JumpIfZero skips the branch
+ * of a selection not taken, AndThen and OrElse the right operand of && and ||
+ * once the left one decides. Subtrees first computed in such code are not
+ * shared with the code after it. The arguments of lazy functions are programs
+ * of their own, run in a nested context when the function reads them; variables
+ * they read are listed with the variables of the program, but input columns of
+ * a batch do not replace the calls they make.
+ *
+ * A program never changes once built: it can be shared and evaluated by any
+ * number of threads at once, each one with its own EvaluationContext.
+ *
+ * A program can be lowered from several roots of a tree at once, subtrees shared
+ * between them being computed once as well. The result of each root stays on
+ * the stacks, below the next ones, and eval_outputs() reads them all.
+ *
+ * Programs loaded from a ProgramBundle read their code and constants in place
+ * from the bundle, and share its function and variable tables. */
+class Program
+{
+public:
+	Program();
+	explicit Program(const SyntaxTree& iTree);
+	// Roots given in increasing order, none of them inside the subtree of another
+	Program(const SyntaxTree& iTree, const std::vector<std::uint32_t>& iRoots);
+
+	// Variables are read from iFrame, indexed by slot. iArguments are the arguments of a function body.
+	ResultType run(EvaluationContext& ioContext, const double* iFrame, const ArgumentSpan* iArguments = nullptr) const;
+	double eval(EvaluationContext& ioContext, const double* iFrame) const;
+	// Input columns replace the variables, and the calls to zero argument functions, of the same name
+	void eval_batch(EvaluationContext& ioContext, const double* iFrame, const std::vector<Column>& iColumns, size_t iRows, double* oResults) const;
+	// One result per root, programs lowered from a single root giving theirs
+	void eval_outputs(EvaluationContext& ioContext, const double* iFrame, double* oResults) const;
+	// Reads the clock before each instruction, which makes evaluating several times slower
+	double eval(EvaluationContext& ioContext, const double* iFrame, InstructionTimes& ioTimes) const;
+
+	ArrayView<Instruction> code() const { return m_code_view; }
+	ArrayView<double> numbers() const { return m_numbers_view; }
+	// String table: each literal once, copied by PushString without allocating
+	const std::vector<ResultType>& strings() const { return m_strings; }
+	const std::vector<ProgramFunction>& functions() const { return *m_functions; }
+	const std::vector<ProgramVariable>& variables() const { return *m_variables; }
+	const std::vector<ProgramLazyCall>& lazy_calls() const { return m_lazy_calls; }
+	// Size of the smallest frame holding every variable read by the program
+	size_t frame_size() const;
+	size_t number_stack_size() const { return m_number_stack_size; }
+	size_t value_stack_size() const { return m_value_stack_size; }
+	bool boxed_result() const { return m_boxed_result; }
+	size_t number_locals() const { return m_number_locals; }
+	size_t value_locals() const { return m_value_locals; }
+	// Empty for programs lowered from a single root
+	const std::vector<ProgramOutput>& outputs() const { return m_outputs; }
+	// Source of each instruction, for programs lowered from a tree keeping spans
+	const std::vector<SourceSpan>& spans() const { return m_spans; }
+
+private:
+	friend struct ProgramLowering;
+	friend class ProgramBundle;
+	explicit Program(const std::shared_ptr<const void>& iImage);
+	Program(const Program&);
+	Program& operator= (const Program&);
+	void lower(const SyntaxTree& iTree, const std::vector<std::uint32_t>& iRoots);
+
+	std::vector<Instruction> m_code;
+	std::vector<double> m_numbers;
+	std::vector<ResultType> m_strings;
+	std::shared_ptr< const std::vector<ProgramFunction> > m_functions;
+	std::shared_ptr< const std::vector<ProgramVariable> > m_variables;
+	std::vector<ProgramLazyCall> m_lazy_calls;
+	size_t m_number_stack_size;
+	size_t m_value_stack_size;
+	size_t m_number_locals;
+	size_t m_value_locals;
+	bool m_boxed_result;
+	std::vector<ProgramOutput> m_outputs;
+	std::vector<SourceSpan> m_spans;
+	ArrayView<Instruction> m_code_view;    // Over m_code, or over the image of a bundle
+	ArrayView<double> m_numbers_view;
+	std::shared_ptr<const void> m_image;   // Keeps the bundle mapped while the program lives
+};
+
+/** Runtime state of evaluations: stacks and locals, kept between evaluations.
+ *
+ * Once the stacks have grown to the needs of a program, evaluating it does not
+ * allocate: numbers never leave the number stack and functions read their
+ * arguments in place on the value stack. Batches run each instruction over
+ * blocks of rows at once, every stack slot then being a column.
+ *
+ * A context is used by one evaluation at a time: give each thread its own.
+ * Evaluations nested in a function call borrow a Nested context instead. */
+class EvaluationContext
+{
+public:
+	static const size_t BlockSize = 256;
+
+	// One context per thread and per nesting level, reused from one call to the next
+	class Nested
+	{
+	public:
+		Nested();
+		~Nested();
+		EvaluationContext& context() { return *m_context; }
+
+	private:
+		Nested(const Nested&);
+		Nested& operator= (const Nested&);
+		EvaluationContext* m_context;
+	};
+
+private:
+	friend class Program;
+	friend class NativeProgram;
+
+	void eval_batch(const Program& iProgram, const double* iFrame, const std::vector<Column>& iColumns, size_t iRows, double* oResults);
+	std::pair<double*, ResultType*> execute(const Program& iProgram, const double* iFrame, const ArgumentSpan* iArguments, size_t iRow = 0);
+	// The probe is told of each instruction before it runs, and of the end of the code.
+	// Resumes at instruction iStart when given, the first iNumbers and iValues slots of the stacks already filled.
+	template<typename Probe> std::pair<double*, ResultType*> execute(const Program& iProgram, const double* iFrame,
+		const ArgumentSpan* iArguments, size_t iRow, Probe& ioProbe, size_t iStart = 0, size_t iNumbers = 0, size_t iValues = 0);
+	void execute_block(const Program& iProgram, const double* iFrame, size_t iRow, size_t iCount, double* oResults);
+	void finish_block(const Program& iProgram, size_t iRow, size_t iCount, size_t iCall, size_t iFailed,
+		const ResultType& iResult, const double* iNumber, const double* iArguments, double* oResults);
+	void reserve_stacks(const Program& iProgram);
+
+	std::vector<double> m_numbers;
+	std::vector<ResultType> m_values;
+	std::vector<double> m_number_locals;
+	std::vector<ResultType> m_value_locals;
+	std::vector<double> m_columns;
+	std::vector<const double*> m_bound;
+	std::vector<const double*> m_bound_variables;
+	std::vector<double> m_row_frame;
+	std::vector<const double*> m_arguments;
+	std::vector<ResultType> m_row_arguments;
+	std::vector<ResultType> m_scalar_arguments;
+	std::vector<double> m_native_doubles;
+};
+
+}
+
+#endif /* CEP_PROGRAM_H_ */
@@ -0,0 +1,478 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#include "ProgramBundle.h"
+#include "Expression.h"
+#include "Parser.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CEP_BUNDLE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace CompactExpressionParser
+{
+
+namespace
+{
+	// File layout, every section starting on 8 bytes:
+	//   BundleHeader
+	//   BundleProgram[programs], then the programs sorted by name as uint32 indices
+	//   BundleText[functions], BundleText[variables] (by slot), BundleText[literals]
+	//   code and constants of each program
+	//   text: names and string literals, not terminated
+	// All offsets are counted from the start of the file.
+	const char Magic[8] = { 'C', 'E', 'P', 'B', 'N', 'D', 'L', '\0' };
+	const std::uint32_t ByteOrder = 0x01020304;
+
+	struct BundleHeader
+	{
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t byte_order;        // Written natively, files of the other byte order are refused
+		std::uint32_t instruction_size;
+		std::uint32_t programs;
+		std::uint32_t functions;
+		std::uint32_t variables;
+		std::uint32_t literals;
+		std::uint32_t reserved;
+		std::uint64_t programs_offset;
+		std::uint64_t index_offset;
+		std::uint64_t functions_offset;
+		std::uint64_t variables_offset;
+		std::uint64_t literals_offset;
+		std::uint64_t text_offset;
+		std::uint64_t text_size;
+		std::uint64_t size;
+	};
+
+	struct BundleText
+	{
+		std::uint32_t offset;            // In the text section
+		std::uint32_t size;
+	};
+
+	struct BundleProgram
+	{
+		BundleText name;
+		std::uint64_t code_offset;
+		std::uint64_t numbers_offset;
+		std::uint32_t code_size;
+		std::uint32_t numbers_size;
+		std::uint32_t literals_first;    // Literals of a program are consecutive
+		std::uint32_t literals_size;
+		std::uint32_t number_stack_size;
+		std::uint32_t value_stack_size;
+		std::uint32_t number_locals;
+		std::uint32_t value_locals;
+		std::uint32_t boxed_result;
+		std::uint32_t reserved;
+	};
+
+	size_t align(size_t iOffset) { return (iOffset + 7) & ~size_t(7); }
+
+	// Builds the file in memory, sections being appended at aligned offsets
+	class BundleImage
+	{
+	public:
+		template<typename T> size_t append(const T* iData, size_t iCount)
+		{
+			size_t offset = align(m_bytes.size());
+			m_bytes.resize(offset + iCount * sizeof(T));
+			if(iCount) std::memcpy(&m_bytes[offset], iData, iCount * sizeof(T));
+			return offset;
+		}
+		template<typename T> T& at(size_t iOffset) { return *reinterpret_cast<T*>(&m_bytes[iOffset]); }
+
+		BundleText text(const std::string& iText)
+		{
+			BundleText text = { static_cast<std::uint32_t>(m_text.size()), static_cast<std::uint32_t>(iText.size()) };
+			m_text.append(iText);
+			return text;
+		}
+		const std::string& text() const { return m_text; }
+		const std::vector<char>& bytes() const { return m_bytes; }
+
+	private:
+		std::vector<char> m_bytes;
+		std::string m_text;
+	};
+
+	// Bundle-wide index of a name, given in the order names are first met
+	std::uint32_t intern(const std::string& iName, std::map<std::string, std::uint32_t>& ioIndex, std::vector<std::string>& ioNames)
+	{
+		std::map<std::string, std::uint32_t>::const_iterator found = ioIndex.find(iName);
+		if(found != ioIndex.end()) return found->second;
+		ioNames.push_back(iName);
+		return ioIndex[iName] = static_cast<std::uint32_t>(ioNames.size() - 1);
+	}
+
+	// Unmapped once the bundle and every program loaded from it are gone
+	struct MappedFile
+	{
+		MappedFile() : data(nullptr), size(0) {}
+		~MappedFile()
+		{
+#ifdef CEP_BUNDLE_MMAP
+			if(data) munmap(data, size);
+#endif
+		}
+
+		void* data;
+		size_t size;
+		std::vector<double> buffer;  // Read in memory where files cannot be mapped, aligned for doubles
+	};
+
+	// Stack depths where jumps land, which every path reaching the instruction must agree on
+	class JumpTargets
+	{
+	public:
+		explicit JumpTargets(size_t iCodeSize) : m_depths(iCodeSize + 1, std::make_pair(Unreached, 0)) {}
+
+		// Jumps only go forward, and at most to the end of the code
+		bool jump(size_t iFrom, std::uint32_t iTo, size_t iNumbers, size_t iValues)
+		{
+			if(iTo <= iFrom || iTo >= m_depths.size()) return false;
+			if(m_depths[iTo].first == Unreached) m_depths[iTo] = std::make_pair(iNumbers, iValues);
+			return m_depths[iTo] == std::make_pair(iNumbers, iValues);
+		}
+
+		// Merges the depths jumps land with at iIndex with the ones of the previous instruction, if it falls through
+		bool land(size_t iIndex, bool& ioReached, size_t& ioNumbers, size_t& ioValues) const
+		{
+			if(m_depths[iIndex].first == Unreached) return ioReached;
+			if(ioReached && m_depths[iIndex] != std::make_pair(ioNumbers, ioValues)) return false;
+			ioNumbers = m_depths[iIndex].first;
+			ioValues = m_depths[iIndex].second;
+			return ioReached = true;
+		}
+
+	private:
+		static const size_t Unreached = ~size_t(0);
+		std::vector< std::pair<size_t, size_t> > m_depths;
+	};
+
+	const size_t JumpTargets::Unreached;
+
+	// Checks that a program keeps to its own constants, locals and stacks, and ends with a result
+	bool verify(const BundleProgram& iRecord, const Instruction* iCode, const BundleHeader& iHeader)
+	{
+		size_t numbers = 0, values = 0;
+		bool reached = true;
+		JumpTargets targets(iRecord.code_size);
+		for(const Instruction* instruction = iCode; instruction != iCode + iRecord.code_size; ++instruction)
+		{
+			std::uint32_t operand = instruction->operand;
+			size_t index = static_cast<size_t>(instruction - iCode);
+			if(!targets.land(index, reached, numbers, values)) return false;
+			switch(instruction->code)
+			{
+				case Instruction::PushNumber: if(operand >= iRecord.numbers_size) return false; ++numbers; break;
+				case Instruction::PushString: if(operand >= iRecord.literals_size) return false; ++values; break;
+				case Instruction::LoadVariable: if(operand >= iHeader.variables) return false; ++numbers; break;
+				case Instruction::Box: if(!numbers) return false; --numbers; ++values; break;
+				case Instruction::Unbox: if(!values) return false; --values; ++numbers; break;
+				case Instruction::StoreNumber: if(!numbers || operand >= iRecord.number_locals) return false; break;
+				case Instruction::LoadNumber: if(operand >= iRecord.number_locals) return false; ++numbers; break;
+				case Instruction::StoreValue: if(!values || operand >= iRecord.value_locals) return false; break;
+				case Instruction::LoadValue: if(operand >= iRecord.value_locals) return false; ++values; break;
+				case Instruction::LoadArgument: ++values; break;
+				case Instruction::Add: case Instruction::Sub: case Instruction::Mult: case Instruction::Divide: case Instruction::Power:
+				case Instruction::Less: case Instruction::LessEqual: case Instruction::Greater: case Instruction::GreaterEqual:
+				case Instruction::Equal: case Instruction::NotEqual:
+					if(numbers < 2) return false;
+					--numbers;
+					break;
+				case Instruction::Truth: if(!numbers) return false; break;
+				case Instruction::Jump:
+					if(!targets.jump(index, operand, numbers, values)) return false;
+					reached = false;
+					break;
+				case Instruction::JumpIfZero:
+					if(!numbers || !targets.jump(index, operand, numbers - 1, values)) return false;
+					--numbers;
+					break;
+				case Instruction::AndThen: case Instruction::OrElse:
+					if(!numbers || !targets.jump(index, operand, numbers, values)) return false;
+					--numbers;
+					break;
+				case Instruction::Call:
+					if(operand >= iHeader.functions || values < instruction->arity) return false;
+					values = values - instruction->arity + 1;
+					break;
+				default: return false;
+			}
+			if(numbers > iRecord.number_stack_size || values > iRecord.value_stack_size) return false;
+		}
+		if(!targets.land(iRecord.code_size, reached, numbers, values)) return false;
+		return iRecord.boxed_result ? values > 0 : numbers > 0;
+	}
+}
+
+bool BundleWriter::add(const std::string& iName, const std::shared_ptr<const Program>& iProgram)
+{
+	if(!iProgram->outputs().empty() || !iProgram->lazy_calls().empty() || !m_names.insert(std::make_pair(iName, m_programs.size())).second) return false;
+	Entry entry = { iName, iProgram };
+	m_programs.push_back(entry);
+	return true;
+}
+
+bool BundleWriter::save(const std::string& iPath) const
+{
+	BundleImage image;
+	BundleHeader header;
+	std::memset(&header, 0, sizeof(header));
+	image.append(&header, 1);
+	std::vector<BundleProgram> records(m_programs.size());
+	size_t programs_offset = image.append(records.data(), records.size());
+
+	std::vector<std::uint32_t> index;
+	for(std::map<std::string, size_t>::const_iterator name = m_names.begin(); name != m_names.end(); ++name)
+		index.push_back(static_cast<std::uint32_t>(name->second));
+	size_t index_offset = image.append(index.data(), index.size());
+
+	// Operands are renumbered over the whole bundle: functions and variables by name, literals by position
+	std::map<std::string, std::uint32_t> function_index, variable_index;
+	std::vector<std::string> functions, variables, literals;
+	for(size_t program = 0; program < m_programs.size(); ++program)
+	{
+		const Program& source = *m_programs[program].program;
+		std::map<std::uint32_t, std::uint32_t> slots;
+		for(const ProgramVariable& variable : source.variables()) slots[variable.slot] = intern(variable.name, variable_index, variables);
+		std::vector<std::uint32_t> calls;
+		for(const ProgramFunction& function : source.functions()) calls.push_back(intern(function.name, function_index, functions));
+
+		std::vector<Instruction> code(source.code().begin(), source.code().end());
+		for(Instruction& instruction : code)
+		{
+			if(instruction.code == Instruction::LoadVariable) instruction.operand = slots[instruction.operand];
+			else if(instruction.code == Instruction::Call) instruction.operand = calls[instruction.operand];
+		}
+
+		BundleProgram& record = records[program];
+		record.name = image.text(m_programs[program].name);
+		record.code_offset = image.append(code.data(), code.size());
+		record.code_size = static_cast<std::uint32_t>(code.size());
+		record.numbers_offset = image.append(source.numbers().data(), source.numbers().size());
+		record.numbers_size = static_cast<std::uint32_t>(source.numbers().size());
+		record.literals_first = static_cast<std::uint32_t>(literals.size());
+		record.literals_size = static_cast<std::uint32_t>(source.strings().size());
+		for(const ResultType& literal : source.strings()) literals.push_back(literal);
+		record.number_stack_size = static_cast<std::uint32_t>(source.number_stack_size());
+		record.value_stack_size = static_cast<std::uint32_t>(source.value_stack_size());
+		record.number_locals = static_cast<std::uint32_t>(source.number_locals());
+		record.value_locals = static_cast<std::uint32_t>(source.value_locals());
+		record.boxed_result = source.boxed_result();
+		record.reserved = 0;
+	}
+
+	std::vector<BundleText> texts;
+	for(const std::string& name : functions) texts.push_back(image.text(name));
+	size_t functions_offset = image.append(texts.data(), texts.size());
+	texts.clear();
+	for(const std::string& name : variables) texts.push_back(image.text(name));
+	size_t variables_offset = image.append(texts.data(), texts.size());
+	texts.clear();
+	for(const std::string& literal : literals) texts.push_back(image.text(literal));
+	size_t literals_offset = image.append(texts.data(), texts.size());
+	size_t text_offset = image.append(image.text().data(), image.text().size());
+
+	std::memcpy(header.magic, Magic, sizeof(Magic));
+	header.version = ProgramBundle::Version;
+	header.byte_order = ByteOrder;
+	header.instruction_size = sizeof(Instruction);
+	header.programs = static_cast<std::uint32_t>(m_programs.size());
+	header.functions = static_cast<std::uint32_t>(functions.size());
+	header.variables = static_cast<std::uint32_t>(variables.size());
+	header.literals = static_cast<std::uint32_t>(literals.size());
+	header.programs_offset = programs_offset;
+	header.index_offset = index_offset;
+	header.functions_offset = functions_offset;
+	header.variables_offset = variables_offset;
+	header.literals_offset = literals_offset;
+	header.text_offset = text_offset;
+	header.text_size = image.text().size();
+	header.size = image.bytes().size();
+	image.at<BundleHeader>(0) = header;
+	for(size_t program = 0; program < records.size(); ++program)
+		image.at<BundleProgram>(programs_offset + program * sizeof(BundleProgram)) = records[program];
+
+	std::ofstream out(iPath.c_str(), std::ios::binary | std::ios::trunc);
+	out.write(image.bytes().data(), image.bytes().size());
+	return static_cast<bool>(out.flush());
+}
+
+ProgramBundle::ProgramBundle() : m_data(nullptr), m_size(0), m_index(nullptr) {}
+
+bool ProgramBundle::map(const std::string& iPath)
+{
+	std::shared_ptr<MappedFile> file(new MappedFile);
+#ifdef CEP_BUNDLE_MMAP
+	int fd = open(iPath.c_str(), O_RDONLY);
+	if(fd < 0) return false;
+	struct stat status;
+	if(fstat(fd, &status) != 0 || status.st_size < static_cast<off_t>(sizeof(BundleHeader)))
+	{
+		close(fd);
+		return false;
+	}
+	file->size = static_cast<size_t>(status.st_size);
+	void* data = mmap(nullptr, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED) return false;
+	file->data = data;
+	m_data = static_cast<const char*>(data);
+#else
+	std::ifstream in(iPath.c_str(), std::ios::binary | std::ios::ate);
+	if(!in) return false;
+	file->size = static_cast<size_t>(in.tellg());
+	if(file->size < sizeof(BundleHeader)) return false;
+	file->buffer.resize(file->size / sizeof(double) + 1);
+	in.seekg(0);
+	if(!in.read(reinterpret_cast<char*>(file->buffer.data()), file->size)) return false;
+	m_data = reinterpret_cast<const char*>(file->buffer.data());
+#endif
+	m_size = file->size;
+	m_image = file;
+	return true;
+}
+
+bool ProgramBundle::load(const std::string& iPath, const Expression& iFunctions)
+{
+	m_programs.clear();
+	m_variables = VariableSet();
+	m_image.reset();
+	m_data = nullptr; m_size = 0; m_index = nullptr;
+	if(map(iPath) && read(iFunctions)) return true;
+	m_programs.clear();
+	m_image.reset();
+	m_data = nullptr; m_size = 0; m_index = nullptr;
+	return false;
+}
+
+bool ProgramBundle::read(const Expression& iFunctions)
+{
+	const BundleHeader& header = *reinterpret_cast<const BundleHeader*>(m_data);
+	if(std::memcmp(header.magic, Magic, sizeof(Magic)) || header.version != Version || header.byte_order != ByteOrder
+		|| header.instruction_size != sizeof(Instruction) || header.size != m_size)
+		return false;
+
+	// Every section must lie in the file, aligned for what it holds
+	struct Section { std::uint64_t offset; std::uint64_t bytes; };
+	const Section sections[] = {
+		{ header.programs_offset, std::uint64_t(header.programs) * sizeof(BundleProgram) },
+		{ header.index_offset, std::uint64_t(header.programs) * sizeof(std::uint32_t) },
+		{ header.functions_offset, std::uint64_t(header.functions) * sizeof(BundleText) },
+		{ header.variables_offset, std::uint64_t(header.variables) * sizeof(BundleText) },
+		{ header.literals_offset, std::uint64_t(header.literals) * sizeof(BundleText) },
+		{ header.text_offset, header.text_size } };
+	for(const Section& section : sections)
+		if(section.offset % 8 || section.offset > m_size || section.bytes > m_size - section.offset) return false;
+
+	const BundleProgram* records = reinterpret_cast<const BundleProgram*>(m_data + header.programs_offset);
+	const BundleText* texts[] = {
+		reinterpret_cast<const BundleText*>(m_data + header.functions_offset),
+		reinterpret_cast<const BundleText*>(m_data + header.variables_offset),
+		reinterpret_cast<const BundleText*>(m_data + header.literals_offset) };
+	const std::uint32_t counts[] = { header.functions, header.variables, header.literals };
+	for(size_t table = 0; table < 3; ++table)
+		for(std::uint32_t text = 0; text < counts[table]; ++text)
+			if(texts[table][text].offset > header.text_size || texts[table][text].size > header.text_size - texts[table][text].offset) return false;
+	const char* text = m_data + header.text_offset;
+
+	std::shared_ptr< std::vector<ProgramFunction> > functions(new std::vector<ProgramFunction>(header.functions));
+	for(std::uint32_t index = 0; index < header.functions; ++index)
+	{
+		ProgramFunction& function = (*functions)[index];
+		function.name.assign(text + texts[0][index].offset, texts[0][index].size);
+		const FunctionDefinition* definition = iFunctions.m_parser->findFunction(function.name);
+		if(!definition) return false;
+		function.definition = *definition;
+	}
+	std::shared_ptr< std::vector<ProgramVariable> > variables(new std::vector<ProgramVariable>(header.variables));
+	for(std::uint32_t slot = 0; slot < header.variables; ++slot)
+	{
+		ProgramVariable& variable = (*variables)[slot];
+		variable.name.assign(text + texts[1][slot].offset, texts[1][slot].size);
+		variable.slot = slot;
+		if(m_variables.declare(variable.name) != slot) return false;
+	}
+
+	m_index = reinterpret_cast<const std::uint32_t*>(m_data + header.index_offset);
+	m_programs.reserve(header.programs);
+	for(std::uint32_t index = 0; index < header.programs; ++index)
+	{
+		const BundleProgram& record = records[index];
+		if(m_index[index] >= header.programs || record.name.offset > header.text_size || record.name.size > header.text_size - record.name.offset
+			|| record.code_offset % 8 || record.numbers_offset % 8
+			|| record.code_offset > m_size || std::uint64_t(record.code_size) * sizeof(Instruction) > m_size - record.code_offset
+			|| record.numbers_offset > m_size || std::uint64_t(record.numbers_size) * sizeof(double) > m_size - record.numbers_offset
+			|| record.literals_first > header.literals || record.literals_size > header.literals - record.literals_first)
+			return false;
+		const Instruction* code = reinterpret_cast<const Instruction*>(m_data + record.code_offset);
+		if(!verify(record, code, header)) return false;
+
+		std::shared_ptr<Program> program(new Program(m_image));
+		program->m_code_view = ArrayView<Instruction>(code, record.code_size);
+		program->m_numbers_view = ArrayView<double>(reinterpret_cast<const double*>(m_data + record.numbers_offset), record.numbers_size);
+		for(std::uint32_t literal = record.literals_first; literal < record.literals_first + record.literals_size; ++literal)
+			program->m_strings.push_back(ResultType(text + texts[2][literal].offset, texts[2][literal].size));
+		program->m_functions = functions;
+		program->m_variables = variables;
+		program->m_number_stack_size = record.number_stack_size;
+		program->m_value_stack_size = record.value_stack_size;
+		program->m_number_locals = record.number_locals;
+		program->m_value_locals = record.value_locals;
+		program->m_boxed_result = record.boxed_result != 0;
+		m_programs.push_back(program);
+	}
+	return true;
+}
+
+std::string ProgramBundle::name(size_t iIndex) const
+{
+	const BundleHeader& header = *reinterpret_cast<const BundleHeader*>(m_data);
+	const BundleText& name = reinterpret_cast<const BundleProgram*>(m_data + header.programs_offset)[iIndex].name;
+	return std::string(m_data + header.text_offset + name.offset, name.size);
+}
+
+bool ProgramBundle::find(const std::string& iName, size_t& oIndex) const
+{
+	if(m_programs.empty()) return false;
+	const BundleHeader& header = *reinterpret_cast<const BundleHeader*>(m_data);
+	const BundleProgram* records = reinterpret_cast<const BundleProgram*>(m_data + header.programs_offset);
+	const char* text = m_data + header.text_offset;
+	// Compares the names in place, without building any string
+	const std::uint32_t* found = std::lower_bound(m_index, m_index + m_programs.size(), iName,
+		[records, text](std::uint32_t iProgram, const std::string& iWanted)
+		{
+			const BundleText& name = records[iProgram].name;
+			return iWanted.compare(0, std::string::npos, text + name.offset, name.size) > 0;
+		});
+	if(found == m_index + m_programs.size()) return false;
+	const BundleText& name = records[*found].name;
+	if(iName.compare(0, std::string::npos, text + name.offset, name.size) != 0) return false;
+	oIndex = *found;
+	return true;
+}
+
+double ProgramBundle::eval(size_t iIndex) { return m_programs[iIndex]->eval(m_context, m_variables.data()); }
+
+double ProgramBundle::eval(size_t iIndex, EvaluationContext& ioContext, const double* iFrame) const
+{
+	return m_programs[iIndex]->eval(ioContext, iFrame);
+}
+
+}
@@ -0,0 +1,95 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#ifndef CEP_PROGRAMBUNDLE_H_
+#define CEP_PROGRAMBUNDLE_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Program.h"
+#include "VariableSet.h"
+
+namespace CompactExpressionParser
+{
+
+class Expression;
+
+/** Collects compiled programs under a name and writes them to a bundle file.
+ *
+ * The file only holds offsets, never addresses. Functions are recorded by
+ * their registered name and variables by their name, slots being renumbered
+ * from 0 over the whole bundle in the order they are first met. */
+class BundleWriter
+{
+public:
+	// Fails when the name is already taken, or for programs of several outputs or calling lazy functions
+	bool add(const std::string& iName, const std::shared_ptr<const Program>& iProgram);
+	bool save(const std::string& iPath) const;
+	size_t size() const { return m_programs.size(); }
+
+private:
+	struct Entry
+	{
+		std::string name;
+		std::shared_ptr<const Program> program;
+	};
+
+	std::vector<Entry> m_programs;
+	std::map<std::string, size_t> m_names;
+};
+
+/** Programs loaded from a bundle file, evaluated in place.
+ *
+ * The file is mapped in memory and checked once: code and constants are then
+ * read from the mapping, without parsing anything nor copying any instruction.
+ * Functions are resolved by name among the ones registered in an expression,
+ * loading fails if one of them is missing. Variables have a frame of their own,
+ * shared by all the programs of the bundle.
+ *
+ * Programs returned by program() keep the mapping alive, and can be shared
+ * between threads like any other program. */
+class ProgramBundle
+{
+public:
+	static const std::uint32_t Version = 1;
+
+	ProgramBundle();
+	bool load(const std::string& iPath, const Expression& iFunctions);
+
+	size_t size() const { return m_programs.size(); }
+	std::string name(size_t iIndex) const;
+	bool find(const std::string& iName, size_t& oIndex) const;
+	const std::shared_ptr<const Program>& program(size_t iIndex) const { return m_programs[iIndex]; }
+
+	// Reads the variables from the frame of the bundle
+	double eval(size_t iIndex);
+	double eval(size_t iIndex, EvaluationContext& ioContext, const double* iFrame) const;
+	VariableSet& variables() { return m_variables; }
+
+private:
+	ProgramBundle(const ProgramBundle&);
+	ProgramBundle& operator= (const ProgramBundle&);
+
+	bool map(const std::string& iPath);
+	bool read(const Expression& iFunctions);
+
+	std::shared_ptr<const void> m_image;
+	const char* m_data;
+	size_t m_size;
+	const std::uint32_t* m_index;  // Programs sorted by name
+	std::vector< std::shared_ptr<const Program> > m_programs;
+	VariableSet m_variables;
+	EvaluationContext m_context;
+};
+
+}
+
+#endif /* CEP_PROGRAMBUNDLE_H_ */
@@ -0,0 +1,243 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#ifndef CEP_STATICEXPRESSION_HPP_
+#define CEP_STATICEXPRESSION_HPP_
+
+#include <cstddef>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Operators.h"
+
+/** Expressions known when building, written as C++ expression templates.
+ *
+ * The operators build a tree of types evaluated by inline calls only, through
+ * the same operator tags as the syntax tree, so the compiler can fold, inline and
+ * vectorize the whole formula:
+ *
+ *   CEP_VARIABLE(x, 0);
+ *   CEP_VARIABLE(y, 1);
+ *   auto f = CEP_EXPR(4 + 3*x - y);
+ *   double r = f.eval(1.5, 2.);
+ *
+ * Variables are read from a frame at their index. C++ has no right associative
+ * power operator of the right precedence, use power(a, b) instead of a^b.
+ * Operations between two plain numbers stay C++ ones: 3/2 is an integer division.
+ * Functions are plain callables taking and returning doubles; they may be called
+ * in any order, like pure functions.
+ *
+ * source() writes the expression in the syntax of Expression, so that both can
+ * be checked against each other, functions being registered under their name. */
+
+namespace CompactExpressionParser
+{
+namespace Static
+{
+
+struct Node {};
+template<typename T> struct IsNode : std::is_base_of<Node, T> {};
+
+template<typename T> struct Symbol;
+template<> struct Symbol<add> { static char value() { return '+'; } };
+template<> struct Symbol<sub> { static char value() { return '-'; } };
+template<> struct Symbol<mult> { static char value() { return '*'; } };
+template<> struct Symbol<divide> { static char value() { return '/'; } };
+template<> struct Symbol<power> { static char value() { return '^'; } };
+
+typedef std::vector< std::pair<std::string, size_t> > VariableList;
+
+struct Constant : Node
+{
+	explicit Constant(double iValue) : value(iValue) {}
+	double operator()(const double*) const { return value; }
+	double row(const double* const*, size_t) const { return value; }
+	void write(std::ostream& ioOut) const
+	{
+		std::ostringstream out;
+		out << std::setprecision(std::numeric_limits<double>::max_digits10) << value;
+		ioOut << '(' << out.str() << ')';
+	}
+	void variables(VariableList&) const {}
+
+	double value;
+};
+
+template<size_t N> struct Variable : Node
+{
+	explicit Variable(const char* iName) : name(iName) {}
+	double operator()(const double* iFrame) const { return iFrame[N]; }
+	double row(const double* const* iColumns, size_t iRow) const { return iColumns[N][iRow]; }
+	void write(std::ostream& ioOut) const { ioOut << name; }
+	void variables(VariableList& ioList) const
+	{
+		for(const std::pair<std::string, size_t>& known : ioList) if(known.second == N) return;
+		ioList.push_back(std::make_pair(std::string(name), N));
+	}
+
+	const char* name;
+};
+
+template<typename T, typename L, typename R> struct Binary : Node
+{
+	Binary(const L& iLeft, const R& iRight) : left(iLeft), right(iRight) {}
+	double operator()(const double* iFrame) const { return T::apply(left(iFrame), right(iFrame)); }
+	double row(const double* const* iColumns, size_t iRow) const { return T::apply(left.row(iColumns, iRow), right.row(iColumns, iRow)); }
+	void write(std::ostream& ioOut) const
+	{
+		ioOut << '(';
+		left.write(ioOut);
+		ioOut << Symbol<T>::value();
+		right.write(ioOut);
+		ioOut << ')';
+	}
+	void variables(VariableList& ioList) const { left.variables(ioList); right.variables(ioList); }
+
+	L left;
+	R right;
+};
+
+// Index sequences, to unpack the arguments of a call
+template<size_t... I> struct Indices {};
+template<size_t N, size_t... I> struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+template<size_t... I> struct MakeIndices<0, I...> { typedef Indices<I...> type; };
+
+template<typename F, typename... A> struct Call : Node
+{
+	typedef typename MakeIndices<sizeof...(A)>::type Arguments;
+
+	Call(const char* iName, const F& iFunction, const A&... iArgs) : name(iName), function(iFunction), args(iArgs...) {}
+	double operator()(const double* iFrame) const { return call(iFrame, Arguments()); }
+	double row(const double* const* iColumns, size_t iRow) const { return call_row(iColumns, iRow, Arguments()); }
+	void write(std::ostream& ioOut) const
+	{
+		ioOut << name << '(';
+		write_args(ioOut, Arguments());
+		ioOut << ')';
+	}
+	void variables(VariableList& ioList) const { variables(ioList, Arguments()); }
+
+	// Parameters are left unused by calls without arguments
+	template<size_t... I> double call(const double* iFrame, Indices<I...>) const
+	{
+		(void)iFrame;
+		return function(std::get<I>(args)(iFrame)...);
+	}
+	template<size_t... I> double call_row(const double* const* iColumns, size_t iRow, Indices<I...>) const
+	{
+		(void)iColumns; (void)iRow;
+		return function(std::get<I>(args).row(iColumns, iRow)...);
+	}
+	template<size_t... I> void write_args(std::ostream& ioOut, Indices<I...>) const
+	{
+		int expand[] = { 0, (ioOut << (I ? "," : ""), std::get<I>(args).write(ioOut), 0)... };
+		(void)expand; (void)ioOut;
+	}
+	template<size_t... I> void variables(VariableList& ioList, Indices<I...>) const
+	{
+		int expand[] = { 0, (std::get<I>(args).variables(ioList), 0)... };
+		(void)expand; (void)ioList;
+	}
+
+	const char* name;
+	F function;
+	std::tuple<A...> args;
+};
+
+// Numbers mixed with nodes become constants
+template<typename T, bool = IsNode<T>::value> struct Operand { typedef T type; static const T& wrap(const T& iNode) { return iNode; } };
+template<typename T> struct Operand<T, false> { typedef Constant type; static Constant wrap(double iValue) { return Constant(iValue); } };
+
+// Operators only take part when at least one side is a node, the other one being a node or a number
+template<typename T, typename L, typename R> struct EnableBinary
+	: std::enable_if<(IsNode<L>::value || IsNode<R>::value)
+		&& (IsNode<L>::value || std::is_arithmetic<L>::value)
+		&& (IsNode<R>::value || std::is_arithmetic<R>::value),
+		Binary<T, typename Operand<L>::type, typename Operand<R>::type> > {};
+
+#define CEP_STATIC_OPERATOR(iFunction, iTag) \
+	template<typename L, typename R> typename EnableBinary<iTag, L, R>::type iFunction(const L& iLeft, const R& iRight) \
+	{ return typename EnableBinary<iTag, L, R>::type(Operand<L>::wrap(iLeft), Operand<R>::wrap(iRight)); }
+
+CEP_STATIC_OPERATOR(operator+, ::CompactExpressionParser::add)
+CEP_STATIC_OPERATOR(operator-, ::CompactExpressionParser::sub)
+CEP_STATIC_OPERATOR(operator*, ::CompactExpressionParser::mult)
+CEP_STATIC_OPERATOR(operator/, ::CompactExpressionParser::divide)
+CEP_STATIC_OPERATOR(power, ::CompactExpressionParser::power)
+
+#undef CEP_STATIC_OPERATOR
+
+template<typename F> struct Function
+{
+	Function(const char* iName, const F& iFunction) : name(iName), function(iFunction) {}
+	template<typename... A> Call<F, typename Operand<A>::type...> operator()(const A&... iArgs) const
+	{
+		return Call<F, typename Operand<A>::type...>(name, function, Operand<A>::wrap(iArgs)...);
+	}
+
+	const char* name;
+	F function;
+};
+
+template<typename F> Function<F> make_function(const char* iName, const F& iFunction) { return Function<F>(iName, iFunction); }
+
+template<typename E> class StaticExpression
+{
+public:
+	explicit StaticExpression(const E& iRoot) : m_root(iRoot) {}
+
+	double operator()(const double* iFrame) const { return m_root(iFrame); }
+	// Variables given in the order of their indices
+	template<typename... A> double eval(A... iValues) const
+	{
+		const double frame[] = { 0., static_cast<double>(iValues)... };
+		return m_root(frame + 1);
+	}
+	// One column per variable index
+	void eval_columns(const double* const* iColumns, size_t iRows, double* oResults) const
+	{
+		for(size_t i = 0; i < iRows; ++i) oResults[i] = m_root.row(iColumns, i);
+	}
+
+	std::string source() const
+	{
+		std::ostringstream out;
+		m_root.write(out);
+		return out.str();
+	}
+	// Names and indices of the variables, to fill the variables of an Expression compiled from source()
+	VariableList variables() const
+	{
+		VariableList list;
+		m_root.variables(list);
+		return list;
+	}
+
+private:
+	E m_root;
+};
+
+template<typename E> StaticExpression<typename Operand<E>::type> make_expression(const E& iRoot)
+{
+	return StaticExpression<typename Operand<E>::type>(Operand<E>::wrap(iRoot));
+}
+
+}
+}
+
+#define CEP_VARIABLE(iName, iIndex) const ::CompactExpressionParser::Static::Variable<iIndex> iName(#iName)
+#define CEP_FUNCTION(iName, iCallable) const auto iName = ::CompactExpressionParser::Static::make_function(#iName, iCallable)
+#define CEP_EXPR(...) ::CompactExpressionParser::Static::make_expression(__VA_ARGS__)
+
+#endif /* CEP_STATICEXPRESSION_HPP_ */
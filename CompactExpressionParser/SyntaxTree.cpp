@@ -0,0 +1,305 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#include "SyntaxTree.h"
+#include "Operators.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace CompactExpressionParser
+{
+
+namespace
+{
+	// Heap bytes of a string, short strings being stored inline
+	size_t heap(const std::string& iString)
+	{
+		std::string empty;
+		return iString.capacity() > empty.capacity() ? iString.capacity() + 1 : 0;
+	}
+
+	// Longer strings share their characters, after a count of references and a size
+	size_t heap(const ResultType& iValue)
+	{
+		size_t size = iValue.StringView().size();
+		return size > ResultType::SmallCapacity ? size + 2 * sizeof(size_t) : 0;
+	}
+
+	template<typename T> size_t bytes(const std::vector<T>& iVector) { return iVector.capacity() * sizeof(T); }
+
+	// Each node of a hash map holds its value, the next node and the hash of the key
+	template<typename K, typename V> size_t bytes(const std::unordered_map<K, V>& iMap)
+	{
+		return iMap.bucket_count() * sizeof(void*) + iMap.size() * (sizeof(std::pair<const K, V>) + sizeof(void*) + sizeof(size_t));
+	}
+
+	// Arguments of a lazy function, walked when read
+	class TreeArguments : public LazyArguments
+	{
+	public:
+		TreeArguments(const ExpressionCalculator& iCalculator, const std::vector<std::uint32_t>& iRoots) : m_calculator(iCalculator), m_roots(iRoots) {}
+		size_t size() const { return m_roots.size(); }
+		ResultType operator[](size_t iIndex) const
+		{
+			if(iIndex >= m_roots.size()) throw std::out_of_range("Function argument");
+			return m_calculator.evaluate(m_roots[iIndex]);
+		}
+
+	private:
+		const ExpressionCalculator& m_calculator;
+		const std::vector<std::uint32_t>& m_roots;
+	};
+}
+
+void SyntaxTree::push(SyntaxNode::Kind iKind, std::uint32_t iOperand, std::uint32_t iSize, std::uint16_t iArity)
+{
+	SyntaxNode node = { static_cast<std::uint8_t>(iKind), 0, iArity, iOperand, iSize };
+	m_nodes.push_back(node);
+	if(m_spanned) m_spans.push_back(SourceSpan());
+}
+
+void SyntaxTree::truncate(std::uint32_t iFirst)
+{
+	m_nodes.resize(iFirst);
+	if(m_spanned) m_spans.resize(iFirst);
+}
+
+void SyntaxTree::erase(std::uint32_t iFirst, std::uint32_t iLast)
+{
+	m_nodes.erase(m_nodes.begin() + iFirst, m_nodes.begin() + iLast);
+	if(m_spanned) m_spans.erase(m_spans.begin() + iFirst, m_spans.begin() + iLast);
+}
+
+void SyntaxTree::index_pools()
+{
+	m_variable_index.clear();
+	for(std::uint32_t index = 0; index < m_variables.size(); ++index) m_variable_index.insert(std::make_pair(m_variables[index].slot, index));
+	m_function_index.clear();
+	for(std::uint32_t index = 0; index < m_functions.size(); ++index) m_function_index.insert(std::make_pair(m_functions[index].name, index));
+}
+
+void SyntaxTree::keep_spans()
+{
+	m_spanned = true;
+	m_spans.resize(m_nodes.size());
+}
+
+void SyntaxTree::push_number(double iValue)
+{
+	push(SyntaxNode::Number, static_cast<std::uint32_t>(m_numbers.size()), 1);
+	m_numbers.push_back(iValue);
+}
+
+void SyntaxTree::push_string(const ResultType& iValue)
+{
+	push(SyntaxNode::String, static_cast<std::uint32_t>(m_strings.size()), 1);
+	m_strings.push_back(iValue);
+}
+
+void SyntaxTree::push_variable(const std::string& iName, size_t iSlot)
+{
+	std::uint32_t slot = static_cast<std::uint32_t>(iSlot);
+	if(m_variable_index.size() != m_variables.size()) index_pools();
+	std::pair<std::unordered_map<std::uint32_t, std::uint32_t>::iterator, bool> found =
+		m_variable_index.insert(std::make_pair(slot, static_cast<std::uint32_t>(m_variables.size())));
+	if(found.second)
+	{
+		SyntaxVariable variable = { iName, slot };
+		m_variables.push_back(variable);
+	}
+	push(SyntaxNode::Variable, found.first->second, 1);
+}
+
+void SyntaxTree::push_argument(size_t iIndex)
+{
+	push(SyntaxNode::Argument, static_cast<std::uint32_t>(iIndex), 1);
+}
+
+void SyntaxTree::push_operation(SyntaxNode::Kind iKind)
+{
+	std::uint32_t right = root();
+	std::uint32_t left_root = left(right + 1);
+	push(iKind, 0, m_nodes[right].size + m_nodes[left_root].size + 1);
+	if(m_spanned)
+	{
+		SourceSpan span = { m_spans[left_root].begin, m_spans[right].end };
+		m_spans.back() = span;
+	}
+}
+
+void SyntaxTree::push_select()
+{
+	std::uint32_t otherwise = root();
+	std::uint32_t then = first(otherwise) - 1;
+	std::uint32_t condition = first(then) - 1;
+	push(SyntaxNode::Select, 0, m_nodes[condition].size + m_nodes[then].size + m_nodes[otherwise].size + 1, 3);
+	if(m_spanned)
+	{
+		SourceSpan span = { m_spans[condition].begin, m_spans[otherwise].end };
+		m_spans.back() = span;
+	}
+}
+
+void SyntaxTree::push_call(const std::string& iName, const FunctionDefinition& iDefinition, size_t iArity)
+{
+	if(m_function_index.size() != m_functions.size()) index_pools();
+	std::pair<std::unordered_map<std::string, std::uint32_t>::iterator, bool> found =
+		m_function_index.insert(std::make_pair(iName, static_cast<std::uint32_t>(m_functions.size())));
+	if(found.second)
+	{
+		SyntaxFunction function = { iName, iDefinition };
+		m_functions.push_back(function);
+	}
+	std::uint32_t size = 1;
+	for(size_t arg = 0; arg < iArity; ++arg) size += m_nodes[m_nodes.size() - size].size;
+	push(SyntaxNode::Call, found.first->second, size, static_cast<std::uint16_t>(iArity));
+}
+
+void SyntaxTree::append(const SyntaxTree& iTree)
+{
+	for(std::uint32_t index = 0; index < iTree.size(); ++index)
+	{
+		const SyntaxNode& node = iTree.node(index);
+		switch(node.kind)
+		{
+			case SyntaxNode::Number: push_number(iTree.number(index)); break;
+			case SyntaxNode::String: push_string(iTree.string(index)); break;
+			case SyntaxNode::Variable: push_variable(iTree.variable(index).name, iTree.variable(index).slot); break;
+			case SyntaxNode::Argument: push_argument(node.operand); break;
+			case SyntaxNode::Call: push_call(iTree.function(index).name, iTree.function(index).definition, node.arity); break;
+			case SyntaxNode::Select: push_select(); break;
+			default: push_operation(static_cast<SyntaxNode::Kind>(node.kind));
+		}
+		if(iTree.has_spans()) set_span(root(), iTree.span(index));
+	}
+}
+
+void SyntaxTree::arguments(std::uint32_t iIndex, std::vector<std::uint32_t>& oArguments) const
+{
+	oArguments.resize(m_nodes[iIndex].arity);
+	std::uint32_t last = iIndex;
+	for(size_t arg = oArguments.size(); arg > 0; --arg)
+	{
+		oArguments[arg - 1] = last - 1;
+		last = first(last - 1);
+	}
+}
+
+bool SyntaxTree::is_lazy(std::uint32_t iIndex) const
+{
+	switch(m_nodes[iIndex].kind)
+	{
+		case SyntaxNode::And: case SyntaxNode::Or: case SyntaxNode::Select: return true;
+		case SyntaxNode::Call: return static_cast<bool>(function(iIndex).definition.lazy);
+		default: return false;
+	}
+}
+
+bool SyntaxTree::is_boxed(std::uint32_t iIndex) const
+{
+	switch(m_nodes[iIndex].kind)
+	{
+		case SyntaxNode::String: case SyntaxNode::Argument: case SyntaxNode::Call: return true;
+		case SyntaxNode::Select: return is_boxed(iIndex - 1) || is_boxed(first(iIndex - 1) - 1);
+		default: return false;
+	}
+}
+
+const std::uint32_t SyntaxTree::Unguarded;
+
+// Parents come after their operands: going down from the root, the guard of each node is known before its operands
+void SyntaxTree::guards(std::vector<std::uint32_t>& oGuards) const
+{
+	oGuards.assign(m_nodes.size(), Unguarded);
+	std::vector<std::uint32_t> operands;
+	for(std::uint32_t index = static_cast<std::uint32_t>(m_nodes.size()); index-- > 0;)
+	{
+		const SyntaxNode& node = m_nodes[index];
+		if(node.kind < SyntaxNode::Add) continue;
+		if(node.kind == SyntaxNode::Call || node.kind == SyntaxNode::Select) arguments(index, operands);
+		else
+		{
+			operands.assign(1, left(index));
+			operands.push_back(right(index));
+		}
+		bool lazy = is_lazy(index);
+		for(size_t operand = 0; operand < operands.size(); ++operand)
+		{
+			bool guarded = lazy && (node.kind == SyntaxNode::Call || operand > 0);
+			oGuards[operands[operand]] = oGuards[index] != Unguarded ? oGuards[index] : guarded ? index : Unguarded;
+		}
+	}
+}
+
+size_t SyntaxTree::memory() const
+{
+	size_t total = bytes(m_nodes) + bytes(m_numbers) + bytes(m_strings) + bytes(m_variables) + bytes(m_functions) + bytes(m_spans);
+	for(const ResultType& value : m_strings) total += heap(value);
+	for(const SyntaxVariable& variable : m_variables) total += heap(variable.name);
+	for(const SyntaxFunction& function : m_functions) total += heap(function.name);
+	total += bytes(m_variable_index) + bytes(m_function_index);
+	for(const std::pair<const std::string, std::uint32_t>& function : m_function_index) total += heap(function.first);
+	return total;
+}
+
+void SyntaxTree::compact()
+{
+	m_nodes.shrink_to_fit();
+	m_numbers.shrink_to_fit();
+	m_strings.shrink_to_fit();
+	m_variables.shrink_to_fit();
+	m_functions.shrink_to_fit();
+	m_spans.shrink_to_fit();
+	std::unordered_map<std::uint32_t, std::uint32_t>().swap(m_variable_index);
+	std::unordered_map<std::string, std::uint32_t>().swap(m_function_index);
+}
+
+ResultType ExpressionCalculator::evaluate(std::uint32_t iIndex) const
+{
+	const SyntaxNode& node = m_tree.node(iIndex);
+	switch(node.kind)
+	{
+		case SyntaxNode::Number: return m_tree.number(iIndex);
+		case SyntaxNode::String: return m_tree.string(iIndex);
+		case SyntaxNode::Variable: return m_frame[m_tree.variable(iIndex).slot];
+		case SyntaxNode::Argument:
+			if(!m_arguments || node.operand >= m_arguments->size()) throw std::out_of_range("Function argument");
+			return (*m_arguments)[node.operand];
+		case SyntaxNode::Add: return add::apply(evaluate(m_tree.left(iIndex)), evaluate(m_tree.right(iIndex)));
+		case SyntaxNode::Sub: return sub::apply(evaluate(m_tree.left(iIndex)), evaluate(m_tree.right(iIndex)));
+		case SyntaxNode::Mult: return mult::apply(evaluate(m_tree.left(iIndex)), evaluate(m_tree.right(iIndex)));
+		case SyntaxNode::Divide: return divide::apply(evaluate(m_tree.left(iIndex)), evaluate(m_tree.right(iIndex)));
+		case SyntaxNode::Power: return power::apply(evaluate(m_tree.left(iIndex)), evaluate(m_tree.right(iIndex)));
+		case SyntaxNode::Less: return less::apply(evaluate(m_tree.left(iIndex)), evaluate(m_tree.right(iIndex)));
+		case SyntaxNode::LessEqual: return less_equal::apply(evaluate(m_tree.left(iIndex)), evaluate(m_tree.right(iIndex)));
+		case SyntaxNode::Greater: return greater::apply(evaluate(m_tree.left(iIndex)), evaluate(m_tree.right(iIndex)));
+		case SyntaxNode::GreaterEqual: return greater_equal::apply(evaluate(m_tree.left(iIndex)), evaluate(m_tree.right(iIndex)));
+		case SyntaxNode::Equal: return equal::apply(evaluate(m_tree.left(iIndex)), evaluate(m_tree.right(iIndex)));
+		case SyntaxNode::NotEqual: return not_equal::apply(evaluate(m_tree.left(iIndex)), evaluate(m_tree.right(iIndex)));
+		case SyntaxNode::And: return truth(evaluate(m_tree.left(iIndex))) && truth(evaluate(m_tree.right(iIndex))) ? 1. : 0.;
+		case SyntaxNode::Or: return truth(evaluate(m_tree.left(iIndex))) || truth(evaluate(m_tree.right(iIndex))) ? 1. : 0.;
+		case SyntaxNode::Select:
+		{
+			std::uint32_t otherwise = iIndex - 1, then = m_tree.first(otherwise) - 1;
+			return evaluate(truth(evaluate(m_tree.first(then) - 1)) ? then : otherwise);
+		}
+		default:
+		{
+			std::vector<std::uint32_t> roots;
+			m_tree.arguments(iIndex, roots);
+			const FunctionDefinition& definition = m_tree.function(iIndex).definition;
+			if(definition.lazy) return definition.lazy(TreeArguments(*this, roots));
+			std::vector<ResultType> args;
+			for(std::uint32_t arg : roots) args.push_back(evaluate(arg));
+			return definition.span ? definition.span(ArgumentSpan(args.data(), args.size())) : definition.func(args);
+		}
+	}
+}
+
+}
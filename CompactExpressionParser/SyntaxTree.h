@@ -0,0 +1,157 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#ifndef CEP_SYNTAXTREE_H_
+#define CEP_SYNTAXTREE_H_
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Interfaces.h"
+
+namespace CompactExpressionParser
+{
+
+struct SyntaxNode
+{
+	// Select is the condition, then the two branches. And, Or and Select compute some of their operands only.
+	enum Kind { Number, String, Variable, Argument, Add, Sub, Mult, Divide, Power, Call,
+		Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual, And, Or, Select };
+
+	std::uint8_t kind;
+	std::uint8_t reserved;
+	std::uint16_t arity;    // Call and Select only
+	std::uint32_t operand;  // Index in the numbers, strings, variables or functions of the tree, or argument index
+	std::uint32_t size;     // Nodes of the subtree rooted here, itself included
+};
+
+struct SyntaxVariable
+{
+	std::string name;
+	std::uint32_t slot;
+};
+
+struct SyntaxFunction
+{
+	std::string name;
+	FunctionDefinition definition;
+};
+
+/** Syntax tree stored as a few flat arrays, indexed with 32 bits.
+ *
+ * Nodes are laid out in postfix order, children before their parent and the root
+ * last, each one knowing the size of its subtree: the right operand of a node is
+ * the node just before it, the left operand the one before the right subtree.
+ * Literals, variables and functions live in pools shared by all the nodes, a
+ * function being stored once whatever the number of calls.
+ *
+ * Building a tree costs a handful of allocations, and one more for each distinct
+ * variable and function indexed while pushing; compacting it drops these indexes.
+ * A tree is never changed once compiled: copies of an expression share it.
+ *
+ * Trees parsed for profiling also keep the span of source text of each node,
+ * operations spanning their operands. */
+class SyntaxTree
+{
+public:
+	SyntaxTree() : m_spanned(false) {}
+
+	// Leaves
+	void push_number(double iValue);
+	// Literals are built once here, evaluations copying them without allocating
+	void push_string(const ResultType& iValue);
+	void push_variable(const std::string& iName, size_t iSlot);
+	void push_argument(size_t iIndex);
+	// Operations take the two subtrees on top, selections the three ones, calls the last iArity ones
+	void push_operation(SyntaxNode::Kind iKind);
+	void push_select();
+	void push_call(const std::string& iName, const FunctionDefinition& iDefinition, size_t iArity);
+	// Pushes the whole of another tree, its root becoming the new root
+	void append(const SyntaxTree& iTree);
+	// Records a span for each node pushed from now on, spans of leaves and calls being set by the caller
+	void keep_spans();
+	void set_span(std::uint32_t iIndex, SourceSpan iSpan) { if(m_spanned) m_spans[iIndex] = iSpan; }
+
+	size_t size() const { return m_nodes.size(); }
+	bool empty() const { return m_nodes.empty(); }
+	std::uint32_t root() const { return static_cast<std::uint32_t>(m_nodes.size() - 1); }
+	const SyntaxNode& node(std::uint32_t iIndex) const { return m_nodes[iIndex]; }
+	std::uint32_t first(std::uint32_t iIndex) const { return iIndex + 1 - m_nodes[iIndex].size; }
+	std::uint32_t right(std::uint32_t iIndex) const { return iIndex - 1; }
+	std::uint32_t left(std::uint32_t iIndex) const { return first(iIndex - 1) - 1; }
+	// Roots of the arguments of a call, or of the operands of a Select, in order
+	void arguments(std::uint32_t iIndex, std::vector<std::uint32_t>& oArguments) const;
+	// And, Or, Select, and calls to lazy functions
+	bool is_lazy(std::uint32_t iIndex) const;
+	// Whether the result may be a string: literals, arguments, calls and selections among them
+	bool is_boxed(std::uint32_t iIndex) const;
+	// By node, the outermost lazy node computing it only when needed, or Unguarded for nodes always computed.
+	// Operands of And, Or and Select past the first, and arguments of lazy functions, are guarded.
+	void guards(std::vector<std::uint32_t>& oGuards) const;
+	static const std::uint32_t Unguarded = 0xFFFFFFFF;
+
+	double number(std::uint32_t iIndex) const { return m_numbers[m_nodes[iIndex].operand]; }
+	const ResultType& string(std::uint32_t iIndex) const { return m_strings[m_nodes[iIndex].operand]; }
+	const SyntaxVariable& variable(std::uint32_t iIndex) const { return m_variables[m_nodes[iIndex].operand]; }
+	const SyntaxFunction& function(std::uint32_t iIndex) const { return m_functions[m_nodes[iIndex].operand]; }
+	const std::vector<SyntaxVariable>& variables() const { return m_variables; }
+	const std::vector<SyntaxFunction>& functions() const { return m_functions; }
+	bool has_spans() const { return m_spanned; }
+	SourceSpan span(std::uint32_t iIndex) const { return m_spans[iIndex]; }
+
+	// Bytes held by the tree, its pools included
+	size_t memory() const;
+	// Releases the capacity left over by building, and the indexes of the pools
+	void compact();
+
+private:
+	friend class TreeFolder;
+
+	void push(SyntaxNode::Kind iKind, std::uint32_t iOperand, std::uint32_t iSize, std::uint16_t iArity = 0);
+	// Drops the nodes from iFirst on, and the ones in [iFirst, iLast)
+	void truncate(std::uint32_t iFirst);
+	void erase(std::uint32_t iFirst, std::uint32_t iLast);
+	// Builds the indexes again when the pools were compacted or copied without them
+	void index_pools();
+
+	std::vector<SyntaxNode> m_nodes;
+	std::vector<double> m_numbers;
+	std::vector<ResultType> m_strings;
+	std::vector<SyntaxVariable> m_variables;
+	std::vector<SyntaxFunction> m_functions;
+	std::vector<SourceSpan> m_spans;  // By node, when m_spanned
+	// Positions in m_variables by slot and in m_functions by name, so that pushing is constant time
+	std::unordered_map<std::uint32_t, std::uint32_t> m_variable_index;
+	std::unordered_map<std::string, std::uint32_t> m_function_index;
+	bool m_spanned;
+};
+
+/** Evaluates a syntax tree by walking it, kept as a reference for the other backends.
+ *
+ * Operands of And, Or and Select, and arguments of lazy functions, are only
+ * computed when needed. */
+class ExpressionCalculator
+{
+public:
+	ExpressionCalculator(const SyntaxTree& iTree, const double* iFrame = nullptr, const ArgumentSpan* iArguments = nullptr)
+	: m_tree(iTree), m_frame(iFrame), m_arguments(iArguments) {}
+
+	ResultType operator()() const { return evaluate(m_tree.root()); }
+	ResultType evaluate(std::uint32_t iIndex) const;
+
+private:
+	const SyntaxTree& m_tree;
+	const double* m_frame;
+	const ArgumentSpan* m_arguments;
+};
+
+}
+
+#endif /* CEP_SYNTAXTREE_H_ */
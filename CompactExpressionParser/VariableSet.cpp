@@ -0,0 +1,32 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#include "VariableSet.h"
+
+namespace CompactExpressionParser
+{
+
+size_t VariableSet::declare(const std::string& iName)
+{
+	std::map<std::string, size_t>::const_iterator found = m_slots.find(iName);
+	if(found != m_slots.end()) return found->second;
+	m_slots.insert(std::make_pair(iName, m_values.size()));
+	m_names.push_back(iName);
+	m_values.push_back(0.);
+	return m_values.size() - 1;
+}
+
+bool VariableSet::find(const std::string& iName, size_t& oSlot) const
+{
+	std::map<std::string, size_t>::const_iterator found = m_slots.find(iName);
+	if(found == m_slots.end()) return false;
+	oSlot = found->second;
+	return true;
+}
+
+}
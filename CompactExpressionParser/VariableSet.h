@@ -0,0 +1,45 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#ifndef CEP_VARIABLESET_H_
+#define CEP_VARIABLESET_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace CompactExpressionParser
+{
+
+/** Names the slots of a frame of doubles.
+ *
+ * Compiling an expression resolves each variable to its slot, declaring the
+ * unknown ones once it parsed, so reading a variable is a single indexed load
+ * at runtime.
+ * data() is such a frame; any other array laid out by slot can be used instead. */
+class VariableSet
+{
+public:
+	size_t declare(const std::string& iName);
+	bool find(const std::string& iName, size_t& oSlot) const;
+	const std::string& name(size_t iSlot) const { return m_names[iSlot]; }
+
+	double& operator[](const std::string& iName) { return m_values[declare(iName)]; }
+	double& at(size_t iSlot) { return m_values[iSlot]; }
+	const double* data() const { return m_values.data(); }
+	size_t size() const { return m_values.size(); }
+
+private:
+	std::map<std::string, size_t> m_slots;
+	std::vector<std::string> m_names;
+	std::vector<double> m_values;
+};
+
+}
+
+#endif /* CEP_VARIABLESET_H_ */
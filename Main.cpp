@@ -11,6 +11,8 @@
 #include <vector>
 #include <cmath>
 #include <CompactExpressionParser/Expression.h>
+#include <CompactExpressionParser/IncrementalEvaluator.h>
+#include <CompactExpressionParser/StaticExpression.hpp>
 #include <boost/format.hpp>
 #include <boost/shared_ptr.hpp>
 #include <functional>
@@ -46,7 +48,7 @@ struct UserArg
 // Using strings
 struct Print { 
   ResultType operator()(const std::vector<ResultType>& args) { 
-    std::cout << std::string(args[0]) << std::endl;
+    std::cout << args[0].StringView() << std::endl;
     return 0.;
   } 
 };
@@ -91,10 +93,11 @@ int main()
 	cep_add_example(index_example,"Using some additional functions");
 	{
 		Expression exp;
-		exp.register_function("Pi", Pi() );
-		exp.register_function("cos", Cosinus() );
-		exp.register_function("sin", Sinus() );
-		exp.register_function("atan2", Arctan2() );
+		// Pure functions called with constant arguments are evaluated once, when compiling
+		exp.register_function("Pi", Pi(), Pure );
+		exp.register_function("cos", Cosinus(), Pure );
+		exp.register_function("sin", Sinus(), Pure );
+		exp.register_function("atan2", Arctan2(), Pure );
 
 		exp.compile("sin(Pi()/2)");
 		cep_example_output(index_example, exp() );
@@ -165,10 +168,11 @@ int main()
 	{
 		Expression exp;
 
-		RuntimeFunction f1(exp,"MyFunc1");
+		// Pure functions are inlined by the expressions calling them
+		RuntimeFunction f1(exp,"MyFunc1",Pure);
 		f1.compile("_1 * _2");
 
-		RuntimeFunction f2(exp,"MyFunc2");
+		RuntimeFunction f2(exp,"MyFunc2",Pure);
 		f2.compile("_1 - _2*_3");
 
 		exp.compile("MyFunc1(2,2) + MyFunc2(10,2,3)");
@@ -190,6 +194,80 @@ int main()
 		cep_example_output(index_example, status ? 1. : 0.);
 		cep_example_output(index_example, exp());
 	}
+
+	cep_add_example(index_example, "Using variables");
+	{
+		// Variables are plain names, each one is given a slot when compiling
+		Expression exp;
+		exp.compile("4 + 3*x - y");
+		VariableSet& vars = exp.variables();
+		vars["x"] = 2.; vars["y"] = 5.;
+		cep_example_output(index_example, exp() );
+
+		// Any frame laid out by slots can be used as well
+		double frame[2];
+		size_t x_slot, y_slot;
+		vars.find("x", x_slot); vars.find("y", y_slot);
+		frame[x_slot] = 3.; frame[y_slot] = 1.;
+		cep_example_output(index_example, exp.eval(frame) );
+	}
+	cep_add_example(index_example, "Expressions known when building");
+	{
+		// Expression templates, evaluated without any parsing nor interpretation
+		CEP_VARIABLE(x, 0);
+		CEP_VARIABLE(y, 1);
+		auto formula = CEP_EXPR(4 + 3*x - y);
+		cep_example_output(index_example, formula.eval(2., 5.) );
+
+		// Their source can be compiled as well, giving the same results
+		Expression exp;
+		exp.compile(formula.source());
+		exp.variables()["x"] = 2.; exp.variables()["y"] = 5.;
+		cep_example_output(index_example, exp() );
+	}
+	cep_add_example(index_example, "Evaluating again what changed only");
+	{
+		UserArg arg;
+		Expression exp;
+		exp.register_function("Arg", std::ref(arg));
+		exp.compile("4 + 3*x - y*Arg()");
+		IncrementalEvaluator incremental(exp);
+		incremental.set("x", 2.); incremental.set("y", 5.); arg = 1.;
+		cep_example_output(index_example, incremental.eval() );
+
+		// Only 3*x and the operations above it are computed again
+		incremental.set("x", 3.);
+		cep_example_output(index_example, incremental.eval() );
+
+		// Functions are not called again unless told so
+		arg = 2.;
+		incremental.invalidate("Arg");
+		cep_example_output(index_example, incremental.eval() );
+	}
+	cep_add_example(index_example, "Conditions");
+	{
+		UserArg arg;
+		Expression exp;
+		exp.register_function("Arg", std::ref(arg));
+		exp.variables()["x"] = 2.;
+		// Comparisons give 1 or 0, the branch not taken is not computed
+		exp.compile("x > 1 ? 10 : Arg()");
+		cep_example_output(index_example, exp() );
+		exp.compile("if(x <= 1 || x == 3, 4*x, x/4)");
+		cep_example_output(index_example, exp() );
+
+		// Lazy functions compute their arguments when they read them
+		exp.register_function("first_positive", LazyFunctionType([](const LazyArguments& args) {
+			for(size_t index = 0; index < args.size(); ++index)
+			{
+				ResultType value = args[index];
+				if(double(value) > 0.) return value;
+			}
+			return ResultType(0.);
+		}));
+		exp.compile("first_positive(x - 3, x - 1, Arg())");
+		cep_example_output(index_example, exp() );
+	}
 	return 0;
 }
 
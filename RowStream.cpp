@@ -0,0 +1,440 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#include "RowStream.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <sstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CEP_STREAM_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	const size_t ChunkSize = 1 << 20;
+	// Mapped bytes consumed before they are given back
+	const size_t ReleaseSize = 64 << 20;
+
+	bool little_endian()
+	{
+		const std::uint16_t probe = 1;
+		return 1 == *reinterpret_cast<const unsigned char*>(&probe);
+	}
+
+	void swap_bytes(char* ioBytes)
+	{
+		std::reverse(ioBytes, ioBytes + sizeof(double));
+	}
+
+	bool is_blank(char iChar) { return iChar == ' ' || iChar == '\t'; }
+
+	// Fields of a header, spaces and quotes around them removed
+	std::string trim(const char* iBegin, const char* iEnd)
+	{
+		while(iBegin != iEnd && is_blank(*iBegin)) ++iBegin;
+		while(iEnd != iBegin && is_blank(iEnd[-1])) --iEnd;
+		if(iEnd - iBegin >= 2 && *iBegin == '"' && iEnd[-1] == '"') { ++iBegin; --iEnd; }
+		return std::string(iBegin, iEnd);
+	}
+
+	// Numbers the fast path cannot round exactly
+	bool parse_slowly(const char* iBegin, const char* iEnd, double& oValue)
+	{
+		std::string text(iBegin, iEnd);
+		char* stop = nullptr;
+		oValue = std::strtod(text.c_str(), &stop);
+		return stop == text.c_str() + text.size();
+	}
+}
+
+InputBuffer::InputBuffer() : m_file(nullptr), m_mapping(nullptr), m_mapped(0), m_released(nullptr), m_begin(nullptr), m_end(nullptr) {}
+
+InputBuffer::~InputBuffer() { close(); }
+
+void InputBuffer::close()
+{
+	if(m_file && m_file != stdin) std::fclose(m_file);
+#ifdef CEP_STREAM_MMAP
+	if(m_mapping) munmap(m_mapping, m_mapped);
+#endif
+	m_file = nullptr;
+	m_mapping = nullptr;
+	m_mapped = 0;
+	m_released = m_begin = m_end = nullptr;
+}
+
+bool InputBuffer::open(const std::string& iPath)
+{
+	close();
+	if(iPath == "-")
+	{
+		m_file = stdin;
+		return true;
+	}
+#ifdef CEP_STREAM_MMAP
+	// Pipes and other special files are read as streams
+	int fd = ::open(iPath.c_str(), O_RDONLY);
+	if(fd < 0) return false;
+	struct stat status;
+	if(fstat(fd, &status) == 0 && S_ISREG(status.st_mode))
+	{
+		m_mapped = static_cast<size_t>(status.st_size);
+		void* data = m_mapped ? mmap(nullptr, m_mapped, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+		::close(fd);
+		if(data == MAP_FAILED)
+		{
+			m_mapped = 0;
+			return false;
+		}
+		if(data) madvise(data, m_mapped, MADV_SEQUENTIAL);
+		m_mapping = data;
+		m_released = m_begin = static_cast<const char*>(data);
+		m_end = m_begin + m_mapped;
+		return true;
+	}
+	::close(fd);
+#endif
+	m_file = std::fopen(iPath.c_str(), "rb");
+	return m_file != nullptr;
+}
+
+void InputBuffer::consume(const char* iPosition)
+{
+	m_begin = iPosition;
+#ifdef CEP_STREAM_MMAP
+	if(m_mapping && static_cast<size_t>(m_begin - m_released) >= ReleaseSize)
+	{
+		const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		const char* base = static_cast<const char*>(m_mapping);
+		const char* until = base + static_cast<size_t>(m_begin - base) / page * page;
+		madvise(const_cast<char*>(m_released), static_cast<size_t>(until - m_released), MADV_DONTNEED);
+		m_released = until;
+	}
+#endif
+}
+
+bool InputBuffer::more()
+{
+	if(!m_file) return false;
+	size_t kept = static_cast<size_t>(m_end - m_begin);
+	if(m_buffer.empty()) m_buffer.resize(ChunkSize);
+	else if(kept == m_buffer.size())
+	{
+		// A record longer than the buffer
+		size_t offset = static_cast<size_t>(m_begin - m_buffer.data());
+		m_buffer.resize(m_buffer.size() * 2);
+		m_begin = m_buffer.data() + offset;
+	}
+	if(kept) std::memmove(m_buffer.data(), m_begin, kept);
+	size_t read = std::fread(m_buffer.data() + kept, 1, m_buffer.size() - kept, m_file);
+	m_begin = m_buffer.data();
+	m_end = m_begin + kept + read;
+	return read > 0;
+}
+
+void RowReader::select(const std::vector<size_t>& iColumns)
+{
+	m_targets.assign(m_columns.size(), -1);
+	for(size_t target = 0; target < iColumns.size(); ++target) m_targets[iColumns[target]] = static_cast<int>(target);
+}
+
+void RowReader::fail(const std::string& iMessage)
+{
+	m_error = iMessage;
+}
+
+CsvReader::CsvReader(InputBuffer& ioInput, char iDelimiter) : RowReader(ioInput), m_delimiter(iDelimiter) {}
+
+bool CsvReader::next_line(const char*& oBegin, const char*& oEnd)
+{
+	for(;;)
+	{
+		size_t available = static_cast<size_t>(m_input.end() - m_input.begin());
+		const void* newline = available ? std::memchr(m_input.begin(), '\n', available) : nullptr;
+		if(newline)
+		{
+			oBegin = m_input.begin();
+			oEnd = static_cast<const char*>(newline);
+			return true;
+		}
+		if(m_input.more()) continue;
+		// The last line may miss its end of line
+		if(!available) return false;
+		oBegin = m_input.begin();
+		oEnd = m_input.end();
+		return true;
+	}
+}
+
+bool CsvReader::start()
+{
+	const char* begin;
+	const char* end;
+	if(!next_line(begin, end))
+	{
+		fail("No header line");
+		return false;
+	}
+	m_input.consume(end == m_input.end() ? end : end + 1);
+	m_row = 1;
+	if(end != begin && end[-1] == '\r') --end;
+	for(const char* field = begin;;)
+	{
+		const char* stop = std::find(field, end, m_delimiter);
+		m_columns.push_back(trim(field, stop));
+		if(stop == end) break;
+		field = stop + 1;
+	}
+	m_targets.assign(m_columns.size(), -1);
+	return true;
+}
+
+size_t CsvReader::read(double* const* oColumns, size_t iCapacity)
+{
+	if(!m_error.empty()) return 0;
+	size_t rows = 0;
+	const char* begin;
+	const char* end;
+	while(rows < iCapacity && next_line(begin, end))
+	{
+		const char* next = end == m_input.end() ? end : end + 1;
+		++m_row;
+		if(end != begin && end[-1] == '\r') --end;
+		if(std::find_if(begin, end, [](char c) { return !is_blank(c); }) == end)
+		{
+			m_input.consume(next);
+			continue;
+		}
+
+		size_t column = 0;
+		for(const char* field = begin;; ++column)
+		{
+			const void* found = std::memchr(field, m_delimiter, static_cast<size_t>(end - field));
+			const char* stop = found ? static_cast<const char*>(found) : end;
+			if(column < m_columns.size())
+			{
+				int target = m_targets[column];
+				if(target >= 0 && !parse_number(field, stop, oColumns[target][rows]))
+				{
+					std::ostringstream message;
+					message << "Line " << m_row << ": " << m_columns[column] << " is not a number";
+					fail(message.str());
+					return rows;
+				}
+			}
+			if(stop == end) break;
+			field = stop + 1;
+		}
+		if(column + 1 != m_columns.size())
+		{
+			std::ostringstream message;
+			message << "Line " << m_row << ": " << column + 1 << " fields instead of " << m_columns.size();
+			fail(message.str());
+			return rows;
+		}
+		m_input.consume(next);
+		++rows;
+	}
+	return rows;
+}
+
+// Up to 19 digits are gathered in an integer. When it holds in the 53 bits of a double
+// and the power of ten is exact, a single rounded operation gives the closest double,
+// as strtod does. Other numbers, and words such as nan or inf, are left to strtod.
+bool CsvReader::parse_number(const char* iBegin, const char* iEnd, double& oValue)
+{
+	static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	while(iBegin != iEnd && is_blank(*iBegin)) ++iBegin;
+	while(iEnd != iBegin && is_blank(iEnd[-1])) --iEnd;
+	if(iBegin == iEnd)
+	{
+		oValue = std::numeric_limits<double>::quiet_NaN();
+		return true;
+	}
+
+	const char* iter = iBegin;
+	bool negative = *iter == '-';
+	if(*iter == '-' || *iter == '+') ++iter;
+	std::uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	bool any = false, exact = true;
+	for(; iter != iEnd && *iter >= '0' && *iter <= '9'; ++iter)
+	{
+		any = true;
+		if(!mantissa && *iter == '0') continue;
+		if(digits++ < 19) mantissa = mantissa * 10 + static_cast<unsigned>(*iter - '0');
+		else exact = false;
+	}
+	if(iter != iEnd && *iter == '.')
+	{
+		for(++iter; iter != iEnd && *iter >= '0' && *iter <= '9'; ++iter)
+		{
+			any = true;
+			if(!mantissa && *iter == '0') { --exponent; continue; }
+			if(digits++ < 19)
+			{
+				mantissa = mantissa * 10 + static_cast<unsigned>(*iter - '0');
+				--exponent;
+			}
+			else exact = false;
+		}
+	}
+	if(any && iter != iEnd && (*iter == 'e' || *iter == 'E'))
+	{
+		++iter;
+		bool negative_exponent = iter != iEnd && *iter == '-';
+		if(iter != iEnd && (*iter == '-' || *iter == '+')) ++iter;
+		if(iter == iEnd || *iter < '0' || *iter > '9') return false;
+		int written = 0;
+		for(; iter != iEnd && *iter >= '0' && *iter <= '9'; ++iter)
+			if(written < 100000) written = written * 10 + (*iter - '0');
+		exponent += negative_exponent ? -written : written;
+	}
+	if(!any || iter != iEnd) return parse_slowly(iBegin, iEnd, oValue);
+
+	if(exact && !mantissa)
+	{
+		oValue = negative ? -0. : 0.;
+		return true;
+	}
+	if(exact && mantissa <= (std::uint64_t(1) << 53) && exponent >= -22 && exponent <= 22)
+	{
+		double value = static_cast<double>(mantissa);
+		value = exponent < 0 ? value / powers[-exponent] : value * powers[exponent];
+		oValue = negative ? -value : value;
+		return true;
+	}
+	return parse_slowly(iBegin, iEnd, oValue);
+}
+
+BinaryReader::BinaryReader(InputBuffer& ioInput, const std::vector<std::string>& iColumns) : RowReader(ioInput)
+{
+	m_columns = iColumns;
+	m_targets.assign(m_columns.size(), -1);
+}
+
+size_t BinaryReader::read(double* const* oColumns, size_t iCapacity)
+{
+	const size_t width = m_columns.size() * sizeof(double);
+	if(!m_error.empty() || !width) return 0;
+	const bool swap = !little_endian();
+	size_t rows = 0;
+	while(rows < iCapacity)
+	{
+		size_t available = static_cast<size_t>(m_input.end() - m_input.begin());
+		if(available < width)
+		{
+			if(m_input.more()) continue;
+			if(!available) break;
+			std::ostringstream message;
+			message << "Row " << m_row + 1 << ": " << available << " bytes instead of " << width;
+			fail(message.str());
+			return rows;
+		}
+
+		size_t count = std::min(iCapacity - rows, available / width);
+		const char* record = m_input.begin();
+		for(size_t row = rows; row < rows + count; ++row, record += width)
+		{
+			for(size_t column = 0; column < m_targets.size(); ++column)
+			{
+				if(m_targets[column] < 0) continue;
+				double* value = oColumns[m_targets[column]] + row;
+				std::memcpy(value, record + column * sizeof(double), sizeof(double));
+				if(swap) swap_bytes(reinterpret_cast<char*>(value));
+			}
+		}
+		m_input.consume(record);
+		rows += count;
+		m_row += count;
+	}
+	return rows;
+}
+
+RowWriter::RowWriter(std::FILE* oFile, bool iBinary, char iDelimiter, int iPrecision)
+: m_file(oFile), m_binary(iBinary), m_delimiter(iDelimiter), m_precision(iPrecision), m_buffer(ChunkSize), m_used(0), m_failed(false) {}
+
+RowWriter::~RowWriter() { flush(); }
+
+void RowWriter::header(const std::vector<std::string>& iNames)
+{
+	if(m_binary) return;
+	std::string line;
+	for(size_t index = 0; index < iNames.size(); ++index)
+		line += (index ? std::string(1, m_delimiter) : std::string()) + iNames[index];
+	line += '\n';
+	flush();
+	m_failed = std::fwrite(line.data(), 1, line.size(), m_file) != line.size() || m_failed;
+}
+
+void RowWriter::write(const double* const* iColumns, size_t iCount, size_t iRows)
+{
+	const bool swap = !little_endian();
+	for(size_t row = 0; row < iRows; ++row)
+	{
+		for(size_t column = 0; column < iCount; ++column)
+		{
+			if(m_binary)
+			{
+				reserve(sizeof(double));
+				char* bytes = &m_buffer[m_used];
+				std::memcpy(bytes, iColumns[column] + row, sizeof(double));
+				if(swap) swap_bytes(bytes);
+				m_used += sizeof(double);
+			}
+			else
+			{
+				reserve(32);
+				if(column) m_buffer[m_used++] = m_delimiter;
+				format(iColumns[column][row]);
+			}
+		}
+		if(!m_binary) m_buffer[m_used++] = '\n';
+	}
+}
+
+// Integers are written by hand, being the most common and the slowest for snprintf
+void RowWriter::format(double iValue)
+{
+	char* out = &m_buffer[m_used];
+	if(iValue == std::floor(iValue) && std::fabs(iValue) < 1e15 && !(iValue == 0. && std::signbit(iValue)))
+	{
+		char digits[16];
+		int count = 0;
+		std::uint64_t integer = static_cast<std::uint64_t>(std::fabs(iValue));
+		do { digits[count++] = static_cast<char>('0' + integer % 10); integer /= 10; } while(integer);
+		if(iValue < 0.) *out++ = '-';
+		while(count) *out++ = digits[--count];
+		m_used = static_cast<size_t>(out - m_buffer.data());
+		return;
+	}
+	int written = std::snprintf(out, 31, "%.*g", m_precision, iValue);
+	m_used += static_cast<size_t>(std::max(0, std::min(written, 30)));
+}
+
+bool RowWriter::flush()
+{
+	if(m_used)
+	{
+		m_failed = std::fwrite(m_buffer.data(), 1, m_used, m_file) != m_used || m_failed;
+		m_used = 0;
+	}
+	return 0 == std::fflush(m_file) && !m_failed;
+}
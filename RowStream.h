@@ -0,0 +1,143 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+#ifndef CEP_ROWSTREAM_H_
+#define CEP_ROWSTREAM_H_
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/** Bytes of an input, read from a file mapped in memory or from a stream by chunks.
+ *
+ * A mapped file is available at once, and the pages consumed are handed back to
+ * the system as reading goes, so memory stays bounded whatever the size of the
+ * file. Streams, and files that cannot be mapped, are read in a buffer which only
+ * grows to hold the longest record. */
+class InputBuffer
+{
+public:
+	InputBuffer();
+	~InputBuffer();
+
+	// "-" reads the standard input
+	bool open(const std::string& iPath);
+	const char* begin() const { return m_begin; }
+	const char* end() const { return m_end; }
+	// Moves the beginning to iPosition, in [begin(), end()]
+	void consume(const char* iPosition);
+	// Reads more bytes after end(), keeping the ones not consumed. False at the end of the input
+	bool more();
+
+private:
+	InputBuffer(const InputBuffer&);
+	InputBuffer& operator= (const InputBuffer&);
+
+	void close();
+
+	std::FILE* m_file;
+	void* m_mapping;
+	size_t m_mapped;
+	const char* m_released;  // Mapped pages before it were given back
+	std::vector<char> m_buffer;
+	const char* m_begin;
+	const char* m_end;
+};
+
+/** Rows of numeric columns, read by blocks into one array per column.
+ *
+ * Only the columns selected are decoded, the others are skipped. Reading stops at
+ * the first malformed row, described by error(). */
+class RowReader
+{
+public:
+	explicit RowReader(InputBuffer& ioInput) : m_input(ioInput), m_row(0) {}
+	virtual ~RowReader() {}
+
+	const std::vector<std::string>& columns() const { return m_columns; }
+	// Column iColumns[k] of the input is written to the k-th array given to read()
+	void select(const std::vector<size_t>& iColumns);
+	// Reads up to iCapacity rows, returns how many, 0 at the end of the input or after an error.
+	// Rows before a malformed one are returned first.
+	virtual size_t read(double* const* oColumns, size_t iCapacity) = 0;
+	const std::string& error() const { return m_error; }
+
+protected:
+	void fail(const std::string& iMessage);
+
+	InputBuffer& m_input;
+	std::vector<std::string> m_columns;
+	std::vector<int> m_targets;  // By input column, the array it goes to or -1
+	size_t m_row;
+	std::string m_error;
+
+private:
+	RowReader(const RowReader&);
+	RowReader& operator= (const RowReader&);
+};
+
+/** Text rows with a header line naming the columns, fields parsed in place.
+ *
+ * Fields are decimal numbers, spaces around them are ignored and empty ones read
+ * as NaN. Lines may end with "\r\n", blank lines are skipped. */
+class CsvReader : public RowReader
+{
+public:
+	CsvReader(InputBuffer& ioInput, char iDelimiter = ',');
+	// Reads the header
+	bool start();
+	virtual size_t read(double* const* oColumns, size_t iCapacity);
+
+	// Parses a whole field, exactly as strtod does
+	static bool parse_number(const char* iBegin, const char* iEnd, double& oValue);
+
+private:
+	bool next_line(const char*& oBegin, const char*& oEnd);
+
+	char m_delimiter;
+};
+
+/** Rows of raw little-endian doubles, one after the other, the columns being named by the caller. */
+class BinaryReader : public RowReader
+{
+public:
+	BinaryReader(InputBuffer& ioInput, const std::vector<std::string>& iColumns);
+	virtual size_t read(double* const* oColumns, size_t iCapacity);
+};
+
+/** Writes rows of results as text or raw little-endian doubles, through a buffer of its own. */
+class RowWriter
+{
+public:
+	// Precision is the number of significant digits of the text, 17 reading back the same doubles
+	RowWriter(std::FILE* oFile, bool iBinary, char iDelimiter = ',', int iPrecision = 17);
+	~RowWriter();
+
+	// Text only
+	void header(const std::vector<std::string>& iNames);
+	// Row r is made of iColumns[c][r] for each of the iCount columns
+	void write(const double* const* iColumns, size_t iCount, size_t iRows);
+	bool flush();
+
+private:
+	RowWriter(const RowWriter&);
+	RowWriter& operator= (const RowWriter&);
+
+	void format(double iValue);
+	void reserve(size_t iBytes) { if(m_buffer.size() - m_used < iBytes) flush(); }
+
+	std::FILE* m_file;
+	bool m_binary;
+	char m_delimiter;
+	int m_precision;
+	std::vector<char> m_buffer;
+	size_t m_used;
+	bool m_failed;
+};
+
+#endif /* CEP_ROWSTREAM_H_ */
@@ -0,0 +1,292 @@
+/* This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/** @author: Jean-Bernard Jansen <jeanbernard@jjansen.fr> */
+
+// Evaluates expressions over the rows of a CSV or binary input, see usage()
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <CompactExpressionParser/Expression.h>
+#include <CompactExpressionParser/Program.h>
+#include "RowStream.h"
+
+using CompactExpressionParser::ArgumentSpan;
+using CompactExpressionParser::Expression;
+using CompactExpressionParser::ResultType;
+
+namespace
+{
+	typedef double (*UnaryFunction)(double);
+	typedef double (*BinaryFunction)(double, double);
+
+	void check_arity(const char* iName, const ArgumentSpan& iArgs, size_t iArity)
+	{
+		if(iArgs.size() != iArity)
+			throw std::invalid_argument(std::string(iName) + " takes " + std::to_string(iArity) + " argument(s)");
+	}
+
+	struct Unary
+	{
+		const char* m_name;
+		UnaryFunction m_func;
+		ResultType operator()(const ArgumentSpan& iArgs) const { check_arity(m_name, iArgs, 1); return m_func(iArgs[0]); }
+	};
+
+	struct VectorUnary
+	{
+		UnaryFunction m_func;
+		void operator()(const double* const* iArgs, size_t iCount, double* oResults) const
+		{
+			for(size_t index = 0; index < iCount; ++index) oResults[index] = m_func(iArgs[0][index]);
+		}
+	};
+
+	struct Binary
+	{
+		const char* m_name;
+		BinaryFunction m_func;
+		ResultType operator()(const ArgumentSpan& iArgs) const { check_arity(m_name, iArgs, 2); return m_func(iArgs[0], iArgs[1]); }
+	};
+
+	struct VectorBinary
+	{
+		BinaryFunction m_func;
+		void operator()(const double* const* iArgs, size_t iCount, double* oResults) const
+		{
+			for(size_t index = 0; index < iCount; ++index) oResults[index] = m_func(iArgs[0][index], iArgs[1][index]);
+		}
+	};
+
+	double minimum(double a, double b) { return std::fmin(a, b); }
+	double maximum(double a, double b) { return std::fmax(a, b); }
+	double pi() { return std::atan2(0., -1.); }
+
+	// Pure, so calls with constant arguments are folded when compiling
+	void register_functions(Expression& ioExp)
+	{
+		using CompactExpressionParser::Pure;
+		using CompactExpressionParser::SpanFunctionType;
+		using CompactExpressionParser::VectorFunctionType;
+
+		static const struct { const char* name; UnaryFunction func; } unary[] = {
+			{ "sin", std::sin }, { "cos", std::cos }, { "tan", std::tan }, { "asin", std::asin }, { "acos", std::acos },
+			{ "atan", std::atan }, { "sinh", std::sinh }, { "cosh", std::cosh }, { "tanh", std::tanh }, { "exp", std::exp },
+			{ "log", std::log }, { "log10", std::log10 }, { "sqrt", std::sqrt }, { "abs", std::fabs }, { "floor", std::floor },
+			{ "ceil", std::ceil }, { "round", std::round } };
+		static const struct { const char* name; BinaryFunction func; } binary[] = {
+			{ "atan2", std::atan2 }, { "pow", std::pow }, { "hypot", std::hypot }, { "fmod", std::fmod },
+			{ "min", minimum }, { "max", maximum } };
+
+		for(const auto& function : unary)
+		{
+			Unary scalar = { function.name, function.func };
+			VectorUnary vector = { function.func };
+			ioExp.register_function(function.name, SpanFunctionType(scalar), VectorFunctionType(vector), Pure);
+		}
+		for(const auto& function : binary)
+		{
+			Binary scalar = { function.name, function.func };
+			VectorBinary vector = { function.func };
+			ioExp.register_function(function.name, SpanFunctionType(scalar), VectorFunctionType(vector), Pure);
+		}
+		ioExp.register_function("Pi", SpanFunctionType([](const ArgumentSpan& iArgs) { check_arity("Pi", iArgs, 0); return ResultType(pi()); }), Pure);
+	}
+
+	void usage(const char* iProgram)
+	{
+		std::cerr << "Usage: " << iProgram << " [options] [name=]expression..." << std::endl
+			<< "Evaluates the expressions on every row of the input, variables being read from the columns of the same name." << std::endl
+			<< "The input is a CSV file with a header line, unless --binary is given." << std::endl << std::endl
+			<< "  --input <file>        reads the file, mapped in memory, instead of the standard input" << std::endl
+			<< "  --output <file>       writes the results to the file instead of the standard output" << std::endl
+			<< "  --binary <columns>    input rows are raw little-endian doubles of the columns, separated by commas" << std::endl
+			<< "  --binary-output       writes the results as raw little-endian doubles, without header" << std::endl
+			<< "  --delimiter <char>    of text fields, ',' by default" << std::endl
+			<< "  --precision <digits>  significant digits of text results, from 1 to 17 (the default)" << std::endl
+			<< "  --block <rows>        rows read and evaluated at once, 16384 by default" << std::endl;
+	}
+
+	// "name=expression", an expression being its own name otherwise
+	void split_definition(const std::string& iArgument, std::string& oName, std::string& oExpression)
+	{
+		size_t equal = iArgument.find('=');
+		bool named = equal != std::string::npos && equal > 0 && (equal + 1 == iArgument.size() || iArgument[equal + 1] != '=');
+		for(size_t index = 0; named && index < equal; ++index)
+			named = std::isalnum(static_cast<unsigned char>(iArgument[index])) || iArgument[index] == '_';
+		oName = named ? iArgument.substr(0, equal) : iArgument;
+		oExpression = named ? iArgument.substr(equal + 1) : iArgument;
+	}
+
+	std::vector<std::string> split_names(const std::string& iList)
+	{
+		std::vector<std::string> names;
+		size_t begin = 0;
+		for(size_t comma; (comma = iList.find(',', begin)) != std::string::npos; begin = comma + 1)
+			names.push_back(iList.substr(begin, comma - begin));
+		names.push_back(iList.substr(begin));
+		return names;
+	}
+
+	int run(int argc, char** argv)
+	{
+		std::string input = "-", output, binary_columns;
+		bool binary_input = false, binary_output = false;
+		char delimiter = ',';
+		int precision = 17;
+		size_t block = 1 << 14;
+		std::vector<std::string> definitions;
+		for(int arg = 1; arg < argc; ++arg)
+		{
+			std::string option = argv[arg];
+			if(option == "--binary-output") binary_output = true;
+			else if(option.compare(0, 2, "--") == 0)
+			{
+				if(arg + 1 == argc)
+				{
+					usage(argv[0]);
+					return 1;
+				}
+				std::string value = argv[++arg];
+				if(option == "--input") input = value;
+				else if(option == "--output") output = value;
+				else if(option == "--binary") { binary_input = true; binary_columns = value; }
+				else if(option == "--delimiter" && value.size() == 1) delimiter = value[0];
+				else if(option == "--precision") precision = std::atoi(value.c_str());
+				else if(option == "--block") block = static_cast<size_t>(std::atol(value.c_str()));
+				else
+				{
+					usage(argv[0]);
+					return 1;
+				}
+			}
+			else definitions.push_back(option);
+		}
+		if(definitions.empty() || precision < 1 || precision > 17 || !block)
+		{
+			usage(argv[0]);
+			return 1;
+		}
+
+		// Every expression shares the functions and the variables of the first one
+		Expression prototype;
+		register_functions(prototype);
+		std::vector<std::string> names;
+		std::vector< std::unique_ptr<Expression> > expressions;
+		std::vector<std::string> variables;
+		for(const std::string& definition : definitions)
+		{
+			std::string name, source;
+			split_definition(definition, name, source);
+			expressions.emplace_back(new Expression(prototype));
+			if(!expressions.back()->compile(source))
+			{
+				std::cerr << "Cannot compile " << source << std::endl;
+				return 1;
+			}
+			names.push_back(name);
+			for(const CompactExpressionParser::ProgramVariable& variable : expressions.back()->program()->variables())
+				if(std::find(variables.begin(), variables.end(), variable.name) == variables.end()) variables.push_back(variable.name);
+		}
+
+		InputBuffer buffer;
+		if(!buffer.open(input))
+		{
+			std::cerr << "Cannot read " << input << std::endl;
+			return 1;
+		}
+		std::unique_ptr<RowReader> reader;
+		if(binary_input) reader.reset(new BinaryReader(buffer, split_names(binary_columns)));
+		else
+		{
+			CsvReader* csv = new CsvReader(buffer, delimiter);
+			reader.reset(csv);
+			if(!csv->start())
+			{
+				std::cerr << reader->error() << std::endl;
+				return 1;
+			}
+		}
+
+		// Only the columns read by the expressions are decoded
+		std::vector<size_t> selected;
+		for(const std::string& variable : variables)
+		{
+			const std::vector<std::string>& columns = reader->columns();
+			std::vector<std::string>::const_iterator found = std::find(columns.begin(), columns.end(), variable);
+			if(found == columns.end())
+			{
+				std::cerr << "No column named " << variable << std::endl;
+				return 1;
+			}
+			selected.push_back(static_cast<size_t>(found - columns.begin()));
+		}
+		reader->select(selected);
+
+		std::vector<double> inputs(variables.size() * block), results(expressions.size() * block);
+		std::vector<double*> input_columns, result_columns;
+		std::vector<CompactExpressionParser::Column> bound;
+		for(size_t index = 0; index < variables.size(); ++index)
+		{
+			input_columns.push_back(inputs.data() + index * block);
+			CompactExpressionParser::Column column = { variables[index], input_columns.back() };
+			bound.push_back(column);
+		}
+		for(size_t index = 0; index < expressions.size(); ++index) result_columns.push_back(results.data() + index * block);
+
+		std::FILE* file = output.empty() ? stdout : std::fopen(output.c_str(), "wb");
+		if(!file)
+		{
+			std::cerr << "Cannot write " << output << std::endl;
+			return 1;
+		}
+		bool written;
+		{
+			RowWriter writer(file, binary_output, delimiter, precision);
+			writer.header(names);
+			while(size_t rows = reader->read(input_columns.data(), block))
+			{
+				for(size_t index = 0; index < expressions.size(); ++index)
+					expressions[index]->eval_batch(bound, rows, result_columns[index]);
+				writer.write(result_columns.data(), result_columns.size(), rows);
+			}
+			written = writer.flush();
+		}
+		if(file != stdout) written = 0 == std::fclose(file) && written;
+		if(!reader->error().empty())
+		{
+			std::cerr << reader->error() << std::endl;
+			return 1;
+		}
+		if(!written)
+		{
+			std::cerr << "Cannot write " << (output.empty() ? "the results" : output) << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		return run(argc, argv);
+	}
+	catch(const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+}